@@ -0,0 +1,90 @@
+#include "access_trace.h"
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <stdexcept>
+
+namespace nesem {
+
+AccessTrace::AccessTrace(size_t capacity)
+    : records(std::bit_ceil(std::max<size_t>(capacity, 8))),
+      mask(records.size() - 1),
+      wake_mask(records.size() / 8 - 1) {}
+
+size_t AccessTrace::pop(AccessRecord *out, size_t max) {
+  size_t head = this->head.load(std::memory_order_relaxed);
+  size_t tail = this->tail.load(std::memory_order_acquire);
+  size_t count = std::min(tail - head, max);
+  for (size_t i = 0; i < count; ++i) out[i] = records[(head + i) & mask];
+  this->head.store(head + count, std::memory_order_release);
+  return count;
+}
+
+static void encode(const AccessRecord &record, uint8_t *out) {
+  for (int i = 0; i < 8; ++i) *out++ = record.cycle >> (i * 8);
+  *out++ = record.addr;
+  *out++ = record.addr >> 8;
+  *out++ = record.pc;
+  *out++ = record.pc >> 8;
+  *out++ = record.data;
+  *out++ = static_cast<uint8_t>(record.kind);
+}
+
+static AccessRecord decode(const uint8_t *in) {
+  AccessRecord record = {};
+  for (int i = 0; i < 8; ++i) record.cycle |= uint64_t(*in++) << (i * 8);
+  record.addr = in[0] | (in[1] << 8);
+  record.pc = in[2] | (in[3] << 8);
+  record.data = in[4];
+  record.kind = static_cast<AccessKind>(in[5]);
+  return record;
+}
+
+AccessTraceWriter::AccessTraceWriter(AccessTrace *trace,
+                                     const std::string &path)
+    : trace(trace), out(path, std::ios::binary | std::ios::trunc) {
+  if (!out)
+    throw std::runtime_error(
+        fmt::format("Failed to open access trace file {}", path));
+  thread = std::thread(&AccessTraceWriter::run, this);
+}
+
+AccessTraceWriter::~AccessTraceWriter() {
+  stopping.store(true, std::memory_order_release);
+  trace->wake();
+  thread.join();
+}
+
+void AccessTraceWriter::run() {
+  constexpr size_t kBatch = 4096;
+  std::vector<AccessRecord> batch(kBatch);
+  std::vector<uint8_t> bytes(kBatch * kAccessRecordSize);
+  for (;;) {
+    // Records pushed before the writer was stopped are drained first, and
+    // wakeups during the drain are not missed
+    uint32_t wakeups = trace->wakeup_count();
+    bool stop = stopping.load(std::memory_order_acquire);
+    while (size_t count = trace->pop(batch.data(), kBatch)) {
+      for (size_t i = 0; i < count; ++i)
+        encode(batch[i], &bytes[i * kAccessRecordSize]);
+      out.write(reinterpret_cast<const char *>(bytes.data()),
+                count * kAccessRecordSize);
+    }
+    if (stop) break;
+    trace->wait(wakeups);
+  }
+  out.flush();
+}
+
+std::vector<AccessRecord> read_access_trace(std::istream &in) {
+  std::vector<AccessRecord> records;
+  std::array<uint8_t, kAccessRecordSize> bytes;
+  while (in.read(reinterpret_cast<char *>(bytes.data()), bytes.size()))
+    records.push_back(decode(bytes.data()));
+  return records;
+}
+
+}  // namespace nesem
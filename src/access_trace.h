@@ -0,0 +1,135 @@
+// Recording of the accesses of the cpu to the bus, for post-mortem analysis.
+//
+// The mmu of a debug NES (DebugNesMmu) pushes a record of each access into an
+// AccessTrace: a fixed-size ring buffer with a single producer and a single
+// consumer, which never takes a lock. The cpu never waits for the consumer
+// either: records pushed while the buffer is full are dropped and counted.
+// An AccessTraceWriter drains the buffer from its own thread into a file,
+// kAccessRecordSize bytes per record. The writer sleeps until the producer
+// wakes it, each time an eighth of the buffer fills up, so that it starts
+// draining long before the buffer is full. A frame makes fewer accesses
+// than it has cpu cycles, so the default buffer holds two frames.
+//
+// Instruction fetches served by the decode cache of the cpu do not reach the
+// bus, and are not recorded. Neither are the reads it makes ahead of
+// execution to decode blocks, which bypass the bus.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <istream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace nesem {
+
+enum class AccessKind : uint8_t {
+  Read,
+  Write,
+};
+
+struct AccessRecord {
+  uint64_t cycle;  // cpu cycle of the access, or of the instruction fetched
+  uint16_t addr;
+  uint16_t pc;     // start of the instruction making the access
+  uint8_t data;    // data read or written
+  AccessKind kind;
+
+  bool operator==(const AccessRecord &other) const = default;
+};
+
+// Size of a record in a trace file: the fields of AccessRecord in order,
+// little-endian
+inline constexpr size_t kAccessRecordSize = 14;
+
+class AccessTrace {
+ public:
+  // Hold up to capacity records, rounded up to a power of two
+  explicit AccessTrace(size_t capacity = 1 << 16);
+  AccessTrace(const AccessTrace &) = delete;
+
+  // Called by the producer only. Returns false if the buffer is full, in
+  // which case the record is dropped.
+  bool push(const AccessRecord &record) {
+    size_t tail = this->tail.load(std::memory_order_relaxed);
+    if (tail - cached_head == records.size()) {
+      cached_head = head.load(std::memory_order_acquire);
+      if (tail - cached_head == records.size()) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        wake();
+        return false;
+      }
+    }
+    records[tail & mask] = record;
+    this->tail.store(tail + 1, std::memory_order_release);
+    if (((tail + 1) & wake_mask) == 0) wake();
+    return true;
+  }
+
+  // Called by the consumer only. Move up to max of the oldest records into
+  // out, and return their number.
+  size_t pop(AccessRecord *out, size_t max);
+
+  size_t capacity() const { return records.size(); }
+
+  // Wake the consumer, if it waits
+  void wake() {
+    wakeups.fetch_add(1, std::memory_order_release);
+    wakeups.notify_one();
+  }
+
+  // Number of wakeups so far. The consumer reads it before draining the
+  // buffer, and then waits for it to move.
+  uint32_t wakeup_count() const {
+    return wakeups.load(std::memory_order_acquire);
+  }
+  void wait(uint32_t wakeup_count) const {
+    wakeups.wait(wakeup_count, std::memory_order_acquire);
+  }
+
+  // Number of records dropped so far because the buffer was full
+  uint64_t dropped_count() const {
+    return dropped.load(std::memory_order_relaxed);
+  }
+
+ private:
+  std::vector<AccessRecord> records;
+  size_t mask;
+  size_t wake_mask;  // an eighth of the buffer
+
+  // Count of records pushed, its last value seen by the producer, and the
+  // count of records popped, kept on separate cache lines for each side
+  alignas(64) std::atomic<size_t> tail = 0;
+  size_t cached_head = 0;
+  std::atomic<uint64_t> dropped = 0;
+  alignas(64) std::atomic<size_t> head = 0;
+  std::atomic<uint32_t> wakeups = 0;
+};
+
+class AccessTraceWriter {
+ public:
+  // Start draining the trace into the file at path, which is created or
+  // truncated. Throws if it cannot be opened.
+  AccessTraceWriter(AccessTrace *trace, const std::string &path);
+  AccessTraceWriter(const AccessTraceWriter &) = delete;
+
+  // Drain the records pushed so far, and close the file
+  ~AccessTraceWriter();
+
+ private:
+  AccessTrace *trace;
+  std::ofstream out;
+  std::atomic<bool> stopping = false;
+  std::thread thread;
+
+  void run();
+};
+
+// Read back the records of a trace file
+std::vector<AccessRecord> read_access_trace(std::istream &in);
+
+}  // namespace nesem
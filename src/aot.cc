@@ -0,0 +1,44 @@
+#include "aot.h"
+
+#include <algorithm>
+
+namespace nesem {
+
+AotEngine::AotEngine(const AotProgram &program, NesMmu *mmu) : mmu(mmu) {
+  if (program.prg_size != mmu->prg->size() ||
+      !std::equal(mmu->prg->begin(), mmu->prg->end(), program.prg))
+    return;
+  table.resize(0x8000);
+  for (size_t i = 0; i < program.num_blocks; ++i) {
+    const AotBlock &block = program.blocks[i];
+    if (block.start >= 0x8000) table[block.start - 0x8000] = &block;
+  }
+}
+
+bool AotEngine::run(CpuState *cpu, size_t max_cycles,
+                    const DecodeCache *decode_cache) {
+  // Blocks were compiled from the unpatched ROM
+  if (table.empty() || mmu->has_cheats()) return false;
+  if (decode_cache) {
+    for (uint16_t page = 0; page < 0x800; page += 0x100)
+      if (decode_cache->covers(page)) return false;
+  }
+
+  size_t start_cycles = cpu->cycles;
+  bool ran = false;
+  while (cpu->pc >= 0x8000 && !cpu->interrupt_pending()) {
+    const AotBlock *block = table[cpu->pc - 0x8000];
+    if (!block || cpu->cycles - start_cycles + block->max_cycles > max_cycles)
+      break;
+
+    uint16_t pc = cpu->pc;
+    size_t cycles = cpu->cycles;
+    block->run(*cpu, mmu->wram.data());
+    // Left the block before its first instruction
+    if (cpu->pc == pc && cpu->cycles == cycles) break;
+    ran = true;
+  }
+  return ran;
+}
+
+}  // namespace nesem
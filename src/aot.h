@@ -0,0 +1,160 @@
+// Runtime support for code recompiled ahead of time.
+//
+// For cartridges whose PRG ROM is fixed (mapper 0), nesem_recompile traces
+// the code reachable from the interrupt vectors and translates each basic
+// block into a C++ function. The generated translation unit defines an
+// AotProgram, which is linked into the emulator and attached to a Nes
+// running that same cartridge with Nes::set_aot_program.
+//
+// Blocks only access CPU RAM and PRG ROM directly. An instruction accessing
+// any other address (PPU and APU registers, save RAM) is left to the
+// interpreter, so that it runs once the PPU has caught up. Code that was not
+// discovered by the tool is interpreted as well.
+//
+// Since blocks write to CPU RAM behind the cpu's back, nothing is run while
+// the decode cache of the cpu holds code predecoded from CPU RAM, which
+// these writes would leave stale.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "cpu.h"
+#include "mmu.h"
+
+namespace nesem {
+
+// A basic block translated ahead of time
+struct AotBlock {
+  uint16_t start;       // address of the first instruction
+  uint16_t max_cycles;  // upper bound of the cycles taken by the block
+  // Runs the block on the cpu, leaving the program counter on the next
+  // instruction to execute
+  void (*run)(CpuState &cpu, uint8_t *wram);
+};
+
+// Program translated ahead of time from a specific PRG ROM
+struct AotProgram {
+  const uint8_t *prg;  // PRG ROM the program was translated from
+  size_t prg_size;
+  const AotBlock *blocks;
+  size_t num_blocks;
+};
+
+// Copy of the cpu registers held in a local variable by translated blocks,
+// so that the compiler can keep them in host registers
+struct AotRegs {
+  uint8_t a;
+  uint8_t x;
+  uint8_t y;
+  uint8_t sp;
+  CpuFlags flags;
+  size_t cycles;
+
+  explicit AotRegs(const CpuState &cpu)
+      : a(cpu.a),
+        x(cpu.x),
+        y(cpu.y),
+        sp(cpu.sp),
+        flags(cpu.flags),
+        cycles(cpu.cycles) {}
+
+  // Write the registers back and continue at the address
+  void leave(CpuState &cpu, uint16_t pc) const {
+    cpu.a = a;
+    cpu.x = x;
+    cpu.y = y;
+    cpu.sp = sp;
+    cpu.flags = flags;
+    cpu.cycles = cycles;
+    cpu.pc = pc;
+  }
+
+  void set_nz(uint8_t data) {
+    flags.set_nz(data);
+  }
+
+  void push(uint8_t *wram, uint8_t data) { wram[0x100 + sp--] = data; }
+
+  uint8_t pop(const uint8_t *wram) { return wram[0x100 + ++sp]; }
+
+  void plp(uint8_t bits) { flags.set_bits(bits); }
+
+  void adc(uint8_t data) {
+    uint16_t sum = a + data + flags.carry;
+    flags.carry = sum > 0xFF;
+    uint8_t result = sum;
+    flags.overflow = (data ^ result) & (result ^ a) & 0b10000000;
+    a = result;
+    set_nz(a);
+  }
+
+  void sbc(uint8_t data) { adc(~data); }
+
+  void compare(uint8_t data, uint8_t reg) {
+    flags.carry = data <= reg;
+    set_nz(reg - data);
+  }
+
+  void bit(uint8_t data) {
+    flags.set_nz(data, data & a);
+    flags.overflow = data & 0b01000000;
+  }
+
+  uint8_t asl(uint8_t data) {
+    flags.carry = data & 0b10000000;
+    data <<= 1;
+    set_nz(data);
+    return data;
+  }
+
+  uint8_t lsr(uint8_t data) {
+    flags.carry = data & 0b1;
+    data >>= 1;
+    set_nz(data);
+    return data;
+  }
+
+  uint8_t rol(uint8_t data) {
+    bool c = data & 0b10000000;
+    data = (data << 1) | flags.carry;
+    flags.carry = c;
+    set_nz(data);
+    return data;
+  }
+
+  uint8_t ror(uint8_t data) {
+    bool c = data & 0b1;
+    data = (data >> 1) | (flags.carry << 7);
+    flags.carry = c;
+    set_nz(data);
+    return data;
+  }
+};
+
+// Runs the blocks of a program translated ahead of time
+class AotEngine {
+ public:
+  AotEngine(const AotProgram &program, NesMmu *mmu);
+
+  // Whether the program was translated from the PRG ROM of the mmu
+  bool matches() const { return !table.empty(); }
+
+  // Run translated blocks starting at the cpu's program counter, for as long
+  // as they exist and are guaranteed to finish within the specified number
+  // of cycles. Nothing is run while an interrupt is pending.
+  //
+  // Returns false if no instruction was executed, in which case the caller
+  // should step the interpreter instead.
+  bool run(CpuState *cpu, size_t max_cycles,
+           const DecodeCache *decode_cache = nullptr);
+
+ private:
+  NesMmu *mmu;
+  // Translated blocks, indexed by address - 0x8000
+  std::vector<const AotBlock *> table;
+};
+
+}  // namespace nesem
@@ -0,0 +1,56 @@
+#include "bus_errors.h"
+
+#include <fmt/core.h>
+
+namespace nesem {
+
+static uint64_t count(const std::array<uint64_t, 0x100> &pages, uint16_t lo,
+                      uint16_t hi) {
+  uint64_t total = 0;
+  for (size_t page = lo >> 8; page <= size_t(hi >> 8); ++page)
+    total += pages[page];
+  return total;
+}
+
+uint64_t BusErrors::count_reads(uint16_t lo, uint16_t hi) const {
+  return count(reads, lo, hi);
+}
+
+uint64_t BusErrors::count_writes(uint16_t lo, uint16_t hi) const {
+  return count(writes, lo, hi);
+}
+
+// Print the accesses counted since the last report, one line per range of
+// consecutive pages
+static void report_pages(std::FILE *out, const char *kind,
+                         const std::array<uint64_t, 0x100> &pages,
+                         const std::array<uint64_t, 0x100> &reported) {
+  for (size_t page = 0; page < 0x100;) {
+    if (pages[page] == reported[page]) {
+      ++page;
+      continue;
+    }
+    size_t first = page;
+    uint64_t accesses = 0;
+    // Counts below the reported ones were cleared since
+    for (; page < 0x100 && pages[page] != reported[page]; ++page) {
+      uint64_t since = pages[page] > reported[page] ? reported[page] : 0;
+      accesses += pages[page] - since;
+    }
+    fmt::print(out, "{} invalid {} at {:04X}-{:04X}\n", accesses, kind,
+               first << 8, (page << 8) - 1);
+  }
+}
+
+void BusErrorLog::report(const BusErrors &errors, Clock::time_point now) {
+  if (has_reported && now - last_report < interval) return;
+  if (errors.reads == reported.reads && errors.writes == reported.writes)
+    return;
+  report_pages(out, "reads", errors.reads, reported.reads);
+  report_pages(out, "writes", errors.writes, reported.writes);
+  reported = errors;
+  last_report = now;
+  has_reported = true;
+}
+
+}  // namespace nesem
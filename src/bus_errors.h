@@ -0,0 +1,50 @@
+// Accesses to addresses of the bus that nothing answers to.
+//
+// Some games read or write open bus every frame, so the mmu does not report
+// these accesses as they happen: it only counts them, per page of the address
+// space. BusErrorLog reports the counts that moved, at most once per
+// interval, from wherever the frontend calls it.
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+
+namespace nesem {
+
+struct BusErrors {
+  // Number of invalid accesses to each page of the address space. 64-bit,
+  // so that long runs of games hitting open bus every frame never wrap.
+  std::array<uint64_t, 0x100> reads = {};
+  std::array<uint64_t, 0x100> writes = {};
+
+  // Number of invalid accesses to the pages spanning [lo, hi]
+  uint64_t count_reads(uint16_t lo = 0x0000, uint16_t hi = 0xFFFF) const;
+  uint64_t count_writes(uint16_t lo = 0x0000, uint16_t hi = 0xFFFF) const;
+
+  void clear() { *this = {}; }
+};
+
+class BusErrorLog {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  explicit BusErrorLog(Clock::duration interval = std::chrono::seconds(1),
+                       std::FILE *out = stderr)
+      : interval(interval), out(out) {}
+
+  // Print the ranges of pages whose counts moved since the last report,
+  // unless the last report is more recent than the interval
+  void report(const BusErrors &errors, Clock::time_point now = Clock::now());
+
+ private:
+  Clock::duration interval;
+  std::FILE *out;
+  BusErrors reported;  // counts as of the last report
+  Clock::time_point last_report;
+  bool has_reported = false;
+};
+
+}  // namespace nesem
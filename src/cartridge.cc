@@ -5,6 +5,8 @@
 #include <array>
 #include <cstdlib>
 
+#include "mapper.h"
+
 namespace nesem {
 
 constexpr size_t PRG_ROM_PAGE_SIZE = 16 * 1024;
@@ -27,7 +29,7 @@ Cartridge load_ines_rom_dump(std::istream *is) {
     throw std::runtime_error("Cartridge does not have expected NES tag");
 
   cart.mapper = (header[7] & 0b11110000) | (header[6] >> 4);
-  if (cart.mapper != 0)
+  if (!mapper_supported(cart.mapper))
     throw std::runtime_error(
         fmt::format("Unsupported cartridge mapper {}", cart.mapper));
 
@@ -44,6 +46,8 @@ Cartridge load_ines_rom_dump(std::istream *is) {
         vertmirror ? ScreenMirroring::Vertical : ScreenMirroring::Horizontal;
   }
 
+  cart.battery = (header[6] & 0b10) != 0;
+
   size_t prgl = (size_t)header[4] * PRG_ROM_PAGE_SIZE;
   size_t chrl = (size_t)header[5] * CHR_ROM_PAGE_SIZE;
 
@@ -44,18 +44,33 @@
 #include <array>
 #include <cstdint>
 #include <iostream>
+#include <memory>
 #include <vector>
 
 namespace nesem {
 
-enum class ScreenMirroring { Vertical, Horizontal, FourScreen };
+enum class ScreenMirroring {
+  Vertical,
+  Horizontal,
+  FourScreen,
+
+  // All nametables map to the first or to the second 1KB of VRAM, as
+  // selected by some mappers
+  SingleScreenLower,
+  SingleScreenUpper,
+};
+
+// Immutable ROM image, shared by the NES instances running the same cartridge
+using SharedRom = std::shared_ptr<const std::vector<uint8_t>>;
 
 struct Cartridge {
   std::vector<uint8_t> prg;  // Bytes containing game code
   std::vector<uint8_t> chr;  // Bytes containing graphics data
   uint8_t mapper =
       0;  // Type of mapper. Some mappers provide access to more ROM.
-  ScreenMirroring mirroring;  // Type of screen mirroring for the PPU
+  ScreenMirroring mirroring =
+      ScreenMirroring::Vertical;  // Type of screen mirroring for the PPU
+  bool battery = false;  // Whether PRG RAM is battery-backed
 
   // Write data into PRG ROM.
   // param size: should be 0x4000 (for a mirrored cartridge) or 0x8000
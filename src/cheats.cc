@@ -0,0 +1,84 @@
+#include "cheats.h"
+
+#include <fmt/core.h>
+
+#include <cctype>
+#include <charconv>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace nesem {
+
+// Value of each letter of Game Genie codes
+constexpr std::string_view kGameGenieLetters = "APZLGITYEOXUKSVN";
+
+static std::runtime_error invalid_cheat(std::string_view code) {
+  return std::runtime_error(fmt::format("Invalid cheat code {}", code));
+}
+
+// The letters of a code hold the bits of the address, value and compare
+// value shuffled as follows, from the most to the least significant bit of
+// each letter:
+//
+//   1678 H234 -IJK LABC DMNO 5EFG           (6 letters)
+//   1678 H234 -IJK LABC DMNO %EFG !^&* 5#$@ (8 letters)
+//
+// with 12345678 the value, !#$%^&*@ the compare value, and ABCDEFGHIJKLMNO
+// the offset of the address from $8000.
+static Cheat decode_game_genie(std::string_view code) {
+  std::vector<uint8_t> n;
+  for (char c : code) {
+    size_t letter = kGameGenieLetters.find(std::toupper(c));
+    if (letter == std::string_view::npos) throw invalid_cheat(code);
+    n.push_back(letter);
+  }
+
+  Cheat cheat;
+  cheat.addr = 0x8000 + (((n[3] & 7) << 12) | ((n[4] & 8) << 8) |
+                         ((n[5] & 7) << 8) | ((n[1] & 8) << 4) |
+                         ((n[2] & 7) << 4) | (n[3] & 8) | (n[4] & 7));
+  cheat.value = ((n[0] & 8) << 4) | ((n[1] & 7) << 4) | (n[0] & 7);
+  if (n.size() == 6) {
+    cheat.value |= n[5] & 8;
+  } else {
+    cheat.value |= n[7] & 8;
+    cheat.compare =
+        ((n[6] & 8) << 4) | ((n[7] & 7) << 4) | (n[5] & 8) | (n[6] & 7);
+  }
+  return cheat;
+}
+
+// Parse a hexadecimal number of at most max_digits digits
+template <typename T>
+static T parse_hex(std::string_view code, std::string_view digits,
+                   size_t max_digits) {
+  T value;
+  auto [end, error] =
+      std::from_chars(digits.data(), digits.data() + digits.size(), value, 16);
+  if (digits.empty() || digits.size() > max_digits || error != std::errc() ||
+      end != digits.data() + digits.size())
+    throw invalid_cheat(code);
+  return value;
+}
+
+Cheat parse_cheat(std::string_view code) {
+  size_t equals = code.find('=');
+  if (equals == std::string_view::npos) {
+    if (code.size() != 6 && code.size() != 8) throw invalid_cheat(code);
+    return decode_game_genie(code);
+  }
+
+  std::string_view value = code.substr(equals + 1);
+  Cheat cheat;
+  cheat.addr = parse_hex<uint16_t>(code, code.substr(0, equals), 4);
+  size_t question = value.find('?');
+  if (question != std::string_view::npos) {
+    cheat.compare = parse_hex<uint8_t>(code, value.substr(question + 1), 2);
+    value = value.substr(0, question);
+  }
+  cheat.value = parse_hex<uint8_t>(code, value, 2);
+  return cheat;
+}
+
+}  // namespace nesem
@@ -0,0 +1,33 @@
+// Cheat codes patching bytes of PRG ROM, as entered into a Game Genie or as
+// raw patches:
+// https://www.nesdev.org/wiki/Game_Genie
+//
+// The mmu does not check accesses against the cheats: it copies each page of
+// PRG ROM holding a patched byte into a shadow page, patches the copy, and
+// points its page table at it. Reads cost the same with or without cheats.
+
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+namespace nesem {
+
+struct Cheat {
+  uint16_t addr;  // in PRG ROM, at $8000-$FFFF
+  uint8_t value;
+
+  // When set, the byte is only patched while ROM holds this value there,
+  // which tells apart the banks switched in at the address
+  std::optional<uint8_t> compare;
+
+  bool operator==(const Cheat &other) const = default;
+};
+
+// Parse a 6 or 8 letter Game Genie code (e.g. "GOSSIP"), or a raw patch
+// written in hexadecimal as address=value or address=value?compare (e.g.
+// "D1DD=14?03"). Throws for invalid codes.
+Cheat parse_cheat(std::string_view code);
+
+}  // namespace nesem
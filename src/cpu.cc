@@ -1,651 +1,814 @@
 #include "cpu.h"
 
 #include <assert.h>
-#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include <algorithm>
+#include <string_view>
+
 namespace nesem {
 
-void Cpu::step() {
-  if (nmi_pending) {
-    nmi_pending = false;
-    handle_nmi();
-  } else if (irq_pending && !flags.interrupt_disable) {
-    irq_pending = false;
-    handle_irq();
+template <typename Bus>
+void BasicCpu<Bus>::step() {
+  if (jammed) return;
+  if (interrupts.any() && handle_interrupt()) return;
+  if (decode_cache) {
+    exec_cached();
   } else {
     fetch_exec();
   }
 }
 
-void Cpu::reset() {
+template <typename Bus>
+void BasicCpu<Bus>::run(size_t cycle_limit) {
+  run_limit = cycle_limit;
+  while (cycles < run_limit && !jammed) {
+#ifdef NESEM_THREADED_DISPATCH
+    if (!decode_cache && !interrupt_pending()) {
+      run_threaded();
+      continue;
+    }
+#endif
+    step();
+  }
+}
+
+template <typename Bus>
+void BasicCpu<Bus>::reset() {
   sp = 0xFD;
   flags.interrupt_disable = true;
+  jammed = false;
   pc = read16(kResetVector);
   cycles += 7;
 }
 
-uint8_t Cpu::read(uint16_t addr) const { return mmu->read(addr); }
+// Accesses call the implementation of Bus itself, so that they are resolved
+// statically even when other classes derive from it (e.g. DebugNesMmu from
+// NesMmu)
+template <typename Bus>
+uint8_t BasicCpu<Bus>::read(uint16_t addr) const {
+  if constexpr (std::is_abstract_v<Bus>)
+    return mmu->read(addr);
+  else
+    return mmu->Bus::read(addr);
+}
+
+template <typename Bus>
+uint8_t BasicCpu<Bus>::peek(uint16_t addr) const {
+  const Bus &bus = *mmu;
+  if constexpr (std::is_abstract_v<Bus>)
+    return bus.read(addr);
+  else
+    return bus.Bus::read(addr);
+}
+
+template <typename Bus>
+void BasicCpu<Bus>::write(uint16_t addr, uint8_t data) {
+  if constexpr (std::is_abstract_v<Bus>)
+    mmu->write(addr, data);
+  else
+    mmu->Bus::write(addr, data);
+  if (decode_cache && decode_cache->covers(addr))
+    decode_cache->invalidate(addr, addr);
+}
+
+template <typename Bus>
+template <bool low_ram>
+uint8_t BasicCpu<Bus>::read_at(uint16_t addr) const {
+  if constexpr (low_ram && Bus::kDirectLowRam)
+    return mmu->low_ram()[addr];
+  else
+    return read(addr);
+}
 
-void Cpu::write(uint16_t addr, uint8_t data) { mmu->write(addr, data); }
+template <typename Bus>
+template <bool low_ram>
+void BasicCpu<Bus>::write_at(uint16_t addr, uint8_t data) {
+  if constexpr (low_ram && Bus::kDirectLowRam) {
+    mmu->low_ram()[addr] = data;
+    if (decode_cache && decode_cache->covers(addr))
+      decode_cache->invalidate(addr, addr);
+  } else {
+    write(addr, data);
+  }
+}
+
+template <typename Bus>
+bool BasicCpu<Bus>::set_profiling_enabled(bool enabled) {
+  if (!kProfiling || !enabled) {
+    profile.reset();
+    return !enabled;
+  }
+  if (!profile) profile = std::make_unique<ExecutionProfile>();
+  return true;
+}
 
-uint16_t Cpu::read16(uint16_t addr) const {
+template <typename Bus>
+void BasicCpu<Bus>::set_decode_cache_enabled(bool enabled) {
+  if (enabled && !decode_cache) {
+    decode_cache = std::make_unique<DecodeCache>();
+    decode_cache_remap_count = mmu->remap_count;
+  } else if (!enabled) {
+    decode_cache.reset();
+  }
+  block = nullptr;
+  next_op = block_end = nullptr;
+}
+
+template <typename Bus>
+void BasicCpu<Bus>::set_fusion_enabled(bool enabled) {
+  fusion = enabled;
+  if (enabled) set_decode_cache_enabled(true);
+  // Decode the blocks again with or without fused sequences
+  if (decode_cache) decode_cache->clear();
+}
+
+template <typename Bus>
+uint16_t BasicCpu<Bus>::read16(uint16_t addr) const {
   uint16_t lo = read(addr);
   uint16_t hi = read(addr + 1);
   return (hi << 8) | lo;
 }
 
-void Cpu::write16(uint16_t addr, uint16_t data) {
+template <typename Bus>
+void BasicCpu<Bus>::write16(uint16_t addr, uint16_t data) {
   uint8_t lo = data & 0xFF;
   uint8_t hi = data >> 8;
   write(addr, lo);
   write(addr + 1, hi);
 }
 
-uint16_t Cpu::get_operand_addr(const Opcode &opcode) {
-  switch (opcode.mode) {
-    case AddressingMode::Immediate:
-      return pc;
-    case AddressingMode::Zeropage:
-      return read(pc);
-    case AddressingMode::ZeropageX: {
-      uint8_t addr = read(pc) + x;
-      return addr;
-    }
-    case AddressingMode::ZeropageY: {
-      uint8_t addr = read(pc) + y;
-      return addr;
-    }
-    case AddressingMode::Absolute:
-      return read16(pc);
-    case AddressingMode::AbsoluteX: {
-      uint16_t base_addr = read16(pc);
-      uint16_t addr = base_addr + x;
-      if (opcode.does_add_cycle_if_page_boundary_crossed() &&
-          (addr & 0xFF00) != (base_addr & 0xFF00)) {
-        // crossed page boundary
-        ++cycles;
-      }
-      return addr;
-    }
-    case AddressingMode::AbsoluteY: {
-      uint16_t base_addr = read16(pc);
-      uint16_t addr = base_addr + y;
-      if (opcode.does_add_cycle_if_page_boundary_crossed() &&
-          (addr & 0xFF00) != (base_addr & 0xFF00)) {
-        // crossed page boundary
-        ++cycles;
-      }
-      return addr;
-    }
-    case AddressingMode::Relative: {
-      uint8_t addr = read(pc) + pc + 1;
-      return addr;
-    }
-    case AddressingMode::Indirect: {
-      uint16_t ref = read16(pc);
-      uint8_t addr_lo = read(ref);
-      uint16_t addr_hi;
-      if ((ref & 0xFF) == 0xFF)
-        // Unintuitively, indirect read wraps around the page
-        addr_hi = read(ref & 0xFF00);
-      else
-        addr_hi = read(ref + 1);
-      uint16_t addr = (addr_hi << 8) | addr_lo;
-      return addr;
-    }
-    case AddressingMode::IndirectX: {
-      // LDA ($02,X)
-      //      ---    @ pc
-      //      -----  ref
-      //     ------- addr
-      uint8_t ref = (read(pc) + x);
-      uint8_t addr_lo = read(ref);
-      uint16_t addr_hi = read((uint8_t)(ref + 1));
-      return (addr_hi << 8) | addr_lo;
+template <typename Bus>
+template <uint8_t len>
+uint16_t BasicCpu<Bus>::fetch_operand() const {
+  if constexpr (len == 3)
+    return read16(pc);
+  else if constexpr (len == 2)
+    return read(pc);
+  else
+    return 0;
+}
+
+template <typename Bus>
+template <AddressingMode mode, bool add_cycle_if_page_boundary_crossed>
+uint16_t BasicCpu<Bus>::get_operand_addr(uint16_t operand) {
+  if constexpr (mode == AddressingMode::Immediate ||
+                mode == AddressingMode::Relative) {
+    return pc;
+  } else if constexpr (mode == AddressingMode::Zeropage) {
+    return operand;
+  } else if constexpr (mode == AddressingMode::ZeropageX) {
+    uint8_t addr = operand + x;
+    return addr;
+  } else if constexpr (mode == AddressingMode::ZeropageY) {
+    uint8_t addr = operand + y;
+    return addr;
+  } else if constexpr (mode == AddressingMode::Absolute) {
+    return operand;
+  } else if constexpr (mode == AddressingMode::AbsoluteX ||
+                       mode == AddressingMode::AbsoluteY) {
+    uint16_t base_addr = operand;
+    uint16_t addr = base_addr + (mode == AddressingMode::AbsoluteX ? x : y);
+    if (add_cycle_if_page_boundary_crossed &&
+        (addr & 0xFF00) != (base_addr & 0xFF00)) {
+      // crossed page boundary
+      ++cycles;
     }
-    case AddressingMode::IndirectY: {
-      // LDA ($02),Y
-      //      ---    ref
-      //     -----   base addr
-      //     ------- addr
-      uint8_t ref = read(pc);
-      uint8_t base_addr_lo = read(ref);
-      uint16_t base_addr_hi = read((uint8_t)(ref + 1));
-      uint16_t base_addr = (base_addr_hi << 8) | base_addr_lo;
-      uint16_t addr = base_addr + y;
-      if (opcode.does_add_cycle_if_page_boundary_crossed() &&
-          (addr & 0xFF00) != (base_addr & 0xFF00)) {
-        // page boundary crossed
-        ++cycles;
-      }
-      return addr;
+    return addr;
+  } else if constexpr (mode == AddressingMode::Indirect) {
+    uint16_t ref = operand;
+    uint8_t addr_lo = read(ref);
+    uint16_t addr_hi;
+    if ((ref & 0xFF) == 0xFF)
+      // Unintuitively, indirect read wraps around the page
+      addr_hi = read(ref & 0xFF00);
+    else
+      addr_hi = read(ref + 1);
+    uint16_t addr = (addr_hi << 8) | addr_lo;
+    return addr;
+  } else if constexpr (mode == AddressingMode::IndirectX) {
+    // LDA ($02,X)
+    //      ---    operand
+    //      -----  ref
+    //     ------- addr
+    uint8_t ref = (operand + x);
+    uint8_t addr_lo = read_at<true>(ref);
+    uint16_t addr_hi = read_at<true>((uint8_t)(ref + 1));
+    return (addr_hi << 8) | addr_lo;
+  } else if constexpr (mode == AddressingMode::IndirectY) {
+    // LDA ($02),Y
+    //      ---    ref
+    //     -----   base addr
+    //     ------- addr
+    uint8_t ref = operand;
+    uint8_t base_addr_lo = read_at<true>(ref);
+    uint16_t base_addr_hi = read_at<true>((uint8_t)(ref + 1));
+    uint16_t base_addr = (base_addr_hi << 8) | base_addr_lo;
+    uint16_t addr = base_addr + y;
+    if (add_cycle_if_page_boundary_crossed &&
+        (addr & 0xFF00) != (base_addr & 0xFF00)) {
+      // page boundary crossed
+      ++cycles;
     }
-    default:
-      assert(!"illegal mode");
+    return addr;
+  } else {
+    static_assert(mode == AddressingMode::Implied, "illegal mode");
+    return 0;
   }
 }
 
-void Cpu::stack_push(uint8_t val) {
-  write(0x0100 + sp, val);
+template <typename Bus>
+void BasicCpu<Bus>::stack_push(uint8_t val) {
+  write_at<true>(0x0100 + sp, val);
   --sp;
 }
 
-uint8_t Cpu::stack_pop() {
+template <typename Bus>
+uint8_t BasicCpu<Bus>::stack_pop() {
   ++sp;
-  uint8_t data = read(0x0100 + sp);
+  uint8_t data = read_at<true>(0x0100 + sp);
   return data;
 }
 
-void Cpu::stack_push16(uint16_t data) {
+template <typename Bus>
+void BasicCpu<Bus>::stack_push16(uint16_t data) {
   uint8_t hi = data >> 8;
   uint8_t lo = data & 0xFF;
   stack_push(hi);
   stack_push(lo);
 }
 
-uint16_t Cpu::stack_pop16() {
+template <typename Bus>
+uint16_t BasicCpu<Bus>::stack_pop16() {
   uint8_t lo = stack_pop();
   uint8_t hi = stack_pop();
   uint16_t data = ((uint16_t)hi << 8) | lo;
   return data;
 }
 
-void Cpu::update_zero_neg_flags(uint8_t val) {
-  flags.zero = (val == 0);
-  flags.negative = ((val & 0b10000000) != 0);
+template <typename Bus>
+void BasicCpu<Bus>::update_zero_neg_flags(uint8_t val) {
+  flags.set_nz(val);
 }
 
-void Cpu::fetch_exec() {
+template <typename Bus>
+void BasicCpu<Bus>::fetch_exec() {
   uint8_t opc = read(pc++);
-  const Opcode &opcode = opcodes[opc];
-  uint16_t operand_addr;
-  if (opcode.mode != AddressingMode::Implied)
-    operand_addr = get_operand_addr(opcode);
-  uint16_t prev_pc = pc;
-
-  switch (opc) {
-      /*
-       * Transfer instructions
-       */
-
-    case 0xA9:
-    case 0xA5:
-    case 0xB5:
-    case 0xAD:
-    case 0xBD:
-    case 0xB9:
-    case 0xA1:
-    case 0xB1:
-      lda(operand_addr);
-      break;
-
-    case 0xA2:
-    case 0xA6:
-    case 0xB6:
-    case 0xAE:
-    case 0xBE:
-      ldx(operand_addr);
-      break;
-
-    case 0xA0:
-    case 0xA4:
-    case 0xB4:
-    case 0xAC:
-    case 0xBC:
-      ldy(operand_addr);
-      break;
-
-    case 0x85:
-    case 0x95:
-    case 0x8D:
-    case 0x9D:
-    case 0x99:
-    case 0x81:
-    case 0x91:
-      sta(operand_addr);
-      break;
-
-    case 0x86:
-    case 0x96:
-    case 0x8E:
-      stx(operand_addr);
-      break;
-
-    case 0x84:
-    case 0x94:
-    case 0x8C:
-      sty(operand_addr);
-      break;
-
-    case 0xAA:
-      tax();
-      break;
-    case 0xA8:
-      tay();
-      break;
-    case 0xBA:
-      tsx();
-      break;
-    case 0x8A:
-      txa();
-      break;
-    case 0x98:
-      tya();
-      break;
-    case 0x9A:
-      txs();
-      break;
-
-      /*
-       * Stack instructions
-       */
-
-    case 0x48:
-      pha();
-      break;
-    case 0x08:
-      php();
-      break;
-    case 0x68:
-      pla();
-      break;
-    case 0x28:
-      plp();
-      break;
-
-      /*
-       * Decrements & increments
-       */
-
-    case 0xC6:
-    case 0xD6:
-    case 0xCE:
-    case 0xDE:
-      dec(operand_addr);
-      break;
+  op_handlers[opc](*this);
+}
 
-    case 0xCA:
-      dex();
-      break;
-    case 0x88:
-      dey();
-      break;
+#ifdef NESEM_THREADED_DISPATCH
+
+// Expand X once per opcode, passing it as two hexadecimal digits
+#define NESEM_OPCODE_ROW(X, hi)                                              \
+  X(hi##0) X(hi##1) X(hi##2) X(hi##3) X(hi##4) X(hi##5) X(hi##6) X(hi##7) \
+  X(hi##8) X(hi##9) X(hi##A) X(hi##B) X(hi##C) X(hi##D) X(hi##E) X(hi##F)
+#define NESEM_FOR_EACH_OPCODE(X)                                             \
+  NESEM_OPCODE_ROW(X, 0) NESEM_OPCODE_ROW(X, 1) NESEM_OPCODE_ROW(X, 2)       \
+  NESEM_OPCODE_ROW(X, 3) NESEM_OPCODE_ROW(X, 4) NESEM_OPCODE_ROW(X, 5)       \
+  NESEM_OPCODE_ROW(X, 6) NESEM_OPCODE_ROW(X, 7) NESEM_OPCODE_ROW(X, 8)       \
+  NESEM_OPCODE_ROW(X, 9) NESEM_OPCODE_ROW(X, A) NESEM_OPCODE_ROW(X, B)       \
+  NESEM_OPCODE_ROW(X, C) NESEM_OPCODE_ROW(X, D) NESEM_OPCODE_ROW(X, E)       \
+  NESEM_OPCODE_ROW(X, F)
+
+// Every handler is expanded in place and ends with its own copy of the
+// dispatch
+template <typename Bus>
+void BasicCpu<Bus>::run_threaded() {
+#define NESEM_HANDLER_LABEL(opc) &&op_##opc,
+  static void *const handlers[0x100] = {
+      NESEM_FOR_EACH_OPCODE(NESEM_HANDLER_LABEL)};
+#undef NESEM_HANDLER_LABEL
+
+#define NESEM_DISPATCH()                                       \
+  do {                                                         \
+    if (cycles >= run_limit || interrupt_pending()) return;    \
+    goto *handlers[read(pc++)];                                \
+  } while (0)
+
+  NESEM_DISPATCH();
+
+// A JAM leaves the program counter on itself, so the loop returns after it
+// rather than dispatching it again
+#define NESEM_HANDLER(opc)                                            \
+  op_##opc:                                                           \
+  exec<0x##opc>(*this);                                               \
+  if constexpr (std::string_view(opcodes[0x##opc].mnemonic) == "JAM") \
+    return;                                                           \
+  NESEM_DISPATCH();
+  NESEM_FOR_EACH_OPCODE(NESEM_HANDLER)
+#undef NESEM_HANDLER
+#undef NESEM_DISPATCH
+}
 
-    case 0xE6:
-    case 0xF6:
-    case 0xEE:
-    case 0xFE:
-      inc(operand_addr);
-      break;
-    case 0xE8:
-      inx();
-      break;
-    case 0xC8:
-      iny();
-      break;
+#undef NESEM_FOR_EACH_OPCODE
+#undef NESEM_OPCODE_ROW
 
-      /*
-       * Arithmetic operations
-       */
-
-    case 0x69:
-    case 0x65:
-    case 0x75:
-    case 0x6D:
-    case 0x7D:
-    case 0x79:
-    case 0x61:
-    case 0x71:
-      adc(operand_addr);
-      break;
+#endif
 
-    case 0xE9:
-    case 0xE5:
-    case 0xF5:
-    case 0xED:
-    case 0xFD:
-    case 0xF9:
-    case 0xE1:
-    case 0xF1:
-      sbc(operand_addr);
-      break;
+template <typename Bus>
+template <size_t... opcs>
+constexpr std::array<typename BasicCpu<Bus>::OpHandler, sizeof...(opcs)>
+BasicCpu<Bus>::make_op_handlers(std::index_sequence<opcs...>) {
+  return {&BasicCpu::exec<opcs>...};
+}
 
-      /*
-       * Logical operations
-       */
-
-    case 0x29:
-    case 0x25:
-    case 0x35:
-    case 0x2D:
-    case 0x3D:
-    case 0x39:
-    case 0x21:
-    case 0x31:
-      and_(operand_addr);
-      break;
+template <typename Bus>
+template <size_t... opcs>
+constexpr std::array<typename BasicCpu<Bus>::OperandHandler, sizeof...(opcs)>
+BasicCpu<Bus>::make_operand_handlers(std::index_sequence<opcs...>) {
+  return {&BasicCpu::exec_operand<opcs>...};
+}
 
-    case 0x49:
-    case 0x45:
-    case 0x55:
-    case 0x4D:
-    case 0x5D:
-    case 0x59:
-    case 0x41:
-    case 0x51:
-      eor(operand_addr);
-      break;
+template <typename Bus>
+const std::array<typename BasicCpu<Bus>::OpHandler, 0x100>
+    BasicCpu<Bus>::op_handlers =
+        make_op_handlers(std::make_index_sequence<0x100>{});
+
+template <typename Bus>
+const std::array<typename BasicCpu<Bus>::OperandHandler, 0x100>
+    BasicCpu<Bus>::operand_handlers =
+        make_operand_handlers(std::make_index_sequence<0x100>{});
+
+template <typename Bus>
+template <size_t... ks>
+constexpr std::array<typename BasicCpu<Bus>::OperandHandler, sizeof...(ks)>
+BasicCpu<Bus>::make_fused_handlers(std::index_sequence<ks...>) {
+  return {&BasicCpu::exec_fused<ks>...};
+}
 
-    case 0x09:
-    case 0x05:
-    case 0x15:
-    case 0x0D:
-    case 0x1D:
-    case 0x19:
-    case 0x01:
-    case 0x11:
-      ora(operand_addr);
-      break;
+template <typename Bus>
+const std::array<typename BasicCpu<Bus>::OperandHandler, fused_patterns.size()>
+    BasicCpu<Bus>::fused_handlers =
+        make_fused_handlers(std::make_index_sequence<fused_patterns.size()>{});
+
+// Whether the instruction may set the program counter itself, rather than
+// simply advancing past its operands
+static constexpr bool is_control_flow(std::string_view op) {
+  return op == "BCC" || op == "BCS" || op == "BEQ" || op == "BMI" ||
+         op == "BNE" || op == "BPL" || op == "BVC" || op == "BVS" ||
+         op == "JMP" || op == "JSR" || op == "RTS" || op == "BRK" ||
+         op == "RTI" || op == "JAM";
+}
 
-      /*
-       * Shift & rotate instructions
-       */
+// Whether the instruction reads the memory at its operand's address, then
+// writes the result back
+static constexpr bool is_read_modify_write(const Opcode &opcode) {
+  std::string_view op = opcode.mnemonic;
+  return opcode.mode != AddressingMode::Implied &&
+         (op == "ASL" || op == "LSR" || op == "ROL" || op == "ROR" ||
+          op == "INC" || op == "DEC" || op == "DCP" || op == "ISB" ||
+          op == "RLA" || op == "RRA" || op == "SLO" || op == "SRE");
+}
 
-    case 0x0A:
-      asl_a();
-      break;
-    case 0x06:
-    case 0x16:
-    case 0x0E:
-    case 0x1E:
-      asl_mem(operand_addr);
-      break;
+// Cycle of the instruction, counted from 0 and not including a page crossing
+// penalty, during which the memory at the operand's address is accessed. The
+// access is made on the last cycle, or for a read-modify-write instruction
+// read on the third to last and written on the last. Instructions without
+// such an access make their other accesses (stack, vectors, pointers) at the
+// start of the instruction.
+static constexpr uint8_t operand_access_cycle(const Opcode &opcode) {
+  std::string_view op = opcode.mnemonic;
+  if (opcode.mode == AddressingMode::Implied ||
+      opcode.mode == AddressingMode::Immediate ||
+      opcode.mode == AddressingMode::Relative ||
+      opcode.mode == AddressingMode::Indirect || op == "JMP" || op == "JSR" ||
+      op == "NOP")
+    return 0;
+  return opcode.cycles - (is_read_modify_write(opcode) ? 3 : 1);
+}
 
-    case 0x4A:
-      lsr_a();
-      break;
-    case 0x46:
-    case 0x56:
-    case 0x4E:
-    case 0x5E:
-      lsr_mem(operand_addr);
-      break;
+template <typename Bus>
+void BasicCpu<Bus>::exec_cached() {
+  if (mmu->remap_count != decode_cache_remap_count) {
+    if (mmu->remap_count == decode_cache_remap_count + 1)
+      decode_cache->invalidate(mmu->last_remap_lo, mmu->last_remap_hi);
+    else
+      decode_cache->clear();
+    decode_cache_remap_count = mmu->remap_count;
+  }
 
-    case 0x2A:
-      rol_a();
-      break;
-    case 0x26:
-    case 0x36:
-    case 0x2E:
-    case 0x3E:
-      rol_mem(operand_addr);
-      break;
+  if (decode_cache_generation != decode_cache->generation) block = nullptr;
+  if (!block || next_op == block_end || next_op->pc != pc) {
+    block = next_block();
+    next_op = block->ops.data();
+    block_end = next_op + block->ops.size();
+    decode_cache_generation = decode_cache->generation;
+  }
 
-    case 0x6A:
-      ror_a();
-      break;
-    case 0x66:
-    case 0x76:
-    case 0x6E:
-    case 0x7E:
-      ror_mem(operand_addr);
-      break;
+  // The block may be dropped while the instruction executes, if it writes
+  // over itself
+  MicroOp op = *next_op++;
+  pc = op.pc + 1;
+  op.exec(*this, op.operand);
+}
 
-      /*
-       * Flag instructions
-       */
+template <typename Bus>
+DecodedBlock *BasicCpu<Bus>::next_block() {
+  if (block) {
+    for (const BlockLink &link : block->links)
+      if (link.block && link.start == pc) return link.block;
+  }
 
-    case 0x18:  // CLC
-      flags.carry = false;
-      break;
-    case 0xD8:  // CLD
-      flags.decimal = false;
-      break;
-    case 0x58:  // CLI
-      flags.interrupt_disable = false;
-      break;
-    case 0xB8:  // CLV
-      flags.overflow = false;
-      break;
-    case 0x38:  // SEC
-      flags.carry = true;
-      break;
-    case 0xF8:  // SED
-      flags.decimal = true;
-      break;
-    case 0x78:  // SEI
-      flags.interrupt_disable = true;
-      break;
+  DecodedBlock *next = decode_cache->find(pc);
+  if (!next) next = decode_block(pc);
+  if (block && decode_cache_generation == decode_cache->generation)
+    decode_cache->link(block, next);
+  return next;
+}
 
-      /*
-       * Comparisons
-       */
-
-    case 0xC9:
-    case 0xC5:
-    case 0xD5:
-    case 0xCD:
-    case 0xDD:
-    case 0xD9:
-    case 0xC1:
-    case 0xD1:  // CMP
-      compare_with(operand_addr, a);
-      break;
+template <typename Bus>
+DecodedBlock *BasicCpu<Bus>::decode_block(uint16_t start) {
+  DecodedBlock block;
+  block.start = start;
+  std::vector<uint8_t> opcs;
+  uint32_t addr = start;
+  for (;;) {
+    uint8_t opc = peek(addr);
+    opcs.push_back(opc);
+    const Opcode &opcode = opcodes[opc];
+    uint16_t operand = 0;
+    if (opcode.len == 3)
+      operand = peek(addr + 1) | (peek(uint16_t(addr + 2)) << 8);
+    else if (opcode.len == 2)
+      operand = peek(addr + 1);
+    block.ops.push_back({operand_handlers[opc], operand, (uint16_t)addr});
+
+    uint32_t next = addr + opcode.len;
+    block.end = std::min<uint32_t>(next - 1, 0xFFFF);
+    if (is_control_flow(opcode.mnemonic) ||
+        block.ops.size() == DecodeCache::kMaxBlockLen || next > 0xFFFF)
+      break;
+    addr = next;
+  }
+  if (fusion) fuse(&block, opcs);
+  return decode_cache->insert(std::move(block));
+}
 
-    case 0xE0:
-    case 0xE4:
-    case 0xEC:  // CPX
-      compare_with(operand_addr, x);
-      break;
+template <typename Bus>
+void BasicCpu<Bus>::fuse(DecodedBlock *block,
+                         const std::vector<uint8_t> &opcs) {
+  // Whether the instruction accesses nothing but CPU RAM and PRG ROM
+  auto is_direct = [](const Opcode &opcode, uint16_t operand) {
+    return opcode.mode != AddressingMode::Absolute || operand <= 0x1FFF ||
+           operand >= 0x8000;
+  };
+
+  for (size_t i = 0; i < opcs.size(); ++i) {
+    for (size_t k = 0; k < fused_patterns.size(); ++k) {
+      const FusedPattern &pattern = fused_patterns[k];
+      if (i + pattern.len > opcs.size() ||
+          (pattern.operand >= 0 && block->ops[i].operand != pattern.operand))
+        continue;
+      bool matches = true;
+      for (size_t j = 0; j < pattern.len && matches; ++j) {
+        const MicroOp &op = block->ops[i + j];
+        matches = opcs[i + j] == pattern.opcs[j] &&
+                  (j == 0 || is_direct(opcodes[pattern.opcs[j]], op.operand));
+      }
+      if (matches) {
+        block->ops[i].exec = fused_handlers[k];
+        break;
+      }
+    }
+  }
+}
 
-    case 0xC0:
-    case 0xC4:
-    case 0xCC:  // CPY
-      compare_with(operand_addr, y);
-      break;
+template <typename Bus>
+template <size_t k>
+void BasicCpu<Bus>::exec_fused(CpuState &state, uint16_t operand) {
+  constexpr const FusedPattern &pattern = fused_patterns[k];
+  BasicCpu &cpu = static_cast<BasicCpu &>(state);
+  exec_operand<pattern.opcs[0]>(cpu, operand);
+  if (!cpu.template exec_fused_next<pattern.opcs[1]>()) return;
+  if constexpr (pattern.len == 3) {
+    if (!cpu.template exec_fused_next<pattern.opcs[2]>()) return;
+  }
+  ++cpu.fusion_hits[static_cast<size_t>(pattern.idiom)];
+}
 
-      /*
-       * Condition branch instructions
-       */
+template <typename Bus>
+template <uint8_t opc>
+bool BasicCpu<Bus>::exec_fused_next() {
+  // The previous instruction may have written over the block, or an
+  // interrupt may have been raised after it
+  if (decode_cache_generation != decode_cache->generation ||
+      cycles > fusion_cycle_limit)
+    return false;
+  const MicroOp &op = *next_op++;
+  pc = op.pc + 1;
+  exec_operand<opc>(*this, op.operand);
+  return true;
+}
 
-    case 0x90:  // BCC
-      branch_cond(!flags.carry);
-      break;
-    case 0xB0:  // BCS
-      branch_cond(flags.carry);
-      break;
-    case 0xF0:  // BEQ
-      branch_cond(flags.zero);
-      break;
-    case 0x30:  // BMI
-      branch_cond(flags.negative);
-      break;
-    case 0xD0:  // BNE
-      branch_cond(!flags.zero);
-      break;
-    case 0x10:  // BPL
-      branch_cond(!flags.negative);
-      break;
-    case 0x50:  // BVC
-      branch_cond(!flags.overflow);
-      break;
-    case 0x70:  // BVS
-      branch_cond(flags.overflow);
-      break;
+template <typename Bus>
+template <uint8_t opc>
+void BasicCpu<Bus>::exec(BasicCpu &cpu) {
+  constexpr const Opcode &opcode = opcodes[opc];
+  exec_operand<opc>(cpu, cpu.template fetch_operand<opcode.len>());
+}
 
-      /*
-       * Jumps & subroutines
-       */
+template <typename Bus>
+template <uint8_t opc>
+void BasicCpu<Bus>::exec_operand(CpuState &state, uint16_t operand) {
+  BasicCpu &cpu = static_cast<BasicCpu &>(state);
+  constexpr const Opcode &opcode = opcodes[opc];
+  constexpr std::string_view op = opcode.mnemonic;
+  constexpr bool implied = opcode.mode == AddressingMode::Implied;
+  constexpr bool zero_page = opcode.mode == AddressingMode::Zeropage ||
+                             opcode.mode == AddressingMode::ZeropageX ||
+                             opcode.mode == AddressingMode::ZeropageY;
+  [[maybe_unused]] size_t start_cycles = cpu.cycles;
+
+  uint16_t addr = 0;
+  if constexpr (!implied)
+    addr = cpu.template get_operand_addr<
+        opcode.mode, opcode.does_add_cycle_if_page_boundary_crossed()>(operand);
+  [[maybe_unused]] uint16_t prev_pc = cpu.pc;
+
+  // Advance the cycle counter to the access of the operand, so that the bus
+  // sees the cycle at which it happens. Read-modify-write instructions
+  // advance it by 2 more between their read and write.
+  constexpr uint8_t access_cycle = operand_access_cycle(opcode);
+  constexpr uint8_t remaining_cycles =
+      opcode.cycles - access_cycle - (is_read_modify_write(opcode) ? 2 : 0);
+  cpu.cycles += access_cycle;
+
+  // Read the value of the operand, for instructions that use it
+  auto load = [&]() -> uint8_t {
+    if constexpr (opcode.mode == AddressingMode::Immediate)
+      return operand;
+    else
+      return cpu.template read_at<zero_page>(addr);
+  };
+
+  /*
+   * Transfer instructions
+   */
+
+  if constexpr (op == "LDA") {
+    cpu.lda(load());
+  } else if constexpr (op == "LDX") {
+    cpu.ldx(load());
+  } else if constexpr (op == "LDY") {
+    cpu.ldy(load());
+  } else if constexpr (op == "STA") {
+    cpu.template sta<zero_page>(addr);
+  } else if constexpr (op == "STX") {
+    cpu.template stx<zero_page>(addr);
+  } else if constexpr (op == "STY") {
+    cpu.template sty<zero_page>(addr);
+  } else if constexpr (op == "TAX") {
+    cpu.tax();
+  } else if constexpr (op == "TAY") {
+    cpu.tay();
+  } else if constexpr (op == "TSX") {
+    cpu.tsx();
+  } else if constexpr (op == "TXA") {
+    cpu.txa();
+  } else if constexpr (op == "TYA") {
+    cpu.tya();
+  } else if constexpr (op == "TXS") {
+    cpu.txs();
+  }
 
-    case 0x4C:
-    case 0x6C:
-      jmp(operand_addr);
-      break;
+  /*
+   * Stack instructions
+   */
+
+  else if constexpr (op == "PHA") {
+    cpu.pha();
+  } else if constexpr (op == "PHP") {
+    cpu.php();
+  } else if constexpr (op == "PLA") {
+    cpu.pla();
+  } else if constexpr (op == "PLP") {
+    cpu.plp();
+  }
 
-    case 0x20:
-      jsr();
-      break;
+  /*
+   * Decrements & increments
+   */
+
+  else if constexpr (op == "DEC") {
+    cpu.template dec<zero_page>(addr);
+  } else if constexpr (op == "DEX") {
+    cpu.dex();
+  } else if constexpr (op == "DEY") {
+    cpu.dey();
+  } else if constexpr (op == "INC") {
+    cpu.template inc<zero_page>(addr);
+  } else if constexpr (op == "INX") {
+    cpu.inx();
+  } else if constexpr (op == "INY") {
+    cpu.iny();
+  }
 
-    case 0x60:
-      rts();
-      break;
+  /*
+   * Arithmetic operations
+   */
 
-      /*
-       * Interrupts
-       */
+  else if constexpr (op == "ADC") {
+    cpu.adc(load());
+  } else if constexpr (op == "SBC") {  // includes USBC (SBC + NOP)
+    cpu.sbc(load());
+  }
 
-    case 0x00:  // BRK
-      brk();
-      break;
-    case 0x40:
-      rti();
-      break;
+  /*
+   * Logical operations
+   */
 
-      /*
-       * Other
-       */
+  else if constexpr (op == "AND") {
+    cpu.and_(load());
+  } else if constexpr (op == "EOR") {
+    cpu.eor(load());
+  } else if constexpr (op == "ORA") {
+    cpu.ora(load());
+  }
 
-    case 0x24:
-    case 0x2C:
-      bit(operand_addr);
-      break;
+  /*
+   * Shift & rotate instructions
+   */
+
+  else if constexpr (op == "ASL") {
+    if constexpr (implied)
+      cpu.asl_a();
+    else
+      cpu.template asl_mem<zero_page>(addr);
+  } else if constexpr (op == "LSR") {
+    if constexpr (implied)
+      cpu.lsr_a();
+    else
+      cpu.template lsr_mem<zero_page>(addr);
+  } else if constexpr (op == "ROL") {
+    if constexpr (implied)
+      cpu.rol_a();
+    else
+      cpu.template rol_mem<zero_page>(addr);
+  } else if constexpr (op == "ROR") {
+    if constexpr (implied)
+      cpu.ror_a();
+    else
+      cpu.template ror_mem<zero_page>(addr);
+  }
 
-    case 0xEA:  // NOP
-      break;
+  /*
+   * Flag instructions
+   */
+
+  else if constexpr (op == "CLC") {
+    cpu.flags.carry = false;
+  } else if constexpr (op == "CLD") {
+    cpu.flags.decimal = false;
+  } else if constexpr (op == "CLI") {
+    cpu.flags.interrupt_disable = false;
+  } else if constexpr (op == "CLV") {
+    cpu.flags.overflow = false;
+  } else if constexpr (op == "SEC") {
+    cpu.flags.carry = true;
+  } else if constexpr (op == "SED") {
+    cpu.flags.decimal = true;
+  } else if constexpr (op == "SEI") {
+    cpu.flags.interrupt_disable = true;
+  }
 
-      /*
-       * "Illegal" opcodes
-       */
-
-    case 0xC7:
-    case 0xD7:
-    case 0xCF:
-    case 0xDF:
-    case 0xDB:
-    case 0xC3:
-    case 0xD3:
-      dcp(operand_addr);
-      break;
+  /*
+   * Comparisons
+   */
 
-    case 0xE7:
-    case 0xF7:
-    case 0xEF:
-    case 0xFF:
-    case 0xFB:
-    case 0xE3:
-    case 0xF3:  // ISC
-      inc(operand_addr);
-      sbc(operand_addr);
-      break;
+  else if constexpr (op == "CMP") {
+    cpu.compare_with(load(), cpu.a);
+  } else if constexpr (op == "CPX") {
+    cpu.compare_with(load(), cpu.x);
+  } else if constexpr (op == "CPY") {
+    cpu.compare_with(load(), cpu.y);
+  }
 
-    case 0xA7:
-    case 0xB7:
-    case 0xAF:
-    case 0xBF:
-    case 0xA3:
-    case 0xB3:
-      lax(operand_addr);
-      break;
+  /*
+   * Condition branch instructions
+   */
+
+  else if constexpr (op == "BCC") {
+    cpu.branch_cond(!cpu.flags.carry, operand);
+  } else if constexpr (op == "BCS") {
+    cpu.branch_cond(cpu.flags.carry, operand);
+  } else if constexpr (op == "BEQ") {
+    cpu.branch_cond(cpu.flags.zero(), operand);
+  } else if constexpr (op == "BMI") {
+    cpu.branch_cond(cpu.flags.negative(), operand);
+  } else if constexpr (op == "BNE") {
+    cpu.branch_cond(!cpu.flags.zero(), operand);
+  } else if constexpr (op == "BPL") {
+    cpu.branch_cond(!cpu.flags.negative(), operand);
+  } else if constexpr (op == "BVC") {
+    cpu.branch_cond(!cpu.flags.overflow, operand);
+  } else if constexpr (op == "BVS") {
+    cpu.branch_cond(cpu.flags.overflow, operand);
+  }
 
-    case 0x27:
-    case 0x37:
-    case 0x2F:
-    case 0x3F:
-    case 0x3B:
-    case 0x23:
-    case 0x33:  // RLA
-      rol_mem(operand_addr);
-      and_(operand_addr);
-      break;
+  /*
+   * Jumps & subroutines
+   */
 
-    case 0x67:
-    case 0x77:
-    case 0x6F:
-    case 0x7F:
-    case 0x7B:
-    case 0x63:
-    case 0x73:  // RRA
-      ror_mem(operand_addr);
-      adc(operand_addr);
-      break;
+  else if constexpr (op == "JMP") {
+    cpu.jmp(addr);
+  } else if constexpr (op == "JSR") {
+    cpu.jsr(addr);
+  } else if constexpr (op == "RTS") {
+    cpu.rts();
+  }
 
-    case 0x87:
-    case 0x97:
-    case 0x8F:
-    case 0x83:
-      sax(operand_addr);
-      break;
+  /*
+   * Interrupts
+   */
 
-    case 0x07:
-    case 0x17:
-    case 0x0F:
-    case 0x1F:
-    case 0x1B:
-    case 0x03:
-    case 0x13:  // SLO
-      asl_mem(operand_addr);
-      ora(operand_addr);
-      break;
+  else if constexpr (op == "BRK") {
+    cpu.brk();
+  } else if constexpr (op == "RTI") {
+    cpu.rti();
+  }
 
-    case 0x47:
-    case 0x57:
-    case 0x4F:
-    case 0x5F:
-    case 0x5B:
-    case 0x43:
-    case 0x53:  // SRE
-      lsr_mem(operand_addr);
-      eor(operand_addr);
-      break;
+  /*
+   * Other
+   */
 
-    case 0xEB:  // USBC (SBC + NOP)
-      sbc(operand_addr);
-      break;
+  else if constexpr (op == "BIT") {
+    cpu.bit(load());
+  } else if constexpr (op == "NOP") {
+    // NOPs (including DOP, TOP)
+  }
 
-    case 0x1A:
-    case 0x3A:
-    case 0x5A:
-    case 0x7A:
-    case 0xDA:
-    case 0xFA:
-    case 0x80:
-    case 0x82:
-    case 0x89:
-    case 0xC2:
-    case 0xE2:
-    case 0x04:
-    case 0x44:
-    case 0x64:
-    case 0x14:
-    case 0x34:
-    case 0x54:
-    case 0x74:
-    case 0xD4:
-    case 0xF4:
-    case 0x0C:
-    case 0x1C:
-    case 0x3C:
-    case 0x5C:
-    case 0x7C:
-    case 0xDC:
-    case 0xFC:  // NOPs (including DOP, TOP)
-      break;
+  /*
+   * "Illegal" opcodes
+   */
+
+  else if constexpr (op == "DCP") {
+    cpu.compare_with(cpu.template dec<zero_page>(addr), cpu.a);
+  } else if constexpr (op == "ISB") {
+    cpu.sbc(cpu.template inc<zero_page>(addr));
+  } else if constexpr (op == "LAX") {
+    cpu.lax(load());
+  } else if constexpr (op == "RLA") {
+    cpu.and_(cpu.template rol_mem<zero_page>(addr));
+  } else if constexpr (op == "RRA") {
+    cpu.adc(cpu.template ror_mem<zero_page>(addr));
+  } else if constexpr (op == "SAX") {
+    cpu.template sax<zero_page>(addr);
+  } else if constexpr (op == "SLO") {
+    cpu.ora(cpu.template asl_mem<zero_page>(addr));
+  } else if constexpr (op == "SRE") {
+    cpu.eor(cpu.template lsr_mem<zero_page>(addr));
+  } else if constexpr (op == "ANC") {
+    cpu.anc(load());
+  } else if constexpr (op == "ALR") {
+    cpu.alr(load());
+  } else if constexpr (op == "ARR") {
+    cpu.arr(load());
+  } else if constexpr (op == "ANE") {
+    cpu.ane(load());
+  } else if constexpr (op == "LXA") {
+    cpu.lxa(load());
+  } else if constexpr (op == "SBX") {
+    cpu.sbx(load());
+  } else if constexpr (op == "LAS") {
+    cpu.las(load());
+  } else if constexpr (op == "SHA") {
+    cpu.store_high(addr, cpu.y, cpu.a & cpu.x);
+  } else if constexpr (op == "SHX") {
+    cpu.store_high(addr, cpu.y, cpu.x);
+  } else if constexpr (op == "SHY") {
+    cpu.store_high(addr, cpu.x, cpu.y);
+  } else if constexpr (op == "TAS") {
+    cpu.sp = cpu.a & cpu.x;
+    cpu.store_high(addr, cpu.y, cpu.sp);
+  } else {
+    static_assert(op == "JAM", "every opcode must have a handler");
+    cpu.jammed = true;
+    cpu.pc = prev_pc - 1;
+  }
 
-    default:
-      printf("Unimplemented opc %02X\n", opc);
-      exit(1);
+  if constexpr (is_control_flow(op)) {
+    // Don't increment pc if the instruction modified it (e.g. jmp)
+    if (cpu.pc == prev_pc) cpu.pc += (opcode.len - 1);
+  } else {
+    cpu.pc += (opcode.len - 1);
   }
 
-  // Don't increment pc if the instruction modified it (e.g. jmp)
-  if (pc == prev_pc) pc += (opcode.len - 1);
+  cpu.cycles += remaining_cycles;
 
-  cycles += opcode.cycles;
+  if constexpr (kProfiling) {
+    if (cpu.profile)
+      cpu.profile->record(opc, prev_pc - 1, cpu.cycles - start_cycles);
+  }
+  if constexpr (kHeatmap && std::is_base_of_v<NesMmu, Bus>) {
+    if (cpu.mmu->heatmap)
+      ++cpu.mmu->heatmap->cpu_pages[uint16_t(prev_pc - 1) >> 8].executions;
+  }
 }
 
-void Cpu::adc(uint16_t addr) {
-  uint8_t data = read(addr);
+template <typename Bus>
+void BasicCpu<Bus>::adc(uint8_t data) {
   uint16_t sum = a + data + (flags.carry ? 1 : 0);
 
   flags.carry = (sum > 0xFF);
@@ -658,13 +821,14 @@ void Cpu::adc(uint16_t addr) {
   update_zero_neg_flags(a);
 }
 
-void Cpu::and_(uint16_t addr) {
-  uint8_t val = read(addr);
+template <typename Bus>
+void BasicCpu<Bus>::and_(uint8_t val) {
   a &= val;
   update_zero_neg_flags(a);
 }
 
-void Cpu::asl_a() {
+template <typename Bus>
+void BasicCpu<Bus>::asl_a() {
   uint16_t data = a;
 
   data <<= 1;
@@ -675,28 +839,30 @@ void Cpu::asl_a() {
   update_zero_neg_flags(a);
 }
 
-void Cpu::asl_mem(uint16_t addr) {
-  uint16_t data = read(addr);
+template <typename Bus>
+template <bool low_ram>
+uint8_t BasicCpu<Bus>::asl_mem(uint16_t addr) {
+  uint16_t data = read_at<low_ram>(addr);
+  cycles += 2;
 
   data <<= 1;
 
   flags.carry = (data > 0xFF);
 
-  write(addr, (uint8_t)data);
+  write_at<low_ram>(addr, (uint8_t)data);
   update_zero_neg_flags(data);
+  return data;
 }
 
-void Cpu::bit(uint16_t addr) {
-  uint16_t data = read(addr);
-
-  flags.negative = data & 0b10000000;
+template <typename Bus>
+void BasicCpu<Bus>::bit(uint8_t data) {
+  flags.set_nz(data, data & a);
   flags.overflow = data & 0b01000000;
-  flags.zero = !(data & a);
 }
 
-void Cpu::branch_cond(uint8_t cond) {
+template <typename Bus>
+void BasicCpu<Bus>::branch_cond(uint8_t cond, int8_t rel) {
   if (cond) {
-    int8_t rel = read(pc);
     ++pc;  // skip the argument
     int16_t new_pc = pc + rel;
     ++cycles;
@@ -705,69 +871,79 @@ void Cpu::branch_cond(uint8_t cond) {
   }
 }
 
-void Cpu::brk() {
+template <typename Bus>
+void BasicCpu<Bus>::brk() {
   stack_push16(pc + 1);
   stack_push(flags.bits() | (0b00010000));
   flags.interrupt_disable = true;
   pc = read16(0xFFFE);
 }
 
-void Cpu::compare_with(uint16_t addr, uint8_t reg) {
-  uint8_t data = read(addr);
-
+template <typename Bus>
+void BasicCpu<Bus>::compare_with(uint8_t data, uint8_t reg) {
   flags.carry = (data <= reg);
 
   uint8_t sub = reg - data;
   update_zero_neg_flags(sub);
 }
 
-void Cpu::dec(uint16_t addr) {
-  uint8_t data = read(addr);
+template <typename Bus>
+template <bool low_ram>
+uint8_t BasicCpu<Bus>::dec(uint16_t addr) {
+  uint8_t data = read_at<low_ram>(addr);
+  cycles += 2;
   --data;
-  write(addr, data);
+  write_at<low_ram>(addr, data);
   update_zero_neg_flags(data);
+  return data;
 }
 
-void Cpu::eor(uint16_t addr) {
-  uint8_t data = read(addr);
+template <typename Bus>
+void BasicCpu<Bus>::eor(uint8_t data) {
   a ^= data;
   update_zero_neg_flags(a);
 }
 
-void Cpu::inc(uint16_t addr) {
-  uint8_t data = read(addr);
+template <typename Bus>
+template <bool low_ram>
+uint8_t BasicCpu<Bus>::inc(uint16_t addr) {
+  uint8_t data = read_at<low_ram>(addr);
+  cycles += 2;
   ++data;
-  write(addr, data);
+  write_at<low_ram>(addr, data);
   update_zero_neg_flags(data);
+  return data;
 }
 
-void Cpu::jmp(uint16_t addr) { pc = addr; }
+template <typename Bus>
+void BasicCpu<Bus>::jmp(uint16_t addr) { pc = addr; }
 
-void Cpu::jsr() {
-  uint16_t addr = read16(pc);
+template <typename Bus>
+void BasicCpu<Bus>::jsr(uint16_t addr) {
   stack_push16(pc + 1);
   pc = addr;
 }
 
-void Cpu::lda(uint16_t addr) {
-  uint8_t val = read(addr);
+template <typename Bus>
+void BasicCpu<Bus>::lda(uint8_t val) {
   a = val;
   update_zero_neg_flags(a);
 }
 
-void Cpu::ldx(uint16_t addr) {
-  uint8_t val = read(addr);
+template <typename Bus>
+void BasicCpu<Bus>::ldx(uint8_t val) {
   x = val;
   update_zero_neg_flags(x);
 }
 
-void Cpu::ldy(uint16_t addr) {
-  uint8_t val = read(addr);
+template <typename Bus>
+void BasicCpu<Bus>::ldy(uint8_t val) {
   y = val;
   update_zero_neg_flags(y);
 }
 
-void Cpu::lsr_a() {
+template <typename Bus>
+void BasicCpu<Bus>::lsr_a() {
   flags.carry = a & 0b1;
 
   a >>= 1;
@@ -775,75 +951,101 @@ void Cpu::lsr_a() {
   update_zero_neg_flags(a);
 }
 
-void Cpu::lsr_mem(uint16_t addr) {
-  uint8_t data = read(addr);
+template <typename Bus>
+template <bool low_ram>
+uint8_t BasicCpu<Bus>::lsr_mem(uint16_t addr) {
+  uint8_t data = read_at<low_ram>(addr);
+  cycles += 2;
 
   flags.carry = data & 0b1;
 
   data >>= 1;
-  write(addr, data);
+  write_at<low_ram>(addr, data);
 
   update_zero_neg_flags(data);
+  return data;
 }
 
-void Cpu::ora(uint16_t addr) {
-  uint8_t data = read(addr);
+template <typename Bus>
+void BasicCpu<Bus>::ora(uint8_t data) {
   a |= data;
   update_zero_neg_flags(a);
 }
 
-void Cpu::sta(uint16_t addr) { write(addr, a); }
+template <typename Bus>
+template <bool low_ram>
+void BasicCpu<Bus>::sta(uint16_t addr) {
+  write_at<low_ram>(addr, a);
+}
 
-void Cpu::stx(uint16_t addr) { write(addr, x); }
+template <typename Bus>
+template <bool low_ram>
+void BasicCpu<Bus>::stx(uint16_t addr) {
+  write_at<low_ram>(addr, x);
+}
 
-void Cpu::sty(uint16_t addr) { write(addr, y); }
+template <typename Bus>
+template <bool low_ram>
+void BasicCpu<Bus>::sty(uint16_t addr) {
+  write_at<low_ram>(addr, y);
+}
 
-void Cpu::transfer_a_to(uint8_t *reg) {
+template <typename Bus>
+void BasicCpu<Bus>::transfer_a_to(uint8_t *reg) {
   *reg = a;
   update_zero_neg_flags(*reg);
 }
 
-void Cpu::tax() {
+template <typename Bus>
+void BasicCpu<Bus>::tax() {
   x = a;
   update_zero_neg_flags(x);
 }
 
-void Cpu::txa() {
+template <typename Bus>
+void BasicCpu<Bus>::txa() {
   a = x;
   update_zero_neg_flags(a);
 }
 
-void Cpu::dex() {
+template <typename Bus>
+void BasicCpu<Bus>::dex() {
   --x;
   update_zero_neg_flags(x);
 }
 
-void Cpu::inx() {
+template <typename Bus>
+void BasicCpu<Bus>::inx() {
   ++x;
   update_zero_neg_flags(x);
 }
 
-void Cpu::tay() {
+template <typename Bus>
+void BasicCpu<Bus>::tay() {
   y = a;
   update_zero_neg_flags(y);
 }
 
-void Cpu::tya() {
+template <typename Bus>
+void BasicCpu<Bus>::tya() {
   a = y;
   update_zero_neg_flags(a);
 }
 
-void Cpu::dey() {
+template <typename Bus>
+void BasicCpu<Bus>::dey() {
   --y;
   update_zero_neg_flags(y);
 }
 
-void Cpu::iny() {
+template <typename Bus>
+void BasicCpu<Bus>::iny() {
   ++y;
   update_zero_neg_flags(y);
 }
 
-void Cpu::rol_a() {
+template <typename Bus>
+void BasicCpu<Bus>::rol_a() {
   uint8_t c = a & 0b10000000;
   a <<= 1;
   a |= (flags.carry ? 1 : 0);
@@ -851,17 +1053,22 @@ void Cpu::rol_a() {
   flags.carry = (c != 0);
 }
 
-void Cpu::rol_mem(uint16_t addr) {
-  uint8_t data = read(addr);
+template <typename Bus>
+template <bool low_ram>
+uint8_t BasicCpu<Bus>::rol_mem(uint16_t addr) {
+  uint8_t data = read_at<low_ram>(addr);
+  cycles += 2;
   uint8_t c = data & 0b10000000;
   data <<= 1;
   data |= (flags.carry ? 1 : 0);
-  write(addr, data);
+  write_at<low_ram>(addr, data);
   update_zero_neg_flags(data);
   flags.carry = (c != 0);
+  return data;
 }
 
-void Cpu::ror_a() {
+template <typename Bus>
+void BasicCpu<Bus>::ror_a() {
   uint8_t c = a & 0b1;
   a >>= 1;
   a |= ((flags.carry ? 1 : 0) << 7);
@@ -869,36 +1076,37 @@ void Cpu::ror_a() {
   flags.carry = (c != 0);
 }
 
-void Cpu::ror_mem(uint16_t addr) {
-  uint8_t data = read(addr);
+template <typename Bus>
+template <bool low_ram>
+uint8_t BasicCpu<Bus>::ror_mem(uint16_t addr) {
+  uint8_t data = read_at<low_ram>(addr);
+  cycles += 2;
   uint8_t c = data & 0b1;
   data >>= 1;
   data |= ((flags.carry ? 1 : 0) << 7);
-  write(addr, data);
+  write_at<low_ram>(addr, data);
   update_zero_neg_flags(data);
   flags.carry = (c != 0);
+  return data;
 }
 
-void Cpu::rti() {
+template <typename Bus>
+void BasicCpu<Bus>::rti() {
   uint8_t saved_flag_bits = stack_pop();
-  flags.negative = saved_flag_bits & 0b10000000;
-  flags.overflow = saved_flag_bits & 0b01000000;
-  flags.decimal = saved_flag_bits & 0b00001000;
-  flags.interrupt_disable = saved_flag_bits & 0b00000100;
-  flags.zero = saved_flag_bits & 0b00000010;
-  flags.carry = saved_flag_bits & 0b00000001;
+  flags.set_bits(saved_flag_bits);
   pc = stack_pop16();
 }
 
-void Cpu::rts() {
+template <typename Bus>
+void BasicCpu<Bus>::rts() {
   uint16_t addr = stack_pop16();
   ++addr;
   pc = addr;
 }
 
 // result is reduced by one if the srflag is **CLEAR**
-void Cpu::sbc(uint16_t addr) {
-  uint8_t data = read(addr);
+template <typename Bus>
+void BasicCpu<Bus>::sbc(uint8_t data) {
   // turn into 1s complement (subtract 1 if no carry)
   data = ~data;
   uint16_t sum = a + data + (flags.carry ? 1 : 0);
@@ -913,21 +1121,26 @@ void Cpu::sbc(uint16_t addr) {
   update_zero_neg_flags(a);
 }
 
-void Cpu::tsx() {
+template <typename Bus>
+void BasicCpu<Bus>::tsx() {
   x = sp;
   update_zero_neg_flags(x);
 }
 
-void Cpu::txs() { sp = x; }
+template <typename Bus>
+void BasicCpu<Bus>::txs() { sp = x; }
 
-void Cpu::pha() { stack_push(a); }
+template <typename Bus>
+void BasicCpu<Bus>::pha() { stack_push(a); }
 
-void Cpu::pla() {
+template <typename Bus>
+void BasicCpu<Bus>::pla() {
   a = stack_pop();
   update_zero_neg_flags(a);
 }
 
-void Cpu::php() {
+template <typename Bus>
+void BasicCpu<Bus>::php() {
   uint8_t bits = flags.bits();
   // B flag is not a "real" flag, but is always set when pushed onto the stack
   // with php. R flag is always set.
@@ -935,36 +1148,107 @@ void Cpu::php() {
   stack_push(bits);
 }
 
-void Cpu::plp() {
+template <typename Bus>
+void BasicCpu<Bus>::plp() {
   uint8_t saved_flag_bits = stack_pop();
-  flags.negative = saved_flag_bits & 0b10000000;
-  flags.overflow = saved_flag_bits & 0b01000000;
-  flags.decimal = saved_flag_bits & 0b00001000;
-  flags.interrupt_disable = saved_flag_bits & 0b00000100;
-  flags.zero = saved_flag_bits & 0b00000010;
-  flags.carry = saved_flag_bits & 0b00000001;
+  flags.set_bits(saved_flag_bits);
 }
 
-void Cpu::lax(uint16_t addr) {
-  uint8_t data = read(addr);
+template <typename Bus>
+void BasicCpu<Bus>::lax(uint8_t data) {
   a = data;
   x = data;
   update_zero_neg_flags(a);
 }
 
-void Cpu::sax(uint16_t addr) {
+template <typename Bus>
+template <bool low_ram>
+void BasicCpu<Bus>::sax(uint16_t addr) {
   uint8_t data = a & x;
-  write(addr, data);
+  write_at<low_ram>(addr, data);
 }
 
-void Cpu::dcp(uint16_t addr) {
-  uint8_t data = read(addr);
-  --data;
+template <typename Bus>
+void BasicCpu<Bus>::anc(uint8_t data) {
+  and_(data);
+  flags.carry = flags.negative();
+}
+
+template <typename Bus>
+void BasicCpu<Bus>::alr(uint8_t data) {
+  a &= data;
+  lsr_a();
+}
+
+// AND, then ROR the accumulator, with the carry and overflow flags taken
+// from bits 6 and 5 of the result
+template <typename Bus>
+void BasicCpu<Bus>::arr(uint8_t data) {
+  a &= data;
+  a = (a >> 1) | ((flags.carry ? 1 : 0) << 7);
+  update_zero_neg_flags(a);
+  flags.carry = a & 0b01000000;
+  flags.overflow = ((a >> 6) ^ (a >> 5)) & 0b1;
+}
+
+// The accumulator is ORed with a constant that varies between chips and
+// with temperature. 0xEE is what most NES units exhibit.
+template <typename Bus>
+void BasicCpu<Bus>::ane(uint8_t data) {
+  a = (a | 0xEE) & x & data;
+  update_zero_neg_flags(a);
+}
+
+// Same unstable constant as ANE
+template <typename Bus>
+void BasicCpu<Bus>::lxa(uint8_t data) {
+  a = (a | 0xEE) & data;
+  x = a;
+  update_zero_neg_flags(a);
+}
+
+// X = (A & X) - data, setting the flags like CMP
+template <typename Bus>
+void BasicCpu<Bus>::sbx(uint8_t data) {
+  uint8_t ax = a & x;
+  compare_with(data, ax);
+  x = ax - data;
+}
+
+template <typename Bus>
+void BasicCpu<Bus>::las(uint8_t data) {
+  a = x = sp = data & sp;
+  update_zero_neg_flags(a);
+}
+
+// Store the data ANDed with the high byte of the address before indexing
+// plus 1, as done by SHA, SHX, SHY and TAS. When indexing crosses a page,
+// the stored value also replaces the high byte of the address.
+template <typename Bus>
+void BasicCpu<Bus>::store_high(uint16_t addr, uint8_t index, uint8_t data) {
+  uint16_t base = addr - index;
+  data &= (base >> 8) + 1;
+  if ((base & 0xFF00) != (addr & 0xFF00)) addr = (data << 8) | (addr & 0xFF);
   write(addr, data);
-  compare_with(addr, a);
 }
 
-void Cpu::handle_nmi() {
+template <typename Bus>
+bool BasicCpu<Bus>::handle_interrupt() {
+  if (interrupts.nmi()) {
+    interrupts.acknowledge_nmi();
+    handle_nmi();
+    return true;
+  }
+  // The IRQ line stays asserted until its sources release it
+  if (interrupts.irq() && !flags.interrupt_disable) {
+    handle_irq();
+    return true;
+  }
+  return false;
+}
+
+template <typename Bus>
+void BasicCpu<Bus>::handle_nmi() {
   stack_push16(pc);
   stack_push(flags.bits());
   flags.interrupt_disable = true;
@@ -972,11 +1256,17 @@ void Cpu::handle_nmi() {
   cycles += 2;
 }
 
-void Cpu::handle_irq() {
+template <typename Bus>
+void BasicCpu<Bus>::handle_irq() {
   stack_push16(pc);
   stack_push(flags.bits());
   flags.interrupt_disable = true;
   pc = read16(0xFFFE);
 }
 
+template struct BasicCpu<Mmu>;
+template struct BasicCpu<NesMmu>;
+template struct BasicCpu<RamOnlyMmu>;
+template struct BasicCpu<DebugNesMmu>;
+
 }  // namespace nesem
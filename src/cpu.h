@@ -7,21 +7,54 @@
 #include <stdint.h>
 
 #include <array>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
+#include "debugger.h"
+#include "decode_cache.h"
+#include "fusion.h"
 #include "instruction_set.h"
+#include "interrupts.h"
 #include "mmu.h"
+#include "profile.h"
 
 namespace nesem {
 
+// Whether the interpreter loop of BasicCpu::run dispatches instructions
+// through computed gotos (configured with NESEM_THREADED_DISPATCH) rather
+// than through the handler table
+#ifdef NESEM_THREADED_DISPATCH
+inline constexpr bool kThreadedDispatch = true;
+#else
+inline constexpr bool kThreadedDispatch = false;
+#endif
+
 struct CpuFlags {
-  bool negative = false;
   bool overflow = false;
   bool brk = false;
   bool decimal = false;
   bool interrupt_disable = true;
-  bool zero = false;
   bool carry = false;
 
+  // The negative and zero flags are derived lazily from the last result
+  // stored with set_nz, which most instructions do
+  bool negative() const { return nz & 0x180; }
+  bool zero() const { return !(nz & 0xFF); }
+
+  // Set the negative and zero flags according to the result
+  void set_nz(uint8_t result) { nz = result; }
+
+  // Set the negative flag from bit 7 of one value, and the zero flag if
+  // another is 0
+  void set_nz(uint8_t negative_source, uint8_t zero_source) {
+    nz = ((negative_source & 0x80) << 1) | (zero_source != 0);
+  }
+
+  void set_negative(bool negative) { set_nz_flags(negative, zero()); }
+  void set_zero(bool zero) { set_nz_flags(negative(), zero); }
+
   // The status register (aka processor flags) is laid out as follows:
   // NV-B DIZC
   // |||| ||||
@@ -35,13 +68,34 @@ struct CpuFlags {
   // |+-------- overflow
   // +--------- negative
   uint8_t bits() const {
-    return (negative << 7) | (overflow << 6) | (1 << 5) | (brk << 4) |
-           (decimal << 3) | (interrupt_disable << 2) | (zero << 1) |
+    return (negative() << 7) | (overflow << 6) | (1 << 5) | (brk << 4) |
+           (decimal << 3) | (interrupt_disable << 2) | (zero() << 1) |
            (carry << 0);
   }
+
+  // Load the flags from the status register, leaving the break flag as is
+  void set_bits(uint8_t bits) {
+    set_nz_flags(bits & 0b10000000, bits & 0b00000010);
+    overflow = bits & 0b01000000;
+    decimal = bits & 0b00001000;
+    interrupt_disable = bits & 0b00000100;
+    carry = bits & 0b00000001;
+  }
+
+ private:
+  // Source of the negative and zero flags. The zero flag is set if the low
+  // byte is 0. The negative flag is set if bit 7 is set (from a result), or
+  // if bit 8 is set (when set independently of the zero flag).
+  uint16_t nz = 1;
+
+  void set_nz_flags(bool negative, bool zero) {
+    nz = (negative ? 0x100 : 0) | (zero ? 0 : 1);
+  }
 };
 
-struct Cpu {
+// Registers and interrupt lines of the cpu, independent of the bus it is
+// attached to
+struct CpuState {
   uint8_t a = 0;      // accumulator
   uint8_t x = 0;      // index register
   uint8_t y = 0;      // index register
@@ -58,8 +112,11 @@ struct Cpu {
   CpuFlags flags;  // processor flags
 
   /* interrupts */
-  bool irq_pending = false;
-  bool nmi_pending = false;
+  InterruptLines interrupts;
+
+  // Set by a JAM opcode, which halts the cpu with the program counter on it.
+  // A jammed cpu executes nothing and ignores interrupts until it is reset.
+  bool jammed = false;
 
   /* interrupt vectors */
   static constexpr uint16_t kNmiVector = 0xFFFA;
@@ -68,9 +125,25 @@ struct Cpu {
 
   size_t cycles = 0;
 
-  Cpu(Mmu *mmu) : mmu(mmu) {}
-  Cpu(const Cpu &c) = delete;
-  ~Cpu() {}
+  // Whether the next step handles an interrupt
+  bool interrupt_pending() const {
+    return interrupts.any() && !jammed &&
+           (interrupts.nmi() || !flags.interrupt_disable);
+  }
+};
+
+// Cpu attached to a bus of type Bus, which is either Mmu or a class derived
+// from it. Instantiating with a concrete mmu class (e.g. BasicCpu<NesMmu>)
+// lets the compiler resolve bus accesses statically and inline them into the
+// instruction handlers, while instantiating with Mmu itself dispatches every
+// access through a virtual call.
+template <typename Bus>
+struct BasicCpu : CpuState {
+  static_assert(std::is_base_of_v<Mmu, Bus>, "Bus must derive from Mmu");
+
+  BasicCpu(Bus *mmu) : mmu(mmu) {}
+  BasicCpu(const BasicCpu &c) = delete;
+  ~BasicCpu() {}
 
   // Read a single byte at the specified address
   uint8_t read(uint16_t addr) const;
@@ -82,18 +155,135 @@ struct Cpu {
   // Write two bytes in little-endian order at the specified address
   void write16(uint16_t addr, uint16_t data);
 
-  // Handle a pending interrupt if applicable, or execute the next instruction
+  // Handle a pending interrupt if applicable, or execute the next
+  // instruction. Does nothing once the cpu is jammed.
   void step();
 
+  // Step until the cycle counter reaches cycle_limit or the cpu jams.
+  // Instructions always run to completion, so the counter may end up a few
+  // cycles past the limit.
+  void run(size_t cycle_limit);
+
+  // Limit of the current run, checked before each instruction. The bus may
+  // lower it while the cpu runs, e.g. when it schedules an event earlier.
+  size_t run_limit = 0;
+
   // Handle the reset signal
   void reset();
 
+  // Execute instructions from a cache of predecoded blocks instead of
+  // decoding each instruction as it is fetched. The cache is invalidated by
+  // the cpu's own writes and by remappings reported by the mmu, so code must
+  // not be modified through the mmu directly while the cache is enabled.
+  void set_decode_cache_enabled(bool enabled);
+  const DecodeCache *decoded_blocks() const { return decode_cache.get(); }
+
+  // Execute the common sequences of instructions listed in fusion.h from a
+  // single handler each. Fused sequences are recognized when decoding, so
+  // this enables the decode cache as well.
+  void set_fusion_enabled(bool enabled);
+  bool fusion_enabled() const { return fusion && decode_cache; }
+
+  // Fused sequences stop before any instruction that would start after this
+  // cycle, leaving it to the next step. Whoever raises interrupts between
+  // steps must set this before each step to the last cycle at which none
+  // can be raised. Instructions accessing anything but CPU RAM and PRG ROM
+  // are never fused after the first one, so that the rest of the system
+  // can catch up before them.
+  size_t fusion_cycle_limit = SIZE_MAX;
+
+  // Number of fused sequences executed to completion, by idiom
+  std::array<uint64_t, kNumFusedIdioms> fusion_hits = {0};
+
+  // Count the executions and cycles of each interpreted instruction into
+  // profile, by opcode and by address. Returns false if profiling was
+  // compiled out (see profile.h).
+  bool set_profiling_enabled(bool enabled);
+  std::unique_ptr<ExecutionProfile> profile;
+
  private:
-  Mmu *mmu;
+  Bus *mmu;
+
+  std::unique_ptr<DecodeCache> decode_cache;
+  // The block being executed from the decode cache and its next instruction,
+  // valid as long as the cache generation has not changed
+  DecodedBlock *block = nullptr;
+  const MicroOp *next_op = nullptr;
+  const MicroOp *block_end = nullptr;
+  uint32_t decode_cache_generation = 0;
+  uint32_t decode_cache_remap_count = 0;
+  bool fusion = false;
+
+  // Handler executing a single opcode. PC is expected to currently be on the
+  // operand.
+  using OpHandler = void (*)(BasicCpu &cpu);
+
+  // Handler executing a single opcode whose operand was already fetched.
+  // Takes the state of the cpu so that it can be stored in a MicroOp.
+  using OperandHandler = MicroOpHandler;
+
+  // One handler per opcode, indexed by machine code. Generated at compile time
+  // from the opcodes table, so that each handler has its addressing mode and
+  // page-cross cycle rule specialized into it.
+  static const std::array<OpHandler, 0x100> op_handlers;
+  static const std::array<OperandHandler, 0x100> operand_handlers;
+
+  template <size_t... opcs>
+  static constexpr std::array<OpHandler, sizeof...(opcs)> make_op_handlers(
+      std::index_sequence<opcs...>);
+  template <size_t... opcs>
+  static constexpr std::array<OperandHandler, sizeof...(opcs)>
+  make_operand_handlers(std::index_sequence<opcs...>);
+
+  // Execute the opcode opc, whose first byte has already been fetched.
+  template <uint8_t opc>
+  static void exec(BasicCpu &cpu);
+
+  // Execute the opcode opc, whose bytes have already been fetched.
+  // The operand holds the bytes following the opcode in little-endian order.
+  template <uint8_t opc>
+  static void exec_operand(CpuState &state, uint16_t operand);
+
+  // One handler per entry of fused_patterns
+  static const std::array<OperandHandler, fused_patterns.size()>
+      fused_handlers;
+
+  template <size_t... ks>
+  static constexpr std::array<OperandHandler, sizeof...(ks)>
+  make_fused_handlers(std::index_sequence<ks...>);
+
+  // Execute the fused sequence fused_patterns[k]. Its first instruction was
+  // decoded into the current micro-op, and the rest into the micro-ops
+  // following it.
+  template <size_t k>
+  static void exec_fused(CpuState &state, uint16_t operand);
+
+  // Execute the next micro-op of a fused sequence, decoded from opcode opc,
+  // unless the sequence must stop before it. Returns false if it stopped.
+  template <uint8_t opc>
+  bool exec_fused_next();
 
-  // Read the address of the operand, resolving addressing modes.
+  // Replace the handlers of the instructions of the block starting fused
+  // sequences. opcs holds the opcode of each micro-op.
+  void fuse(DecodedBlock *block, const std::vector<uint8_t> &opcs);
+
+  // Read the bytes of the operand. PC is expected to currently be on the
+  // operand.
+  template <uint8_t len>
+  uint16_t fetch_operand() const;
+
+  // Resolve the address of the operand according to the addressing mode.
   // PC is expected to currently be on the operand.
-  uint16_t get_operand_addr(const Opcode &mode);
+  template <AddressingMode mode, bool add_cycle_if_page_boundary_crossed>
+  uint16_t get_operand_addr(uint16_t operand);
+
+  // Read or write a byte of memory. When low_ram is set, the address is
+  // known to be in page $00 or $01, which is accessed directly if the bus
+  // allows it (see Mmu::kDirectLowRam).
+  template <bool low_ram>
+  uint8_t read_at(uint16_t addr) const;
+  template <bool low_ram>
+  void write_at(uint16_t addr, uint8_t data);
 
   void stack_push(uint8_t val);
   uint8_t stack_pop();
@@ -105,27 +295,57 @@ struct Cpu {
   // Fetch and execute the instruction under the current program counter
   void fetch_exec();
 
-  void adc(uint16_t addr);
-  void and_(uint16_t addr);
+#ifdef NESEM_THREADED_DISPATCH
+  // Fetch and execute instructions until the cycle counter reaches
+  // run_limit or an interrupt must be handled. Every handler fetches the
+  // next opcode and jumps to its handler itself, so that each one gets its
+  // own indirect branch.
+  void run_threaded();
+#endif
+
+  // Execute the instruction under the current program counter from the
+  // decode cache, decoding its block first if needed
+  void exec_cached();
+
+  // Decode the straight-line run of instructions starting at the address
+  // into the decode cache
+  DecodedBlock *decode_block(uint16_t start);
+
+  // Read a byte through the const accessor of the mmu, which has no side
+  // effects, so that decoding ahead of execution is not seen by the bus
+  uint8_t peek(uint16_t addr) const;
+
+  // Find the block to continue at after leaving the current block
+  DecodedBlock *next_block();
+
+  void adc(uint8_t data);
+  void and_(uint8_t data);
   void asl_a();
-  void asl_mem(uint16_t addr);
-  void bit(uint16_t addr);
-  void branch_cond(uint8_t cond);
+  template <bool low_ram>
+  uint8_t asl_mem(uint16_t addr);
+  void bit(uint8_t data);
+  void branch_cond(uint8_t cond, int8_t rel);
   void brk();
-  void compare_with(uint16_t addr, uint8_t reg);
-  void dec(uint16_t addr);
-  void eor(uint16_t addr);
-  void inc(uint16_t addr);
+  void compare_with(uint8_t data, uint8_t reg);
+  template <bool low_ram>
+  uint8_t dec(uint16_t addr);
+  void eor(uint8_t data);
+  template <bool low_ram>
+  uint8_t inc(uint16_t addr);
   void jmp(uint16_t addr);
-  void jsr();
-  void lda(uint16_t addr);
-  void ldx(uint16_t addr);
-  void ldy(uint16_t addr);
+  void jsr(uint16_t addr);
+  void lda(uint8_t data);
+  void ldx(uint8_t data);
+  void ldy(uint8_t data);
   void lsr_a();
-  void lsr_mem(uint16_t addr);
-  void ora(uint16_t addr);
+  template <bool low_ram>
+  uint8_t lsr_mem(uint16_t addr);
+  void ora(uint8_t data);
+  template <bool low_ram>
   void sta(uint16_t addr);
+  template <bool low_ram>
   void stx(uint16_t addr);
+  template <bool low_ram>
   void sty(uint16_t addr);
   void transfer_a_to(uint8_t *reg);
   void tax();
@@ -137,24 +357,48 @@ struct Cpu {
   void dey();
   void iny();
   void rol_a();
-  void rol_mem(uint16_t addr);
+  template <bool low_ram>
+  uint8_t rol_mem(uint16_t addr);
   void ror_a();
-  void ror_mem(uint16_t addr);
+  template <bool low_ram>
+  uint8_t ror_mem(uint16_t addr);
   void rti();
   void rts();
-  void sbc(uint16_t addr);
+  void sbc(uint8_t data);
   void tsx();
   void txs();
   void pha();
   void pla();
   void php();
   void plp();
-  void lax(uint16_t addr);
+  void lax(uint8_t data);
+  template <bool low_ram>
   void sax(uint16_t addr);
-  void dcp(uint16_t addr);
+  void anc(uint8_t data);
+  void alr(uint8_t data);
+  void arr(uint8_t data);
+  void ane(uint8_t data);
+  void lxa(uint8_t data);
+  void sbx(uint8_t data);
+  void las(uint8_t data);
+  void store_high(uint16_t addr, uint8_t index, uint8_t data);
 
+  // Handle the pending interrupt, if any, returning whether there was one
+  bool handle_interrupt();
   void handle_nmi();
   void handle_irq();
 };
 
+// Cpu whose bus accesses go through the virtual functions of Mmu, for use
+// with any mmu
+using Cpu = BasicCpu<Mmu>;
+
+// Cpu bound to the mmu of a NES
+using NesCpu = BasicCpu<NesMmu>;
+
+extern template struct BasicCpu<Mmu>;
+extern template struct BasicCpu<NesMmu>;
+extern template struct BasicCpu<RamOnlyMmu>;
+extern template struct BasicCpu<DebugNesMmu>;
+
 }  // namespace nesem
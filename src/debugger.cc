@@ -0,0 +1,59 @@
+#include "debugger.h"
+
+#include <algorithm>
+
+namespace nesem {
+
+void Debugger::add_breakpoint(uint16_t pc) {
+  set_flags(pc, pc, kBreakpoint, true);
+}
+
+void Debugger::remove_breakpoint(uint16_t pc) {
+  set_flags(pc, pc, kBreakpoint, false);
+}
+
+void Debugger::add_watchpoint(uint16_t lo, uint16_t hi, WatchKind kind) {
+  set_flags(lo, hi, kind, true);
+}
+
+void Debugger::remove_watchpoint(uint16_t lo, uint16_t hi, WatchKind kind) {
+  set_flags(lo, hi, kind, false);
+}
+
+void Debugger::clear() {
+  std::fill(addr_flags.begin(), addr_flags.end(), 0);
+  page_flags.fill(0);
+}
+
+void Debugger::report(const DebugHit &hit) {
+  if (on_hit && !on_hit(hit)) return;
+  stopped = true;
+  last_hit = hit;
+}
+
+void Debugger::set_flags(uint16_t lo, uint16_t hi, uint8_t flags, bool set) {
+  for (uint32_t addr = lo; addr <= hi; ++addr) {
+    uint16_t canonical = flags & kBreakpoint ? addr : canonical_addr(addr);
+    if (set)
+      addr_flags[canonical] |= flags;
+    else
+      addr_flags[canonical] &= ~flags;
+  }
+
+  // Mirrored ranges may have been folded onto other pages, so recompute the
+  // summary of every page. Watchpoints change rarely, so this is cheap
+  // enough.
+  for (uint32_t page = 0; page < page_flags.size(); ++page) {
+    uint8_t summary = 0;
+    for (uint32_t addr = page << 8; addr < (page + 1) << 8; ++addr)
+      summary |= addr_flags[addr];
+    page_flags[page] = summary;
+  }
+}
+
+void DebugNesMmu::report(DebugHitKind kind, uint16_t addr, uint8_t data) {
+  debugger.report({kind, addr, data, debugger.instruction_pc,
+                   cpu_cycles ? *cpu_cycles : 0});
+}
+
+}  // namespace nesem
@@ -0,0 +1,152 @@
+// Breakpoints and watchpoints.
+//
+// Checking every access against a list of watchpoints would slow down every
+// run, so the checks are only compiled into the mmu of a debug NES
+// (DebugNes, bound to DebugNesMmu). A Nes pays nothing for them.
+//
+// Watched addresses are kept in a bitmap with one byte per address, and a
+// summary with one byte per page, so that accesses to pages without any
+// watchpoint are dismissed with a single lookup.
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "access_trace.h"
+#include "mmu.h"
+
+namespace nesem {
+
+// Kinds of accesses to watch, which may be combined
+enum WatchKind : uint8_t {
+  kWatchRead = 1 << 0,
+  kWatchWrite = 1 << 1,
+  kWatchReadWrite = kWatchRead | kWatchWrite,
+};
+
+enum class DebugHitKind {
+  // The cpu reached a breakpoint, and is about to execute the instruction
+  // under it
+  Breakpoint,
+
+  // The cpu read or wrote a watched address
+  Read,
+  Write,
+};
+
+struct DebugHit {
+  DebugHitKind kind;
+  uint16_t addr;  // address of the breakpoint, or accessed address
+  uint8_t data;   // data read or written
+  uint16_t pc;    // start of the instruction during which the hit occurred
+  size_t cycle;   // cpu cycle of the access, or at the breakpoint
+};
+
+class Debugger {
+ public:
+  Debugger() : addr_flags(0x10000) {}
+
+  // Stop before executing the instruction at the address, whenever the cpu
+  // arrives there from another instruction or an interrupt
+  void add_breakpoint(uint16_t pc);
+  void remove_breakpoint(uint16_t pc);
+
+  // Watch the accesses of the cpu to the range [lo, hi]. Mirrors of CPU RAM
+  // and of the PPU registers are folded onto $0000-$07FF and $2000-$2007, so
+  // watching $2002 catches reads of $3FFA as well.
+  void add_watchpoint(uint16_t lo, uint16_t hi, WatchKind kind);
+  void remove_watchpoint(uint16_t lo, uint16_t hi, WatchKind kind);
+
+  // Remove every breakpoint and watchpoint
+  void clear();
+
+  // Called at each hit. Returns whether the run should stop once the current
+  // instruction completes. When unset, every hit stops the run.
+  std::function<bool(const DebugHit &)> on_hit;
+
+  // Set when a hit stops the run, until the run returns
+  bool stopped = false;
+
+  // The hit that stopped the last run
+  DebugHit last_hit = {};
+
+  // Start of the instruction being executed, as recorded by the NES
+  uint16_t instruction_pc = 0;
+
+  bool watches(uint16_t addr, WatchKind kind) const {
+    addr = canonical_addr(addr);
+    return (page_flags[addr >> 8] & kind) && (addr_flags[addr] & kind);
+  }
+
+  bool has_breakpoint(uint16_t pc) const {
+    return (page_flags[pc >> 8] & kBreakpoint) &&
+           (addr_flags[pc] & kBreakpoint);
+  }
+
+  // Report a hit to the callback, stopping the run if requested
+  void report(const DebugHit &hit);
+
+  // Fold mirrored addresses onto the ones they mirror
+  static uint16_t canonical_addr(uint16_t addr) {
+    if (addr <= 0x1FFF) return addr & 0x07FF;
+    if (addr <= 0x3FFF) return addr & 0x2007;
+    return addr;
+  }
+
+ private:
+  static constexpr uint8_t kBreakpoint = 1 << 2;
+
+  // Flags of each address, and union of the flags of the addresses of each
+  // page
+  std::vector<uint8_t> addr_flags;
+  std::array<uint8_t, 0x100> page_flags = {0};
+
+  void set_flags(uint16_t lo, uint16_t hi, uint8_t flags, bool set);
+};
+
+// NesMmu reporting the accesses of the cpu to watched addresses to its
+// debugger, and recording every access into its access trace, if any.
+// Accesses made by the JIT or AOT compiled code bypass it, so a DebugNes runs
+// everything through the interpreter.
+class DebugNesMmu final : public NesMmu {
+ public:
+  using NesMmu::NesMmu;
+  using NesMmu::read;
+
+  // Accesses to the zero page and the stack are watched as well
+  static constexpr bool kDirectLowRam = false;
+
+  uint8_t read(uint16_t addr) override {
+    uint8_t data = NesMmu::read(addr);
+    if (debugger.watches(addr, kWatchRead))
+      report(DebugHitKind::Read, addr, data);
+    if (access_trace) record(AccessKind::Read, addr, data);
+    return data;
+  }
+
+  void write(uint16_t addr, uint8_t data) override {
+    NesMmu::write(addr, data);
+    if (debugger.watches(addr, kWatchWrite))
+      report(DebugHitKind::Write, addr, data);
+    if (access_trace) record(AccessKind::Write, addr, data);
+  }
+
+  Debugger debugger;
+
+  // Trace the accesses are pushed into, as its only producer
+  AccessTrace *access_trace = nullptr;
+
+ private:
+  void record(AccessKind kind, uint16_t addr, uint8_t data) {
+    access_trace->push({cpu_cycles ? *cpu_cycles : 0, addr,
+                        debugger.instruction_pc, data, kind});
+  }
+
+  void report(DebugHitKind kind, uint16_t addr, uint8_t data);
+};
+
+}  // namespace nesem
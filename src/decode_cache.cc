@@ -0,0 +1,100 @@
+#include "decode_cache.h"
+
+#include <algorithm>
+
+namespace nesem {
+
+DecodedBlock *DecodeCache::find(uint16_t start) {
+  auto it = blocks.find(start);
+  return it == blocks.end() ? nullptr : &it->second;
+}
+
+DecodedBlock *DecodeCache::insert(DecodedBlock &&block) {
+  auto it = blocks.find(block.start);
+  if (it != blocks.end()) {
+    unlink(it->second);
+    remove_pages(it->second);
+    it->second = std::move(block);
+    ++generation;
+  } else {
+    it = blocks.emplace(block.start, std::move(block)).first;
+  }
+  add_pages(it->second);
+  return &it->second;
+}
+
+void DecodeCache::link(DecodedBlock *from, DecodedBlock *to) {
+  BlockLink &link = from->links[0].block ? from->links[1] : from->links[0];
+  link = {to->start, to};
+  if (std::find(to->predecessors.begin(), to->predecessors.end(),
+                from->start) == to->predecessors.end())
+    to->predecessors.push_back(from->start);
+}
+
+// Whether the address is in the range [lo, hi], or mirrors an address in it
+static bool in_range(uint32_t addr, uint16_t lo, uint16_t hi) {
+  if (addr >= lo && addr <= hi) return true;
+  if (addr > 0x1FFF || lo > 0x1FFF) return false;
+  // Compare offsets into CPU RAM
+  uint16_t len = std::min<uint16_t>(hi, 0x1FFF) - lo;
+  return len >= 0x7FF || ((addr - lo) & 0x7FF) <= len;
+}
+
+static bool overlaps(const DecodedBlock &block, uint16_t lo, uint16_t hi) {
+  if (block.start <= hi && block.end >= lo) return true;
+  // Blocks decoded from CPU RAM may also overlap through its mirrors. They
+  // are short, so their bytes are checked one by one.
+  if (block.start > 0x1FFF || lo > 0x1FFF) return false;
+  for (uint32_t addr = block.start; addr <= block.end; ++addr)
+    if (in_range(addr, lo, hi)) return true;
+  return false;
+}
+
+void DecodeCache::invalidate(uint16_t lo, uint16_t hi) {
+  // Only the blocks listed on the pages of the range can overlap it
+  std::vector<DecodedBlock *> dropped;
+  for (int page = lo >> 8; page <= hi >> 8; ++page) {
+    for (uint16_t start : page_blocks[canonical_addr(page << 8) >> 8]) {
+      DecodedBlock &block = blocks.at(start);
+      if (overlaps(block, lo, hi)) dropped.push_back(&block);
+    }
+  }
+  if (dropped.empty()) return;
+  std::sort(dropped.begin(), dropped.end());
+  dropped.erase(std::unique(dropped.begin(), dropped.end()), dropped.end());
+
+  for (DecodedBlock *block : dropped) {
+    unlink(*block);
+    remove_pages(*block);
+  }
+  for (DecodedBlock *block : dropped) blocks.erase(block->start);
+  ++generation;
+}
+
+void DecodeCache::clear() {
+  blocks.clear();
+  for (std::vector<uint16_t> &starts : page_blocks) starts.clear();
+  ++generation;
+}
+
+void DecodeCache::add_pages(const DecodedBlock &block) {
+  for (int page = block.start >> 8; page <= block.end >> 8; ++page)
+    page_blocks[canonical_addr(page << 8) >> 8].push_back(block.start);
+}
+
+void DecodeCache::remove_pages(const DecodedBlock &block) {
+  for (int page = block.start >> 8; page <= block.end >> 8; ++page)
+    std::erase(page_blocks[canonical_addr(page << 8) >> 8], block.start);
+}
+
+void DecodeCache::unlink(const DecodedBlock &block) {
+  // Predecessors may since have been dropped, or have replaced their link
+  for (uint16_t start : block.predecessors) {
+    DecodedBlock *predecessor = find(start);
+    if (!predecessor) continue;
+    for (BlockLink &link : predecessor->links)
+      if (link.block == &block) link = {};
+  }
+}
+
+}  // namespace nesem
@@ -0,0 +1,113 @@
+// Cache of predecoded instructions.
+//
+// Decoding an instruction means fetching its opcode and operand bytes over
+// the bus and looking up its handler. Code running from PRG ROM never
+// changes, so rather than repeating that work every time an instruction is
+// executed, straight-line runs of instructions are decoded once into blocks
+// of compact micro-ops, keyed by the address of their first instruction.
+//
+// Blocks are decoded through the side-effect free reads of the mmu, and are
+// dropped when the memory they were decoded from changes, either through a
+// cpu write or through the mmu remapping the address space (e.g. a mapper
+// bank switch). Addresses in CPU RAM match through its mirrors, so that a
+// write to $0B00 drops the blocks decoded from $0300.
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace nesem {
+
+struct CpuState;
+
+// Executes a predecoded instruction on the cpu owning the state; see
+// BasicCpu::exec_operand
+using MicroOpHandler = void (*)(CpuState &cpu, uint16_t operand);
+
+// A single predecoded instruction
+struct MicroOp {
+  MicroOpHandler exec;
+  uint16_t operand;  // bytes following the opcode, in little-endian order
+  uint16_t pc;       // address of the opcode
+};
+
+struct DecodedBlock;
+
+// A link to a block that execution continued at after leaving another block
+struct BlockLink {
+  uint16_t start = 0;
+  DecodedBlock *block = nullptr;
+};
+
+// A straight-line run of instructions. Only the last instruction of a block
+// may transfer control elsewhere.
+struct DecodedBlock {
+  uint16_t start = 0;  // address of the first instruction
+  uint16_t end = 0;    // address of the last byte of the last instruction
+  std::vector<MicroOp> ops;
+
+  // The blocks most recently executed after this one (e.g. the fall-through
+  // and taken paths of a branch), sparing a lookup when leaving the block.
+  // Cleared when the block they point to is dropped.
+  std::array<BlockLink, 2> links;
+
+  // Start addresses of the blocks that were linked to this one
+  std::vector<uint16_t> predecessors;
+};
+
+class DecodeCache {
+ public:
+  // Maximum number of instructions decoded into a single block
+  static constexpr size_t kMaxBlockLen = 64;
+
+  // Find the block starting at the specified address, if any
+  DecodedBlock *find(uint16_t start);
+
+  // Add a block, replacing any block with the same start address
+  DecodedBlock *insert(DecodedBlock &&block);
+
+  // Link a block to the one that execution continued at after it, replacing
+  // its second link if both are taken
+  void link(DecodedBlock *from, DecodedBlock *to);
+
+  // Whether any block was decoded from the 256-byte page of the address, or
+  // from a mirror of it
+  bool covers(uint16_t addr) const {
+    return !page_blocks[canonical_addr(addr) >> 8].empty();
+  }
+
+  // Drop every block decoded from any byte in the range [lo, hi], or from a
+  // mirror of it
+  void invalidate(uint16_t lo, uint16_t hi);
+
+  // Fold the mirrors of CPU RAM onto $0000-$07FF
+  static uint16_t canonical_addr(uint16_t addr) {
+    return addr <= 0x1FFF ? addr & 0x07FF : addr;
+  }
+
+  // Drop every block
+  void clear();
+
+  // Incremented whenever blocks are dropped, so that holders of a block can
+  // tell that it is gone
+  uint32_t generation = 0;
+
+ private:
+  std::unordered_map<uint16_t, DecodedBlock> blocks;
+
+  // Start addresses of the blocks overlapping each 256-byte page, so that a
+  // write only visits the blocks it may have written over
+  std::array<std::vector<uint16_t>, 0x100> page_blocks;
+
+  void add_pages(const DecodedBlock &block);
+  void remove_pages(const DecodedBlock &block);
+
+  // Clear the links of the predecessors of a block to it
+  void unlink(const DecodedBlock &block);
+};
+
+}  // namespace nesem
@@ -0,0 +1,78 @@
+// Superinstructions.
+//
+// A few short sequences of instructions account for most of the time spent
+// by games: copying a value, counting down a loop, polling the PPU status.
+// When fusion is enabled, the decode cache recognizes these sequences and
+// runs each of them from a single micro-op, saving the dispatch between the
+// instructions. Each instruction still takes its own cycles.
+//
+// Execution of a fused sequence stops early if continuing would hide an
+// event that happens between instructions: see BasicCpu::fusion_cycle_limit.
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <string_view>
+
+namespace nesem {
+
+enum class FusedIdiom {
+  // LDA followed by STA to CPU RAM, e.g. copying a variable
+  LdaSta,
+
+  // DEX; BNE, the end of a loop counting down
+  DexBne,
+
+  // INY; CPY; BNE, the end of a loop counting up
+  InyCpyBne,
+
+  // LDA $2002; BPL, polling the PPU status for vblank
+  LdaPpuStatusBpl,
+
+  // CMP; BEQ
+  CmpBeq,
+};
+
+constexpr size_t kNumFusedIdioms = 5;
+
+constexpr std::string_view fused_idiom_names[kNumFusedIdioms] = {
+    "LDA/STA", "DEX/BNE", "INY/CPY/BNE", "LDA $2002/BPL", "CMP/BEQ"};
+
+// A sequence of opcodes executed by a single handler
+struct FusedPattern {
+  FusedIdiom idiom = FusedIdiom::LdaSta;
+  uint8_t len = 0;
+  uint8_t opcs[3] = {0};
+  int operand = -1;  // operand required for the first instruction, if any
+};
+
+// Every sequence that may be fused, e.g. each combination of LDA and STA
+// opcodes for FusedIdiom::LdaSta. The instructions after the first one use
+// zero page, absolute or immediate operands only, so that whether they access
+// anything but CPU RAM and PRG ROM is known when decoding.
+constexpr auto make_fused_patterns() {
+  constexpr uint8_t lda[] = {0xA9, 0xA5, 0xB5, 0xAD, 0xBD, 0xB9, 0xA1, 0xB1};
+  constexpr uint8_t sta[] = {0x85, 0x95, 0x8D};
+  constexpr uint8_t cpy[] = {0xC0, 0xC4, 0xCC};
+  constexpr uint8_t cmp[] = {0xC9, 0xC5, 0xD5, 0xCD, 0xDD, 0xD9, 0xC1, 0xD1};
+
+  std::array<FusedPattern, std::size(lda) * std::size(sta) + 1 +
+                               std::size(cpy) + 1 + std::size(cmp)>
+      patterns;
+  size_t n = 0;
+  for (uint8_t l : lda)
+    for (uint8_t s : sta) patterns[n++] = {FusedIdiom::LdaSta, 2, {l, s}};
+  patterns[n++] = {FusedIdiom::DexBne, 2, {0xCA, 0xD0}};
+  for (uint8_t c : cpy)
+    patterns[n++] = {FusedIdiom::InyCpyBne, 3, {0xC8, c, 0xD0}};
+  patterns[n++] = {FusedIdiom::LdaPpuStatusBpl, 2, {0xAD, 0x10}, 0x2002};
+  for (uint8_t c : cmp) patterns[n++] = {FusedIdiom::CmpBeq, 2, {c, 0xF0}};
+  return patterns;
+}
+
+constexpr auto fused_patterns = make_fused_patterns();
+
+}  // namespace nesem
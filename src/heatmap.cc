@@ -0,0 +1,181 @@
+#include "heatmap.h"
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <cmath>
+
+namespace nesem {
+
+void AccessHeatmap::clear() {
+  cpu_pages.fill({});
+  ppu_pages.fill({});
+}
+
+static bool accessed(const PageCounter &counter) {
+  return counter.reads || counter.writes || counter.executions;
+}
+
+std::string AccessHeatmap::dump_csv() const {
+  std::string out = "space,page,reads,writes,executions\n";
+  auto dump = [&](const char *space, const auto &pages) {
+    for (size_t page = 0; page < pages.size(); ++page) {
+      const PageCounter &counter = pages[page];
+      if (!accessed(counter)) continue;
+      out += fmt::format("{},{:04X},{},{},{}\n", space, page << 8,
+                         counter.reads, counter.writes, counter.executions);
+    }
+  };
+  dump("cpu", cpu_pages);
+  dump("ppu", ppu_pages);
+  return out;
+}
+
+std::string AccessHeatmap::dump_json() const {
+  std::string out = "{";
+  auto dump = [&](const char *space, const auto &pages) {
+    out += fmt::format("\"{}\":[", space);
+    bool first = true;
+    for (size_t page = 0; page < pages.size(); ++page) {
+      const PageCounter &counter = pages[page];
+      if (!accessed(counter)) continue;
+      out += fmt::format(
+          "{}{{\"page\":\"{:04X}\",\"reads\":{},\"writes\":{},"
+          "\"executions\":{}}}",
+          first ? "" : ",", page << 8, counter.reads, counter.writes,
+          counter.executions);
+      first = false;
+    }
+    out += "]";
+  };
+  dump("cpu", cpu_pages);
+  out += ",";
+  dump("ppu", ppu_pages);
+  out += "}";
+  return out;
+}
+
+// A minimal PNG encoder: 8-bit RGB, no filtering, and a zlib stream made of
+// stored (uncompressed) deflate blocks
+namespace {
+
+class PngWriter {
+ public:
+  PngWriter(size_t width, size_t height) : width(width), height(height) {}
+
+  std::vector<uint8_t> encode(const std::vector<uint8_t> &rgb) {
+    out = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+
+    std::vector<uint8_t> header;
+    put32(&header, width);
+    put32(&header, height);
+    header.insert(header.end(), {8, 2, 0, 0, 0});  // 8-bit RGB
+    chunk("IHDR", header);
+
+    // Each row starts with its filter type (none)
+    std::vector<uint8_t> raw;
+    for (size_t y = 0; y < height; ++y) {
+      raw.push_back(0);
+      raw.insert(raw.end(), rgb.begin() + y * width * 3,
+                 rgb.begin() + (y + 1) * width * 3);
+    }
+    chunk("IDAT", zlib_stored(raw));
+    chunk("IEND", {});
+    return std::move(out);
+  }
+
+ private:
+  size_t width;
+  size_t height;
+  std::vector<uint8_t> out;
+
+  static void put32(std::vector<uint8_t> *v, uint32_t value) {
+    for (int shift = 24; shift >= 0; shift -= 8) v->push_back(value >> shift);
+  }
+
+  static uint32_t crc32(const uint8_t *data, size_t size, uint32_t crc) {
+    crc = ~crc;
+    for (size_t i = 0; i < size; ++i) {
+      crc ^= data[i];
+      for (int bit = 0; bit < 8; ++bit)
+        crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+    }
+    return ~crc;
+  }
+
+  static std::vector<uint8_t> zlib_stored(const std::vector<uint8_t> &data) {
+    std::vector<uint8_t> z = {0x78, 0x01};
+    size_t pos = 0;
+    do {
+      size_t len = std::min<size_t>(data.size() - pos, 0xFFFF);
+      bool last = pos + len == data.size();
+      z.insert(z.end(), {uint8_t(last), uint8_t(len), uint8_t(len >> 8),
+                         uint8_t(~len), uint8_t(~len >> 8)});
+      z.insert(z.end(), data.begin() + pos, data.begin() + pos + len);
+      pos += len;
+    } while (pos < data.size());
+
+    uint32_t a = 1, b = 0;
+    for (uint8_t byte : data) {
+      a = (a + byte) % 65521;
+      b = (b + a) % 65521;
+    }
+    put32(&z, (b << 16) | a);
+    return z;
+  }
+
+  void chunk(const char *type, const std::vector<uint8_t> &data) {
+    put32(&out, data.size());
+    size_t start = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data.begin(), data.end());
+    put32(&out, crc32(&out[start], out.size() - start, 0));
+  }
+};
+
+}  // namespace
+
+std::vector<uint8_t> AccessHeatmap::dump_png() const {
+  constexpr size_t kCell = 8;              // pixels per page
+  constexpr size_t kPanelCells = 16;       // pages per row
+  constexpr size_t kCpuRows = 16;
+  constexpr size_t kPpuRows = 4;
+  constexpr size_t kWidth = (3 * kPanelCells + 2) * kCell;
+  constexpr size_t kHeight = (kCpuRows + 1 + kPpuRows) * kCell;
+
+  // Background, showing between the panels
+  std::vector<uint8_t> rgb(kWidth * kHeight * 3, 0x40);
+
+  auto fill_cell = [&](size_t cell_x, size_t cell_y, double heat) {
+    // Black, through red and yellow, to white
+    uint8_t color[3];
+    for (int c = 0; c < 3; ++c)
+      color[c] = std::clamp(heat * 3 - c, 0.0, 1.0) * 255;
+    for (size_t y = cell_y * kCell; y < (cell_y + 1) * kCell; ++y)
+      for (size_t x = cell_x * kCell; x < (cell_x + 1) * kCell; ++x)
+        std::copy(color, color + 3, &rgb[(y * kWidth + x) * 3]);
+  };
+
+  auto draw = [&](const auto &pages, size_t panel, size_t first_row,
+                  uint64_t PageCounter::*count) {
+    uint64_t max = 0;
+    for (const PageCounter &counter : pages) max = std::max(max, counter.*count);
+    for (size_t page = 0; page < pages.size(); ++page) {
+      double heat = max ? std::log1p(double(pages[page].*count)) /
+                              std::log1p(double(max))
+                        : 0.0;
+      fill_cell(panel * (kPanelCells + 1) + page % kPanelCells,
+                first_row + page / kPanelCells, heat);
+    }
+  };
+
+  uint64_t PageCounter::*counts[] = {&PageCounter::reads, &PageCounter::writes,
+                                     &PageCounter::executions};
+  for (size_t panel = 0; panel < 3; ++panel) {
+    draw(cpu_pages, panel, 0, counts[panel]);
+    draw(ppu_pages, panel, kCpuRows + 1, counts[panel]);
+  }
+  return PngWriter(kWidth, kHeight).encode(rgb);
+}
+
+}  // namespace nesem
@@ -0,0 +1,57 @@
+// Access counters per 256-byte page of the address spaces of the cpu and of
+// the PPU, for finding the regions worth a direct-pointer fast path and the
+// games hammering the PPU registers.
+//
+// The mmu only counts accesses into its heatmap when built with
+// NESEM_HEATMAP, and costs nothing otherwise. The cpu then reads zero page
+// and the stack through the mmu, so that they are counted too. As with the
+// execution profile, instructions run by the JIT or AOT compiled code are
+// not counted.
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace nesem {
+
+// Whether the mmu counts accesses into its heatmap (configured with
+// NESEM_HEATMAP)
+#ifdef NESEM_HEATMAP
+inline constexpr bool kHeatmap = true;
+#else
+inline constexpr bool kHeatmap = false;
+#endif
+
+struct PageCounter {
+  uint64_t reads = 0;
+  uint64_t writes = 0;
+  uint64_t executions = 0;  // of instructions starting in the page
+};
+
+struct AccessHeatmap {
+  // Pages of $0000-$FFFF accessed by the cpu
+  std::array<PageCounter, 0x100> cpu_pages = {};
+
+  // Pages of $0000-$3FFF accessed by the cpu through PPUDATA ($2007). The
+  // fetches of the PPU itself while rendering are not counted.
+  std::array<PageCounter, 0x40> ppu_pages = {};
+
+  void clear();
+
+  // One line per accessed page, with the columns space (cpu or ppu), page,
+  // reads, writes and executions
+  std::string dump_csv() const;
+
+  // Same counters as a JSON object holding a "cpu" and a "ppu" array
+  std::string dump_json() const;
+
+  // PNG image of the reads, writes and executions side by side, with a cell
+  // per page on a logarithmic scale: the cpu pages in a 16x16 grid, and the
+  // PPU pages in 4 rows below
+  std::vector<uint8_t> dump_png() const;
+};
+
+}  // namespace nesem
@@ -0,0 +1,30 @@
+#include "idle_loop.h"
+
+namespace nesem {
+
+IdleLoop find_idle_loop(const NesMmu &mmu, uint16_t pc) {
+  auto read16 = [&](uint16_t addr) -> uint16_t {
+    return mmu.read(addr) | (mmu.read(addr + 1) << 8);
+  };
+
+  uint8_t opc = mmu.read(pc);
+  if (opc == 0x4C && read16(pc + 1) == pc)  // JMP abs
+    return {IdleLoopKind::JmpSelf, 3};
+
+  if (opc != 0xAD && opc != 0x2C) return {};  // LDA abs, BIT abs
+  uint16_t operand = read16(pc + 1);
+  // $2002 and its mirrors
+  if (operand < 0x2000 || operand > 0x3FFF || (operand & 0x7) != 0x2)
+    return {};
+  // BPL back to the first instruction
+  if (mmu.read(pc + 3) != 0x10 || mmu.read(pc + 4) != 0xFB) return {};
+
+  // The branch is taken, crossing a page if the loop does
+  uint16_t next = pc + 5;
+  uint8_t cycles = 4 + 3 + ((next & 0xFF00) != (pc & 0xFF00));
+  return {opc == 0xAD ? IdleLoopKind::LdaPpuStatusBpl
+                      : IdleLoopKind::BitPpuStatusBpl,
+          cycles};
+}
+
+}  // namespace nesem
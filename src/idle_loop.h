@@ -0,0 +1,52 @@
+// Idle loops.
+//
+// While waiting for vblank or for the NMI, games spin in tight loops that
+// either poll the PPU status or jump to themselves:
+//
+//   loop: LDA $2002        loop: BIT $2002        loop: JMP loop
+//         BPL loop               BPL loop
+//
+// Every iteration of such a loop leaves the cpu and the PPU in the same
+// state as the previous one until vblank starts, so any number of iterations
+// before it can be skipped at once by advancing the cycle counters.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "mmu.h"
+
+namespace nesem {
+
+enum class IdleLoopKind {
+  None,
+
+  // JMP to itself, waiting for an interrupt
+  JmpSelf,
+
+  // LDA $2002; BPL, waiting for the vblank flag
+  LdaPpuStatusBpl,
+
+  // BIT $2002; BPL, waiting for the vblank flag
+  BitPpuStatusBpl,
+};
+
+struct IdleLoop {
+  IdleLoopKind kind = IdleLoopKind::None;
+  uint8_t cycles = 0;  // cycles taken by each iteration
+
+  explicit operator bool() const { return kind != IdleLoopKind::None; }
+
+  // Whether each iteration reads the PPU status
+  bool polls_ppu_status() const {
+    return kind == IdleLoopKind::LdaPpuStatusBpl ||
+           kind == IdleLoopKind::BitPpuStatusBpl;
+  }
+};
+
+// Recognize the idle loop starting at the address, if any. The code is read
+// without side effects.
+IdleLoop find_idle_loop(const NesMmu &mmu, uint16_t pc);
+
+}  // namespace nesem
@@ -0,0 +1,54 @@
+// Interrupt lines of the cpu.
+//
+// The IRQ line is level triggered and shared: it stays asserted as long as
+// any of its sources asserts it, and each source releases it when the
+// program acknowledges it (e.g. by writing to a mapper register). The NMI
+// line is edge triggered: a rising edge is latched until the cpu handles it.
+//
+// Both lines live in a single word, so that the cpu checks for interrupts
+// with a single comparison per instruction while none is asserted.
+
+#pragma once
+
+#include <cstdint>
+
+namespace nesem {
+
+// Devices that may assert the IRQ line, one bit each
+enum IrqSource : uint8_t {
+  // Asserted from outside of the emulated system, e.g. by tests
+  kIrqExternal = 1 << 0,
+  kIrqMapper = 1 << 1,
+  kIrqFrameCounter = 1 << 2,
+  kIrqDmc = 1 << 3,
+};
+
+struct InterruptLines {
+  // Bits 0-7 hold the IRQ sources asserting the line, and bit 8 the latched
+  // NMI edge
+  uint16_t word = 0;
+
+  static constexpr uint16_t kIrqMask = 0xFF;
+  static constexpr uint16_t kNmiLatched = 0x100;
+
+  // Whether either line needs the attention of the cpu
+  bool any() const { return word; }
+
+  void assert_irq(IrqSource source) { word |= source; }
+  void release_irq(IrqSource source) { word &= ~source; }
+  void set_irq(IrqSource source, bool asserted) {
+    asserted ? assert_irq(source) : release_irq(source);
+  }
+
+  // Whether any source asserts the IRQ line
+  bool irq() const { return word & kIrqMask; }
+  bool irq_asserted_by(IrqSource source) const { return word & source; }
+
+  // Latch a rising edge of the NMI line
+  void raise_nmi() { word |= kNmiLatched; }
+  // Clear the latched edge, once the cpu handles it
+  void acknowledge_nmi() { word &= ~kNmiLatched; }
+  bool nmi() const { return word & kNmiLatched; }
+};
+
+}  // namespace nesem
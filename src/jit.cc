@@ -0,0 +1,1047 @@
+#include "jit.h"
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__))
+#define NESEM_JIT_SUPPORTED 1
+#include <sys/mman.h>
+#endif
+
+#include <cstddef>
+#include <cstring>
+#include <string_view>
+
+namespace nesem {
+
+#ifdef NESEM_JIT_SUPPORTED
+
+namespace {
+
+// Size of the executable memory region
+constexpr size_t kRegionSize = 4 * 1024 * 1024;
+
+// Upper bound of the size of the code compiled for a single block
+constexpr size_t kMaxBlockCodeSize = Jit::kMaxBlockLen * 256;
+
+enum Reg {
+  RAX,
+  RCX,
+  RDX,
+  RBX,
+  RSP,
+  RBP,
+  RSI,
+  RDI,
+  R8,
+  R9,
+  R10,
+  R11,
+  R12,
+  R13,
+  R14,
+  R15
+};
+
+// Host registers holding the 6502 state; see jit.h
+constexpr Reg kA = R12;
+constexpr Reg kX = R13;
+constexpr Reg kY = R14;
+constexpr Reg kSp = R15;
+constexpr Reg kN = RBX;
+constexpr Reg kZ = RBP;
+constexpr Reg kC = R10;
+constexpr Reg kV = R11;
+constexpr Reg kCtx = RDI;
+constexpr Reg kWram = RSI;
+constexpr Reg kPrg = R8;
+
+// Condition codes
+enum Cond { kCondB = 2, kCondAE = 3, kCondE = 4, kCondNE = 5, kCondA = 7 };
+
+// Opcodes of register to register ALU instructions
+enum AluOp : uint8_t {
+  kAdd = 0x01,
+  kOr = 0x09,
+  kAnd = 0x21,
+  kSub = 0x29,
+  kXor = 0x31,
+  kCmp = 0x39,
+  kTest = 0x85,
+};
+
+// Opcode extensions of ALU instructions with an immediate
+enum AluExt : uint8_t {
+  kAddImm = 0,
+  kOrImm = 1,
+  kAndImm = 4,
+  kSubImm = 5,
+  kXorImm = 6,
+  kCmpImm = 7,
+};
+
+// Memory operand [base + index + disp]
+struct Mem {
+  Reg base;
+  int index;  // -1 for none
+  int32_t disp;
+};
+
+Mem at(Reg base, int32_t disp) { return {base, -1, disp}; }
+Mem at(Reg base, Reg index, int32_t disp) { return {base, index, disp}; }
+
+Mem ctx(size_t offset) { return at(kCtx, (int32_t)offset); }
+
+// Minimal x86-64 assembler for the instruction forms used by the compiler.
+// 32-bit operations are used on registers holding 8-bit values, which keeps
+// the upper bits clear.
+class Emitter {
+ public:
+  std::vector<uint8_t> code;
+
+  // base: address the code will be installed at
+  explicit Emitter(const uint8_t *base) : base((uintptr_t)base) {}
+
+  size_t pos() const { return code.size(); }
+
+  void mov(Reg dst, Reg src) { alu(0x89, dst, src); }
+
+  void mov64(Reg dst, Reg src) {
+    rex(true, src, -1, dst, false);
+    byte(0x89);
+    modrm(3, src, dst);
+  }
+
+  void alu(uint8_t op, Reg dst, Reg src) {
+    rex(false, src, -1, dst, false);
+    byte(op);
+    modrm(3, src, dst);
+  }
+
+  void alu_imm(AluExt ext, Reg dst, uint32_t imm) {
+    rex(false, 0, -1, dst, false);
+    byte(0x81);
+    modrm(3, ext, dst);
+    dword(imm);
+  }
+
+  void mov_imm(Reg dst, uint32_t imm) {
+    rex(false, 0, -1, dst, false);
+    byte(0xB8 + (dst & 7));
+    dword(imm);
+  }
+
+  void shl(Reg dst, uint8_t n) { shift(4, dst, n); }
+  void shr(Reg dst, uint8_t n) { shift(5, dst, n); }
+
+  void test_imm(Reg dst, uint32_t imm) {
+    rex(false, 0, -1, dst, false);
+    byte(0xF7);
+    modrm(3, 0, dst);
+    dword(imm);
+  }
+
+  void setcc(Cond cond, Reg dst) {
+    rex(false, 0, -1, dst, true);
+    byte(0x0F);
+    byte(0x90 + cond);
+    modrm(3, 0, dst);
+  }
+
+  void movzx8(Reg dst, Mem m) {
+    rex(false, dst, m.index, m.base, false);
+    byte(0x0F);
+    byte(0xB6);
+    mem(dst, m);
+  }
+
+  void store8(Mem m, Reg src) {
+    rex(false, src, m.index, m.base, true);
+    byte(0x88);
+    mem(src, m);
+  }
+
+  void store8_imm(Mem m, uint8_t imm) {
+    rex(false, 0, m.index, m.base, false);
+    byte(0xC6);
+    mem(0, m);
+    byte(imm);
+  }
+
+  void store16(Mem m, Reg src) {
+    byte(0x66);
+    rex(false, src, m.index, m.base, false);
+    byte(0x89);
+    mem(src, m);
+  }
+
+  void store16_imm(Mem m, uint16_t imm) {
+    byte(0x66);
+    rex(false, 0, m.index, m.base, false);
+    byte(0xC7);
+    mem(0, m);
+    byte(imm & 0xFF);
+    byte(imm >> 8);
+  }
+
+  void load64(Reg dst, Mem m) {
+    rex(true, dst, m.index, m.base, false);
+    byte(0x8B);
+    mem(dst, m);
+  }
+
+  void add64_imm(Mem m, uint32_t imm) {
+    rex(true, 0, m.index, m.base, false);
+    byte(0x81);
+    mem(kAddImm, m);
+    dword(imm);
+  }
+
+  void add64_imm(Reg dst, uint32_t imm) {
+    rex(true, 0, -1, dst, false);
+    byte(0x81);
+    modrm(3, kAddImm, dst);
+    dword(imm);
+  }
+
+  void cmp64(Reg r, Mem m) {
+    rex(true, r, m.index, m.base, false);
+    byte(0x3B);
+    mem(r, m);
+  }
+
+  void add64(Mem m, Reg src) {
+    rex(true, src, m.index, m.base, false);
+    byte(0x01);
+    mem(src, m);
+  }
+
+  void push(Reg r) {
+    if (r >= 8) byte(0x41);
+    byte(0x50 + (r & 7));
+  }
+
+  void pop(Reg r) {
+    if (r >= 8) byte(0x41);
+    byte(0x58 + (r & 7));
+  }
+
+  void ret() { byte(0xC3); }
+
+  void jmp(Reg r) {
+    rex(false, 0, -1, r, false);
+    byte(0xFF);
+    modrm(3, 4, r);
+  }
+
+  // Jump to a label bound later. Returns the position to bind.
+  size_t jcc(Cond cond) {
+    byte(0x0F);
+    byte(0x80 + cond);
+    dword(0);
+    return pos() - 4;
+  }
+
+  size_t jmp() {
+    byte(0xE9);
+    dword(0);
+    return pos() - 4;
+  }
+
+  // Jump to an absolute address
+  void jmp(const uint8_t *target) {
+    byte(0xE9);
+    dword((uint32_t)((uintptr_t)target - (base + pos() + 4)));
+  }
+
+  void jcc(Cond cond, const uint8_t *target) {
+    byte(0x0F);
+    byte(0x80 + cond);
+    dword((uint32_t)((uintptr_t)target - (base + pos() + 4)));
+  }
+
+  // Make the jump emitted at the position land at the current position
+  void bind(size_t jump) { patch32(jump, pos() - (jump + 4)); }
+
+  void patch32(size_t at, uint32_t value) { memcpy(&code[at], &value, 4); }
+
+ private:
+  uintptr_t base;
+
+  void byte(uint8_t b) { code.push_back(b); }
+
+  void dword(uint32_t d) {
+    for (int i = 0; i < 4; ++i) byte(d >> (i * 8));
+  }
+
+  // byte_reg: whether reg or rm are accessed as 8-bit registers, in which
+  // case a prefix is needed to address spl, bpl, sil and dil
+  void rex(bool w, int reg, int index, int rm, bool byte_reg) {
+    uint8_t prefix = 0x40 | (w << 3) | ((reg >> 3) << 2) |
+                     ((index > 0 ? index >> 3 : 0) << 1) | (rm >> 3);
+    bool needed = prefix != 0x40 ||
+                  (byte_reg && ((reg >= 4 && reg < 8) || (rm >= 4 && rm < 8)));
+    if (needed) byte(prefix);
+  }
+
+  void modrm(int mod, int reg, int rm) {
+    byte((mod << 6) | ((reg & 7) << 3) | (rm & 7));
+  }
+
+  void shift(int ext, Reg dst, uint8_t n) {
+    rex(false, 0, -1, dst, false);
+    byte(0xC1);
+    modrm(3, ext, dst);
+    byte(n);
+  }
+
+  // Always encoded with a 32-bit displacement
+  void mem(int reg, Mem m) {
+    if (m.index >= 0 || (m.base & 7) == RSP) {
+      modrm(2, reg, 4);
+      int index = m.index >= 0 ? m.index : RSP;
+      byte(((index & 7) << 3) | (m.base & 7));
+    } else {
+      modrm(2, reg, m.base);
+    }
+    dword(m.disp);
+  }
+};
+
+// Whether an instruction that may be compiled reads, writes, or reads then
+// writes its operand
+enum class Access { kNone, kRead, kWrite, kReadWrite };
+
+Access access_of(std::string_view op, AddressingMode mode) {
+  if (mode == AddressingMode::Implied || mode == AddressingMode::Relative ||
+      op == "NOP" || op == "JMP" || op == "JSR")
+    return Access::kNone;
+  if (op == "STA" || op == "STX" || op == "STY") return Access::kWrite;
+  if (op == "INC" || op == "DEC" || op == "ASL" || op == "LSR" ||
+      op == "ROL" || op == "ROR")
+    return Access::kReadWrite;
+  return Access::kRead;
+}
+
+bool is_branch(std::string_view op) {
+  return op == "BCC" || op == "BCS" || op == "BEQ" || op == "BMI" ||
+         op == "BNE" || op == "BPL" || op == "BVC" || op == "BVS";
+}
+
+bool ends_block(std::string_view op) {
+  return is_branch(op) || op == "JMP" || op == "JSR" || op == "RTS";
+}
+
+bool is_compilable(std::string_view op) {
+  static constexpr std::string_view kCompilable[] = {
+      "LDA", "LDX", "LDY", "STA", "STX", "STY", "TAX", "TAY", "TSX", "TXA",
+      "TYA", "TXS", "PHA", "PHP", "PLA", "INC", "DEC", "INX", "INY", "DEX",
+      "DEY", "ADC", "SBC", "AND", "EOR", "ORA", "ASL", "LSR", "ROL", "ROR",
+      "CLC", "SEC", "CLV", "CLD", "SED", "CMP", "CPX", "CPY", "BIT", "NOP",
+      "BCC", "BCS", "BEQ", "BMI", "BNE", "BPL", "BVC", "BVS", "JMP", "JSR",
+      "RTS"};
+  for (std::string_view c : kCompilable)
+    if (op == c) return true;
+  return false;
+}
+
+// Translates a single block
+class Compiler {
+ public:
+  Compiler(const uint8_t *base, const uint8_t *epilogue,
+           const std::vector<uint8_t> &prg)
+      : e(base), epilogue(epilogue), prg(prg), prg_mask(prg.size() - 1) {}
+
+  Emitter e;
+
+  // Jumps leaving the block for a known address, which may later be
+  // redirected to the block compiled at that address
+  struct Link {
+    size_t jump;
+    uint16_t target;
+  };
+  std::vector<Link> links;
+
+  // Start the block with a check that it finishes within the cycle limit,
+  // leaving it otherwise
+  void prologue() {
+    e.load64(RAX, ctx(offsetof(JitContext, cycles)));
+    e.add64_imm(RAX, 0);
+    max_cycles_imm = e.pos() - 4;
+    e.cmp64(RAX, ctx(offsetof(JitContext, cycle_limit)));
+    e.jcc(kCondA, epilogue);
+  }
+
+  // Compile the instruction at the address. Returns false if it cannot be
+  // compiled, in which case nothing is emitted.
+  bool instruction(uint16_t pc, bool *ended);
+
+  // End the block, continuing at the address
+  void finish(uint16_t next_pc) { exit_to(next_pc, pending); }
+
+  // Emit the side exits of the block
+  void side_exits();
+
+  uint8_t rom(uint16_t addr) const { return prg[(addr - 0x8000) & prg_mask]; }
+
+ private:
+  const uint8_t *epilogue;
+  const std::vector<uint8_t> &prg;
+  uint16_t prg_mask;
+
+  // Cycles of the compiled instructions not yet added to the cycle counter
+  uint32_t pending = 0;
+
+  // Upper bound of the cycles taken by the block
+  uint32_t max_cycles = 0;
+  size_t max_cycles_imm = 0;
+
+  struct SideExit {
+    size_t jump;
+    uint16_t pc;
+    uint32_t cycles;
+  };
+  std::vector<SideExit> exits;
+
+  // Address of the instruction being compiled
+  uint16_t instr_pc = 0;
+
+  void exit_to(uint16_t pc, uint32_t cycles, bool link = true) {
+    if (cycles) e.add64_imm(ctx(offsetof(JitContext, cycles)), cycles);
+    e.store16_imm(ctx(offsetof(JitContext, pc)), pc);
+    e.jmp(epilogue);
+    if (link) links.push_back({e.pos() - 4, pc});
+  }
+
+  // Leave the block before the current instruction if the condition holds
+  void side_exit(Cond cond) {
+    exits.push_back({e.jcc(cond), instr_pc, pending});
+  }
+
+  void set_nz(Reg r) {
+    e.mov(kN, r);
+    e.mov(kZ, r);
+  }
+
+  // Leave the block before the current instruction if it stores to a page of
+  // CPU RAM holding predecoded code. Clobbers r9d.
+  void check_code_page(int page) {
+    e.movzx8(R9, ctx(offsetof(JitContext, code_pages) + page));
+    e.alu(kTest, R9, R9);
+    side_exit(kCondNE);
+  }
+
+  // Same, for the offset into CPU RAM held by the register. Clobbers ecx and
+  // r9d.
+  void check_code_page(Reg offset) {
+    e.mov(RCX, offset);
+    e.shr(RCX, 8);
+    e.movzx8(R9, at(kCtx, RCX, (int32_t)offsetof(JitContext, code_pages)));
+    e.alu(kTest, R9, R9);
+    side_exit(kCondNE);
+  }
+
+  // Resolve an address known at compile time to host memory
+  bool static_mem(uint16_t addr, bool write, Mem *m) const {
+    if (addr <= 0x1FFF) {
+      *m = at(kWram, addr & 0x7FF);
+      return true;
+    }
+    if (addr >= 0x8000 && !write) {
+      *m = at(kPrg, (addr - 0x8000) & prg_mask);
+      return true;
+    }
+    return false;
+  }
+
+  // Compute the effective address of an indexed or indirect operand into
+  // edx. For modes that may cross a page, ecx is set to 1 if they do.
+  void dynamic_addr(AddressingMode mode, uint16_t operand);
+
+  // Load the operand into eax, adding the page crossing cycle if needed
+  void load(const Opcode &opcode, uint16_t operand);
+
+  // Resolve the operand of an instruction writing to memory. Leaves the
+  // block if it is not in CPU RAM, or if it holds predecoded code.
+  Mem store_target(const Opcode &opcode, uint16_t operand);
+
+  void push(Reg r) {
+    e.mov(RCX, kSp);
+    e.store8(at(kWram, RCX, 0x100), r);
+    e.alu_imm(kSubImm, kSp, 1);
+    e.alu_imm(kAndImm, kSp, 0xFF);
+  }
+
+  void pop(Reg r) {
+    e.alu_imm(kAddImm, kSp, 1);
+    e.alu_imm(kAndImm, kSp, 0xFF);
+    e.movzx8(r, at(kWram, kSp, 0x100));
+  }
+
+  void adc();
+  void compare(Reg r);
+  void branch(std::string_view op, uint16_t pc, int8_t rel);
+  void php();
+  void rmw(std::string_view op, Reg r);
+};
+
+void Compiler::dynamic_addr(AddressingMode mode, uint16_t operand) {
+  switch (mode) {
+    case AddressingMode::ZeropageX:
+    case AddressingMode::ZeropageY:
+      e.mov(RDX, mode == AddressingMode::ZeropageX ? kX : kY);
+      e.alu_imm(kAddImm, RDX, operand);
+      e.alu_imm(kAndImm, RDX, 0xFF);
+      break;
+    case AddressingMode::AbsoluteX:
+    case AddressingMode::AbsoluteY: {
+      Reg index = mode == AddressingMode::AbsoluteX ? kX : kY;
+      e.mov(RDX, index);
+      e.alu_imm(kAddImm, RDX, operand);
+      e.alu_imm(kAndImm, RDX, 0xFFFF);
+      e.mov(RCX, index);
+      e.alu_imm(kAddImm, RCX, operand & 0xFF);
+      e.shr(RCX, 8);
+      break;
+    }
+    case AddressingMode::IndirectX:
+      e.mov(RCX, kX);
+      e.alu_imm(kAddImm, RCX, operand);
+      e.alu_imm(kAndImm, RCX, 0xFF);
+      e.movzx8(RDX, at(kWram, RCX, 0));
+      e.alu_imm(kAddImm, RCX, 1);
+      e.alu_imm(kAndImm, RCX, 0xFF);
+      e.movzx8(RAX, at(kWram, RCX, 0));
+      e.shl(RAX, 8);
+      e.alu(kOr, RDX, RAX);
+      break;
+    case AddressingMode::IndirectY:
+      e.movzx8(RAX, at(kWram, operand & 0xFF));
+      e.movzx8(RCX, at(kWram, (operand + 1) & 0xFF));
+      e.shl(RCX, 8);
+      e.alu(kOr, RAX, RCX);
+      e.mov(RDX, RAX);
+      e.alu(kAdd, RDX, kY);
+      e.alu_imm(kAndImm, RDX, 0xFFFF);
+      e.alu_imm(kAndImm, RAX, 0xFF);
+      e.alu(kAdd, RAX, kY);
+      e.shr(RAX, 8);
+      e.mov(RCX, RAX);
+      break;
+    default:
+      break;
+  }
+}
+
+void Compiler::load(const Opcode &opcode, uint16_t operand) {
+  Mem m;
+  switch (opcode.mode) {
+    case AddressingMode::Immediate:
+      e.mov_imm(RAX, operand);
+      return;
+    case AddressingMode::Zeropage:
+    case AddressingMode::Absolute:
+      static_mem(operand, false, &m);
+      e.movzx8(RAX, m);
+      return;
+    case AddressingMode::ZeropageX:
+    case AddressingMode::ZeropageY:
+      dynamic_addr(opcode.mode, operand);
+      e.movzx8(RAX, at(kWram, RDX, 0));
+      return;
+    default:
+      break;
+  }
+
+  dynamic_addr(opcode.mode, operand);
+  e.alu_imm(kCmpImm, RDX, 0x2000);
+  size_t not_wram = e.jcc(kCondAE);
+  e.alu_imm(kAndImm, RDX, 0x7FF);
+  e.movzx8(RAX, at(kWram, RDX, 0));
+  size_t done = e.jmp();
+  e.bind(not_wram);
+  e.alu_imm(kCmpImm, RDX, 0x8000);
+  side_exit(kCondB);
+  e.alu_imm(kSubImm, RDX, 0x8000);
+  e.alu_imm(kAndImm, RDX, prg_mask);
+  e.movzx8(RAX, at(kPrg, RDX, 0));
+  e.bind(done);
+
+  if (opcode.does_add_cycle_if_page_boundary_crossed())
+    e.add64(ctx(offsetof(JitContext, cycles)), RCX);
+}
+
+Mem Compiler::store_target(const Opcode &opcode, uint16_t operand) {
+  Mem m;
+  switch (opcode.mode) {
+    case AddressingMode::Zeropage:
+    case AddressingMode::Absolute:
+      static_mem(operand, true, &m);
+      check_code_page((operand & 0x7FF) >> 8);
+      return m;
+    case AddressingMode::ZeropageX:
+    case AddressingMode::ZeropageY:
+      check_code_page(0);
+      dynamic_addr(opcode.mode, operand);
+      return at(kWram, RDX, 0);
+    default:
+      dynamic_addr(opcode.mode, operand);
+      e.alu_imm(kCmpImm, RDX, 0x2000);
+      side_exit(kCondAE);
+      e.alu_imm(kAndImm, RDX, 0x7FF);
+      check_code_page(RDX);
+      return at(kWram, RDX, 0);
+  }
+}
+
+// Add eax and the carry to A
+void Compiler::adc() {
+  e.mov(RCX, kA);
+  e.mov(RDX, RAX);
+  e.alu(kAdd, RAX, kA);
+  e.alu(kAdd, RAX, kC);
+  e.mov(kC, RAX);
+  e.shr(kC, 8);
+  e.alu_imm(kAndImm, RAX, 0xFF);
+  // overflow if both operands have a sign different from the result
+  e.alu(kXor, RDX, RAX);
+  e.alu(kXor, RCX, RAX);
+  e.alu(kAnd, RDX, RCX);
+  e.shr(RDX, 7);
+  e.alu_imm(kAndImm, RDX, 1);
+  e.mov(kV, RDX);
+  e.mov(kA, RAX);
+  set_nz(kA);
+}
+
+// Compare the register with eax
+void Compiler::compare(Reg r) {
+  e.mov_imm(kC, 0);
+  e.mov(RCX, r);
+  e.alu(kSub, RCX, RAX);
+  e.setcc(kCondAE, kC);
+  e.alu_imm(kAndImm, RCX, 0xFF);
+  set_nz(RCX);
+}
+
+void Compiler::branch(std::string_view op, uint16_t pc, int8_t rel) {
+  Cond taken;
+  if (op == "BCC" || op == "BCS") {
+    e.alu(kTest, kC, kC);
+    taken = op == "BCC" ? kCondE : kCondNE;
+  } else if (op == "BEQ" || op == "BNE") {
+    e.alu(kTest, kZ, kZ);
+    taken = op == "BEQ" ? kCondE : kCondNE;
+  } else if (op == "BMI" || op == "BPL") {
+    e.test_imm(kN, 0x80);
+    taken = op == "BMI" ? kCondNE : kCondE;
+  } else {
+    e.alu(kTest, kV, kV);
+    taken = op == "BVC" ? kCondE : kCondNE;
+  }
+  size_t jump = e.jcc(taken);
+
+  uint16_t next = pc + 2;
+  exit_to(next, pending + 2);
+
+  e.bind(jump);
+  uint16_t target = next + rel;
+  uint32_t penalty = (target & 0xFF00) != (next & 0xFF00) ? 2 : 1;
+  exit_to(target, pending + 2 + penalty);
+}
+
+void Compiler::php() {
+  e.mov(RAX, kN);
+  e.alu_imm(kAndImm, RAX, 0x80);
+  e.mov(RCX, kV);
+  e.shl(RCX, 6);
+  e.alu(kOr, RAX, RCX);
+  e.alu_imm(kOrImm, RAX, 0b00110000);
+  e.movzx8(RCX, ctx(offsetof(JitContext, d)));
+  e.shl(RCX, 3);
+  e.alu(kOr, RAX, RCX);
+  e.movzx8(RCX, ctx(offsetof(JitContext, i)));
+  e.shl(RCX, 2);
+  e.alu(kOr, RAX, RCX);
+  e.mov_imm(RCX, 0);
+  e.alu(kTest, kZ, kZ);
+  e.setcc(kCondE, RCX);
+  e.shl(RCX, 1);
+  e.alu(kOr, RAX, RCX);
+  e.alu(kOr, RAX, kC);
+  push(RAX);
+}
+
+// Shift, rotate, increment or decrement the register in place. Clobbers ecx
+// and r9d, but not edx which may hold the address of the operand.
+void Compiler::rmw(std::string_view op, Reg r) {
+  if (op == "ASL") {
+    e.mov(kC, r);
+    e.shr(kC, 7);
+    e.shl(r, 1);
+    e.alu_imm(kAndImm, r, 0xFF);
+  } else if (op == "LSR") {
+    e.mov(kC, r);
+    e.alu_imm(kAndImm, kC, 1);
+    e.shr(r, 1);
+  } else if (op == "ROL") {
+    e.mov(RCX, r);
+    e.shr(RCX, 7);
+    e.shl(r, 1);
+    e.alu(kOr, r, kC);
+    e.alu_imm(kAndImm, r, 0xFF);
+    e.mov(kC, RCX);
+  } else if (op == "ROR") {
+    e.mov(RCX, r);
+    e.alu_imm(kAndImm, RCX, 1);
+    e.shr(r, 1);
+    e.mov(R9, kC);
+    e.shl(R9, 7);
+    e.alu(kOr, r, R9);
+    e.mov(kC, RCX);
+  } else if (op == "INC") {
+    e.alu_imm(kAddImm, r, 1);
+    e.alu_imm(kAndImm, r, 0xFF);
+  } else if (op == "DEC") {
+    e.alu_imm(kSubImm, r, 1);
+    e.alu_imm(kAndImm, r, 0xFF);
+  }
+  set_nz(r);
+}
+
+bool Compiler::instruction(uint16_t pc, bool *ended) {
+  const Opcode &opcode = opcodes[rom(pc)];
+  std::string_view op = opcode.mnemonic;
+  if (!is_compilable(op) || opcode.mode == AddressingMode::Indirect)
+    return false;
+  if (pc + opcode.len - 1 > 0xFFFF) return false;
+
+  uint16_t operand = 0;
+  if (opcode.len == 3)
+    operand = rom(pc + 1) | (rom(pc + 2) << 8);
+  else if (opcode.len == 2)
+    operand = rom(pc + 1);
+
+  // Accesses to fixed addresses outside of RAM and ROM are left to the
+  // interpreter
+  Access access = access_of(op, opcode.mode);
+  if (access != Access::kNone && opcode.mode == AddressingMode::Absolute) {
+    Mem m;
+    if (!static_mem(operand, access != Access::kRead, &m)) return false;
+  }
+
+  instr_pc = pc;
+  max_cycles += opcode.cycles;
+  if (opcode.does_add_cycle_if_page_boundary_crossed()) ++max_cycles;
+  if (is_branch(op)) max_cycles += 2;
+  *ended = ends_block(op);
+
+  // Pushes write to the stack page
+  if (op == "PHA" || op == "PHP" || op == "JSR") check_code_page(1);
+
+  if (op == "LDA" || op == "LDX" || op == "LDY") {
+    load(opcode, operand);
+    Reg r = op == "LDA" ? kA : op == "LDX" ? kX : kY;
+    e.mov(r, RAX);
+    set_nz(r);
+  } else if (op == "STA" || op == "STX" || op == "STY") {
+    Reg r = op == "STA" ? kA : op == "STX" ? kX : kY;
+    e.store8(store_target(opcode, operand), r);
+  } else if (op == "TAX" || op == "TAY" || op == "TSX" || op == "TXA" ||
+             op == "TYA" || op == "TXS") {
+    Reg src = op[1] == 'A' ? kA : op[1] == 'S' ? kSp : op[1] == 'X' ? kX : kY;
+    Reg dst = op[2] == 'A' ? kA : op[2] == 'S' ? kSp : op[2] == 'X' ? kX : kY;
+    e.mov(dst, src);
+    if (op != "TXS") set_nz(dst);
+  } else if (op == "PHA") {
+    push(kA);
+  } else if (op == "PHP") {
+    php();
+  } else if (op == "PLA") {
+    pop(kA);
+    set_nz(kA);
+  } else if (op == "INX" || op == "DEX") {
+    rmw(op[0] == 'I' ? "INC" : "DEC", kX);
+  } else if (op == "INY" || op == "DEY") {
+    rmw(op[0] == 'I' ? "INC" : "DEC", kY);
+  } else if (access == Access::kReadWrite) {
+    Mem m = store_target(opcode, operand);
+    e.movzx8(RAX, m);
+    rmw(op, RAX);
+    e.store8(m, RAX);
+  } else if (op == "ASL" || op == "LSR" || op == "ROL" || op == "ROR") {
+    rmw(op, kA);
+  } else if (op == "ADC") {
+    load(opcode, operand);
+    adc();
+  } else if (op == "SBC") {
+    load(opcode, operand);
+    e.alu_imm(kXorImm, RAX, 0xFF);
+    adc();
+  } else if (op == "AND" || op == "EOR" || op == "ORA") {
+    load(opcode, operand);
+    e.alu(op == "AND" ? kAnd : op == "EOR" ? kXor : kOr, kA, RAX);
+    set_nz(kA);
+  } else if (op == "CMP" || op == "CPX" || op == "CPY") {
+    load(opcode, operand);
+    compare(op == "CMP" ? kA : op == "CPX" ? kX : kY);
+  } else if (op == "BIT") {
+    load(opcode, operand);
+    e.mov(kN, RAX);
+    e.mov(kV, RAX);
+    e.shr(kV, 6);
+    e.alu_imm(kAndImm, kV, 1);
+    e.mov(kZ, RAX);
+    e.alu(kAnd, kZ, kA);
+  } else if (op == "CLC" || op == "SEC") {
+    e.mov_imm(kC, op == "SEC");
+  } else if (op == "CLV") {
+    e.mov_imm(kV, 0);
+  } else if (op == "CLD" || op == "SED") {
+    e.store8_imm(ctx(offsetof(JitContext, d)), op == "SED");
+  } else if (op == "NOP") {
+    if (opcode.does_add_cycle_if_page_boundary_crossed()) {
+      dynamic_addr(opcode.mode, operand);
+      e.add64(ctx(offsetof(JitContext, cycles)), RCX);
+    }
+  } else if (is_branch(op)) {
+    branch(op, pc, (int8_t)operand);
+    return true;
+  } else if (op == "JMP") {
+    exit_to(operand, pending + opcode.cycles);
+    return true;
+  } else if (op == "JSR") {
+    uint16_t ret = pc + 2;
+    e.mov_imm(RAX, ret >> 8);
+    push(RAX);
+    e.mov_imm(RAX, ret & 0xFF);
+    push(RAX);
+    exit_to(operand, pending + opcode.cycles);
+    return true;
+  } else if (op == "RTS") {
+    pop(RAX);
+    pop(RDX);
+    e.shl(RDX, 8);
+    e.alu(kOr, RAX, RDX);
+    e.alu_imm(kAddImm, RAX, 1);
+    e.add64_imm(ctx(offsetof(JitContext, cycles)), pending + opcode.cycles);
+    e.store16(ctx(offsetof(JitContext, pc)), RAX);
+    e.jmp(epilogue);
+    return true;
+  }
+
+  pending += opcode.cycles;
+  return true;
+}
+
+void Compiler::side_exits() {
+  for (const SideExit &exit : exits) {
+    e.bind(exit.jump);
+    exit_to(exit.pc, exit.cycles, false);
+  }
+  e.patch32(max_cycles_imm, max_cycles);
+}
+
+// Entry trampoline: void (*)(JitContext *ctx, const uint8_t *code)
+void emit_trampoline(Emitter *e) {
+  for (Reg r : {RBX, RBP, R12, R13, R14, R15}) e->push(r);
+  e->mov64(RAX, RSI);
+  e->load64(kWram, ctx(offsetof(JitContext, wram)));
+  e->load64(kPrg, ctx(offsetof(JitContext, prg)));
+  e->movzx8(kA, ctx(offsetof(JitContext, a)));
+  e->movzx8(kX, ctx(offsetof(JitContext, x)));
+  e->movzx8(kY, ctx(offsetof(JitContext, y)));
+  e->movzx8(kSp, ctx(offsetof(JitContext, sp)));
+  e->movzx8(kN, ctx(offsetof(JitContext, n)));
+  e->movzx8(kZ, ctx(offsetof(JitContext, z)));
+  e->movzx8(kC, ctx(offsetof(JitContext, c)));
+  e->movzx8(kV, ctx(offsetof(JitContext, v)));
+  e->jmp(RAX);
+}
+
+// Exit path shared by all blocks
+void emit_epilogue(Emitter *e) {
+  e->store8(ctx(offsetof(JitContext, a)), kA);
+  e->store8(ctx(offsetof(JitContext, x)), kX);
+  e->store8(ctx(offsetof(JitContext, y)), kY);
+  e->store8(ctx(offsetof(JitContext, sp)), kSp);
+  e->store8(ctx(offsetof(JitContext, n)), kN);
+  e->store8(ctx(offsetof(JitContext, z)), kZ);
+  e->store8(ctx(offsetof(JitContext, c)), kC);
+  e->store8(ctx(offsetof(JitContext, v)), kV);
+  for (Reg r : {R15, R14, R13, R12, RBP, RBX}) e->pop(r);
+  e->ret();
+}
+
+using Trampoline = void (*)(JitContext *ctx, const uint8_t *code);
+
+// Redirect the jump whose displacement is at the address
+void link(uint8_t *jump, const uint8_t *target) {
+  uint32_t rel = (uint32_t)(target - (jump + 4));
+  memcpy(jump, &rel, 4);
+}
+
+}  // namespace
+
+Jit::Jit(NesMmu *mmu, uint32_t hot_threshold)
+    : mmu(mmu), hot_threshold(hot_threshold), remap_count(mmu->remap_count) {
+  void *mem = mmap(nullptr, kRegionSize, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED) return;
+  region = (uint8_t *)mem;
+  region_size = kRegionSize;
+
+  Emitter e{region};
+  emit_trampoline(&e);
+  size_t epilogue = e.pos();
+  emit_epilogue(&e);
+  memcpy(region, e.code.data(), e.code.size());
+  region_used = region_blocks_start = e.code.size();
+  epilogue_offset = epilogue;
+  if (mprotect(region, region_size, PROT_READ | PROT_EXEC) != 0) {
+    munmap(region, region_size);
+    region = nullptr;
+  }
+}
+
+Jit::~Jit() {
+  if (region) munmap(region, region_size);
+}
+
+bool Jit::supported() const {
+  size_t size = mmu->prg->size();
+  return region && size > 0 && (size & (size - 1)) == 0 &&
+         mmu->mapper->fixed_prg() && !mmu->has_cheats();
+}
+
+void Jit::flush() {
+  blocks.clear();
+  unresolved_links.clear();
+  region_used = region_blocks_start;
+}
+
+bool Jit::run(CpuState *cpu, size_t max_cycles,
+              const DecodeCache *decode_cache) {
+  if (!supported()) return false;
+  if (cpu->interrupt_pending()) return false;
+  if (mmu->remap_count != remap_count) {
+    flush();
+    remap_count = mmu->remap_count;
+  }
+
+  JitContext ctx;
+  ctx.wram = mmu->wram.data();
+  ctx.prg = mmu->prg->data();
+  ctx.cycles = cpu->cycles;
+  ctx.cycle_limit = cpu->cycles + max_cycles;
+  ctx.pc = cpu->pc;
+  ctx.a = cpu->a;
+  ctx.x = cpu->x;
+  ctx.y = cpu->y;
+  ctx.sp = cpu->sp;
+  ctx.n = cpu->flags.negative() ? 0x80 : 0;
+  ctx.z = cpu->flags.zero() ? 0 : 1;
+  ctx.c = cpu->flags.carry;
+  ctx.v = cpu->flags.overflow;
+  ctx.d = cpu->flags.decimal;
+  ctx.i = cpu->flags.interrupt_disable;
+  for (int page = 0; page < 8; ++page)
+    ctx.code_pages[page] = decode_cache && decode_cache->covers(page << 8);
+
+  auto trampoline = (Trampoline)region;
+  bool ran = false;
+  while (ctx.pc >= 0x8000) {
+    if (region_size - region_used < kMaxBlockCodeSize) flush();
+
+    Block &block = blocks[ctx.pc];
+    if (!block.code) {
+      if (!block.compilable || ++block.entries < hot_threshold) break;
+      if (!compile(ctx.pc, &block)) {
+        block.compilable = false;
+        break;
+      }
+    }
+    uint16_t pc = ctx.pc;
+    uint64_t cycles = ctx.cycles;
+    trampoline(&ctx, block.code);
+    // Left the block before its first instruction, e.g. because it might not
+    // finish within the cycle limit
+    if (ctx.pc == pc && ctx.cycles == cycles) break;
+    ran = true;
+  }
+
+  if (ran) {
+    cpu->cycles = ctx.cycles;
+    cpu->pc = ctx.pc;
+    cpu->a = ctx.a;
+    cpu->x = ctx.x;
+    cpu->y = ctx.y;
+    cpu->sp = ctx.sp;
+    cpu->flags.set_nz(ctx.n, ctx.z);
+    cpu->flags.carry = ctx.c;
+    cpu->flags.overflow = ctx.v;
+    cpu->flags.decimal = ctx.d;
+  }
+  return ran;
+}
+
+bool Jit::compile(uint16_t start, Block *block) {
+  uint8_t *code = region + region_used;
+  Compiler c{code, region + epilogue_offset, *mmu->prg};
+  c.prologue();
+  uint32_t pc = start;
+  size_t len = 0;
+  bool ended = false;
+  while (!ended && len < kMaxBlockLen && pc <= 0xFFFF) {
+    if (!c.instruction(pc, &ended)) break;
+    pc += opcodes[c.rom(pc)].len;
+    ++len;
+  }
+  if (len == 0) return false;
+  if (!ended) c.finish(pc);
+  c.side_exits();
+
+  if (c.e.code.size() > region_size - region_used) return false;
+  if (mprotect(region, region_size, PROT_READ | PROT_WRITE) != 0)
+    return false;
+  memcpy(code, c.e.code.data(), c.e.code.size());
+  region_used += c.e.code.size();
+  block->code = code;
+
+  // Chain the block with the compiled blocks it jumps to and from
+  for (const Compiler::Link &l : c.links) {
+    auto it = blocks.find(l.target);
+    if (it != blocks.end() && it->second.code)
+      link(code + l.jump, it->second.code);
+    else
+      unresolved_links.emplace(l.target, code + l.jump - region);
+  }
+  auto [first, last] = unresolved_links.equal_range(start);
+  for (auto it = first; it != last; ++it) link(region + it->second, code);
+  unresolved_links.erase(start);
+
+  mprotect(region, region_size, PROT_READ | PROT_EXEC);
+  return true;
+}
+
+#else  // !NESEM_JIT_SUPPORTED
+
+Jit::Jit(NesMmu *mmu, uint32_t hot_threshold)
+    : mmu(mmu), hot_threshold(hot_threshold) {}
+
+Jit::~Jit() {}
+
+bool Jit::supported() const { return false; }
+
+void Jit::flush() {
+  blocks.clear();
+  unresolved_links.clear();
+}
+
+bool Jit::run(CpuState *cpu, size_t max_cycles,
+              const DecodeCache *decode_cache) {
+  return false;
+}
+
+bool Jit::compile(uint16_t start, Block *block) { return false; }
+
+#endif  // NESEM_JIT_SUPPORTED
+
+}  // namespace nesem
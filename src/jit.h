@@ -0,0 +1,125 @@
+// Dynamic recompiler translating hot blocks of PRG ROM code into native
+// x86-64 code.
+//
+// A block is a straight-line run of instructions ending at the first control
+// flow instruction. Blocks jump directly to each other when the destination
+// is compiled, as long as they are guaranteed to finish within the cycle
+// limit. While compiled code runs, the 6502 registers and flags live in host
+// registers:
+//
+//   r12d  A        ebx   source of the N flag (bit 7)
+//   r13d  X        ebp   source of the Z flag (set when zero)
+//   r14d  Y        r10d  C flag (0 or 1)
+//   r15d  SP       r11d  V flag (0 or 1)
+//
+// Only cartridges whose PRG ROM is not bank switched nor patched by cheats
+// are supported.
+//
+// Accesses to CPU RAM and PRG ROM go straight to host memory. Any access to
+// another address (PPU and APU registers, expansion area, save RAM) leaves
+// the block just before the instruction performing it, so that the
+// interpreter executes it once the PPU has caught up. The cycle counter is
+// kept exact at every exit. So does any store to a page of CPU RAM holding
+// code predecoded by the decode cache of the cpu, so that the interpreter
+// drops the blocks decoded from it.
+//
+// Only instructions whose effects are fully described by the above are
+// compiled; a block ends before the first instruction that is not (e.g.
+// RTI, PLP, CLI, or most illegal opcodes).
+//
+// Compiled code is only generated on x86-64 hosts with POSIX virtual memory.
+// Elsewhere, the engine never runs anything and the interpreter is used.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "cpu.h"
+#include "mmu.h"
+
+namespace nesem {
+
+// State shared between the engine and compiled code
+struct JitContext {
+  uint8_t *wram;
+  const uint8_t *prg;
+  uint64_t cycles;
+  uint64_t cycle_limit;  // blocks are only entered if they finish by then
+  uint16_t pc;
+  uint8_t a;
+  uint8_t x;
+  uint8_t y;
+  uint8_t sp;
+  uint8_t n;  // the N flag is bit 7
+  uint8_t z;  // the Z flag is set when this is zero
+  uint8_t c;
+  uint8_t v;
+  uint8_t d;
+  uint8_t i;
+  // Set for each 256-byte page of CPU RAM holding predecoded code
+  uint8_t code_pages[8];
+};
+
+class Jit {
+ public:
+  // Default number of times a block must be entered before it is compiled
+  static constexpr uint32_t kDefaultHotThreshold = 16;
+
+  // Maximum number of instructions compiled into a single block
+  static constexpr size_t kMaxBlockLen = 64;
+
+  explicit Jit(NesMmu *mmu, uint32_t hot_threshold = kDefaultHotThreshold);
+  Jit(const Jit &) = delete;
+  ~Jit();
+
+  // Whether compiled code can run on this host and cartridge
+  bool supported() const;
+
+  // Run compiled blocks starting at the cpu's program counter, for as long
+  // as they are compiled and guaranteed to finish within the specified
+  // number of cycles. Nothing is run while an interrupt is pending.
+  //
+  // Returns false if no instruction was executed, in which case the caller
+  // should step the interpreter instead.
+  //
+  // Stores to the pages of CPU RAM covered by decode_cache, the decode cache
+  // of the cpu if it has one, are left to the interpreter.
+  bool run(CpuState *cpu, size_t max_cycles,
+           const DecodeCache *decode_cache = nullptr);
+
+  // Drop all compiled code
+  void flush();
+
+ private:
+  struct Block {
+    uint32_t entries = 0;  // times the block was entered uncompiled
+    const uint8_t *code = nullptr;
+    bool compilable = true;
+  };
+
+  NesMmu *mmu;
+  uint32_t hot_threshold;
+  uint32_t remap_count = 0;
+  std::unordered_map<uint16_t, Block> blocks;
+
+  // Offsets in the region of jumps to blocks not compiled yet, by address of
+  // the block
+  std::unordered_multimap<uint16_t, size_t> unresolved_links;
+
+  // Executable memory holding the entry trampoline, the shared exit path and
+  // compiled blocks
+  uint8_t *region = nullptr;
+  size_t region_size = 0;
+  size_t region_used = 0;
+  size_t region_blocks_start = 0;
+  size_t epilogue_offset = 0;
+
+  // Compile the block starting at the address. Returns false if not even its
+  // first instruction can be compiled.
+  bool compile(uint16_t start, Block *block);
+};
+
+}  // namespace nesem
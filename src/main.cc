@@ -2,9 +2,12 @@
 #include <fmt/core.h>
 
 #include <cstdio>
+#include <filesystem>
 #include <fstream>
 
+#include "bus_errors.h"
 #include "cartridge.h"
+#include "cheats.h"
 #include "cpu.h"
 #include "mmu.h"
 #include "render.h"
@@ -25,6 +28,26 @@ int main(int argc, char **argv) {
     return 1;
   }
   nesem::Nes nes{cartridge};
+  if (cartridge.battery) {
+    // Saved next to the ROM, e.g. in game.sav for game.nes
+    std::string save_path =
+        std::filesystem::path(nes_file_path).replace_extension(".sav");
+    try {
+      nes.mmu.set_save_ram(std::make_shared<nesem::SaveRam>(save_path));
+    } catch (const std::exception &e) {
+      fmt::print(stderr, "{}\n", e.what());
+      return 1;
+    }
+  }
+  // Cheat codes follow the ROM on the command line
+  for (int i = 2; i < argc; ++i) {
+    try {
+      nes.mmu.add_cheat(nesem::parse_cheat(argv[i]));
+    } catch (const std::exception &e) {
+      fmt::print(stderr, "{}\n", e.what());
+      return 1;
+    }
+  }
   nes.cpu.reset();
 
   SDL_Init(SDL_INIT_VIDEO);
@@ -48,76 +71,83 @@ int main(int argc, char **argv) {
     return 1;
   }
 
-  uint8_t scanline = nes.mmu.ppu.scanline;
+  // Release the save RAM before quitting, which writes it back to the file
+  auto quit = [&] {
+    nes.mmu.set_save_ram(nullptr);
+    return 0;
+  };
 
-  for (;;) {
-    // fmt::print("{}\n", nesem::trace_explain_state(nes));
-    nes.step();
-    if (nes.mmu.ppu.scanline < scanline) {
-      nesem::render(&render_ctx, nes.mmu.ppu);
+  nesem::BusErrorLog bus_error_log;
+  for (size_t frame = 1;; ++frame) {
+    if (nes.run_frame() == nesem::RunStatus::Jammed) {
+      fmt::print(stderr, "CPU jammed at ${:04X}\n", nes.cpu.pc);
+      return 1;
+    }
+    // Save about once per second
+    if (frame % 60 == 0) nes.mmu.flush_save_ram();
+    bus_error_log.report(nes.mmu.bus_errors);
+    nesem::render(&render_ctx, nes.mmu.ppu);
 
-      SDL_Event e;
-      if (SDL_PollEvent(&e)) {
-        switch (e.type) {
-          case SDL_QUIT:
-            exit(0);
-          case SDL_KEYDOWN:
-            switch (e.key.keysym.sym) {
-                case SDLK_ESCAPE:
-                    exit(0);
-                case SDLK_a:
-                    nes.mmu.gamepad.btn_a = true;
-                    break;
-                case SDLK_b:
-                    nes.mmu.gamepad.btn_b = true;
-                    break;
-                case SDLK_RETURN:
-                    nes.mmu.gamepad.btn_start = true;
-                    break;
-                case SDLK_UP:
-                    nes.mmu.gamepad.btn_up = true;
-                    break;
-                case SDLK_DOWN:
-                    nes.mmu.gamepad.btn_down = true;
-                    break;
-                case SDLK_LEFT:
-                    nes.mmu.gamepad.btn_left = true;
-                    break;
-                case SDLK_RIGHT:
-                    nes.mmu.gamepad.btn_right = true;
-                    break;
-            }
-            break;
-          case SDL_KEYUP:
-            switch (e.key.keysym.sym) {
-                case SDLK_ESCAPE:
-                    exit(0);
-                case SDLK_a:
-                    nes.mmu.gamepad.btn_a = false;
-                    break;
-                case SDLK_b:
-                    nes.mmu.gamepad.btn_b = false;
-                    break;
-                case SDLK_RETURN:
-                    nes.mmu.gamepad.btn_start = false;
-                    break;
-                case SDLK_UP:
-                    nes.mmu.gamepad.btn_up = false;
-                    break;
-                case SDLK_DOWN:
-                    nes.mmu.gamepad.btn_down = false;
-                    break;
-                case SDLK_LEFT:
-                    nes.mmu.gamepad.btn_left = false;
-                    break;
-                case SDLK_RIGHT:
-                    nes.mmu.gamepad.btn_right = false;
-                    break;
-            }
-            break;
-        }
+    SDL_Event e;
+    if (SDL_PollEvent(&e)) {
+      switch (e.type) {
+        case SDL_QUIT:
+          return quit();
+        case SDL_KEYDOWN:
+          switch (e.key.keysym.sym) {
+              case SDLK_ESCAPE:
+                  return quit();
+              case SDLK_a:
+                  nes.mmu.gamepad.btn_a = true;
+                  break;
+              case SDLK_b:
+                  nes.mmu.gamepad.btn_b = true;
+                  break;
+              case SDLK_RETURN:
+                  nes.mmu.gamepad.btn_start = true;
+                  break;
+              case SDLK_UP:
+                  nes.mmu.gamepad.btn_up = true;
+                  break;
+              case SDLK_DOWN:
+                  nes.mmu.gamepad.btn_down = true;
+                  break;
+              case SDLK_LEFT:
+                  nes.mmu.gamepad.btn_left = true;
+                  break;
+              case SDLK_RIGHT:
+                  nes.mmu.gamepad.btn_right = true;
+                  break;
+          }
+          break;
+        case SDL_KEYUP:
+          switch (e.key.keysym.sym) {
+              case SDLK_ESCAPE:
+                  return quit();
+              case SDLK_a:
+                  nes.mmu.gamepad.btn_a = false;
+                  break;
+              case SDLK_b:
+                  nes.mmu.gamepad.btn_b = false;
+                  break;
+              case SDLK_RETURN:
+                  nes.mmu.gamepad.btn_start = false;
+                  break;
+              case SDLK_UP:
+                  nes.mmu.gamepad.btn_up = false;
+                  break;
+              case SDLK_DOWN:
+                  nes.mmu.gamepad.btn_down = false;
+                  break;
+              case SDLK_LEFT:
+                  nes.mmu.gamepad.btn_left = false;
+                  break;
+              case SDLK_RIGHT:
+                  nes.mmu.gamepad.btn_right = false;
+                  break;
+          }
+          break;
       }
     }
-    scanline = nes.mmu.ppu.scanline;
   }
 }
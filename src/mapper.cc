@@ -0,0 +1,356 @@
+#include "mapper.h"
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace nesem {
+
+// Cartridges without CHR ROM have 8KB of CHR RAM instead
+constexpr size_t kChrRamSize = 0x2000;
+
+Mapper::Mapper(const Cartridge &cartridge)
+    : mirroring(cartridge.mirroring),
+      prg_size(cartridge.prg.size()),
+      chr_size(cartridge.chr.empty() ? kChrRamSize : cartridge.chr.size()) {
+  map_prg(0x8000, 0x8000, 0);
+  map_chr(0x0000, 0x2000, 0);
+}
+
+// Offset of the byte at offset in bank number bank of the size, in a memory
+// of total bytes
+static uint32_t bank_offset(int bank, size_t size, size_t offset,
+                            size_t total) {
+  if (total == 0) return 0;
+  int count = std::max<int>(total / size, 1);
+  bank %= count;
+  if (bank < 0) bank += count;
+  return (bank * size + offset) % total;
+}
+
+void Mapper::map_prg(uint16_t addr, size_t size, int bank) {
+  for (size_t offset = 0; offset < size; offset += 0x2000)
+    prg_banks[(addr - 0x8000 + offset) / 0x2000] =
+        bank_offset(bank, size, offset, prg_size);
+}
+
+void Mapper::map_chr(uint16_t addr, size_t size, int bank) {
+  for (size_t offset = 0; offset < size; offset += 0x400)
+    chr_banks[(addr + offset) / 0x400] =
+        bank_offset(bank, size, offset, chr_size);
+}
+
+// https://www.nesdev.org/wiki/NROM
+class Nrom final : public Mapper {
+ public:
+  explicit Nrom(const Cartridge &cartridge) : Mapper(cartridge) {}
+
+  std::unique_ptr<Mapper> clone() const override {
+    return std::make_unique<Nrom>(*this);
+  }
+
+  void write(uint16_t addr, uint8_t /*data*/) override {
+    throw std::runtime_error(
+        fmt::format("Attempted to write to ROM at {:04X}", addr));
+  }
+
+  bool fixed_prg() const override { return true; }
+};
+
+// https://www.nesdev.org/wiki/MMC1
+//
+// Registers are written one bit at a time through a shift register. The
+// 512KB PRG ROM variants (SUROM) are not supported.
+class Mmc1 final : public Mapper {
+ public:
+  explicit Mmc1(const Cartridge &cartridge) : Mapper(cartridge) { update(); }
+
+  std::unique_ptr<Mapper> clone() const override {
+    return std::make_unique<Mmc1>(*this);
+  }
+
+  void write(uint16_t addr, uint8_t data) override {
+    if (data & 0x80) {
+      shift = kShiftEmpty;
+      control |= 0x0C;
+      update();
+      return;
+    }
+    bool complete = shift & 1;
+    shift = (shift >> 1) | ((data & 1) << 4);
+    if (!complete) return;
+
+    switch ((addr >> 13) & 0b11) {
+      case 0:
+        control = shift;
+        break;
+      case 1:
+        chr_bank_0 = shift;
+        break;
+      case 2:
+        chr_bank_1 = shift;
+        break;
+      case 3:
+        prg_bank = shift & 0x0F;
+        break;
+    }
+    shift = kShiftEmpty;
+    update();
+  }
+
+ private:
+  // The shift register is full once the marker bit reaches bit 0
+  static constexpr uint8_t kShiftEmpty = 0x10;
+
+  uint8_t shift = kShiftEmpty;
+  uint8_t control = 0x0C;
+  uint8_t chr_bank_0 = 0;
+  uint8_t chr_bank_1 = 0;
+  uint8_t prg_bank = 0;
+
+  void update() {
+    static constexpr ScreenMirroring kMirroring[] = {
+        ScreenMirroring::SingleScreenLower, ScreenMirroring::SingleScreenUpper,
+        ScreenMirroring::Vertical, ScreenMirroring::Horizontal};
+    mirroring = kMirroring[control & 0b11];
+
+    switch ((control >> 2) & 0b11) {
+      case 0:
+      case 1:  // 32KB
+        map_prg(0x8000, 0x8000, prg_bank >> 1);
+        break;
+      case 2:  // first bank fixed at $8000
+        map_prg(0x8000, 0x4000, 0);
+        map_prg(0xC000, 0x4000, prg_bank);
+        break;
+      case 3:  // last bank fixed at $C000
+        map_prg(0x8000, 0x4000, prg_bank);
+        map_prg(0xC000, 0x4000, -1);
+        break;
+    }
+
+    if (control & 0x10) {  // two 4KB banks
+      map_chr(0x0000, 0x1000, chr_bank_0);
+      map_chr(0x1000, 0x1000, chr_bank_1);
+    } else {
+      map_chr(0x0000, 0x2000, chr_bank_0 >> 1);
+    }
+  }
+};
+
+// https://www.nesdev.org/wiki/UxROM
+class Uxrom final : public Mapper {
+ public:
+  explicit Uxrom(const Cartridge &cartridge) : Mapper(cartridge) {
+    map_prg(0xC000, 0x4000, -1);
+  }
+
+  std::unique_ptr<Mapper> clone() const override {
+    return std::make_unique<Uxrom>(*this);
+  }
+
+  void write(uint16_t /*addr*/, uint8_t data) override {
+    map_prg(0x8000, 0x4000, data);
+  }
+};
+
+// https://www.nesdev.org/wiki/INES_Mapper_003
+class Cnrom final : public Mapper {
+ public:
+  explicit Cnrom(const Cartridge &cartridge) : Mapper(cartridge) {}
+
+  std::unique_ptr<Mapper> clone() const override {
+    return std::make_unique<Cnrom>(*this);
+  }
+
+  void write(uint16_t /*addr*/, uint8_t data) override {
+    map_chr(0x0000, 0x2000, data);
+  }
+
+  bool fixed_prg() const override { return true; }
+};
+
+// https://www.nesdev.org/wiki/MMC3
+//
+// The scanline counter is clocked by the rising edges of the PPU address
+// line A12. Rather than following the addresses the PPU fetches at each dot,
+// the counter is clocked once per rendered scanline, at the dot where the
+// pattern tables in use make A12 rise: dot 260 when sprites are fetched from
+// $1000 and the background from $0000, dot 324 the other way around. Other
+// configurations, which games avoid, never clock it. 8x16 sprites are
+// assumed to be fetched from $1000.
+class Mmc3 final : public Mapper {
+ public:
+  explicit Mmc3(const Cartridge &cartridge)
+      : Mapper(cartridge),
+        four_screen(cartridge.mirroring == ScreenMirroring::FourScreen) {
+    update();
+  }
+
+  std::unique_ptr<Mapper> clone() const override {
+    return std::make_unique<Mmc3>(*this);
+  }
+
+  void write(uint16_t addr, uint8_t data) override {
+    bool odd = addr & 1;
+    switch (addr & 0xE000) {
+      case 0x8000:
+        if (odd)
+          registers[bank_select & 0b111] = data;
+        else
+          bank_select = data;
+        update();
+        break;
+      case 0xA000:
+        // Writes to odd addresses protect PRG RAM, which is not emulated
+        if (!odd && !four_screen)
+          mirroring = (data & 1) ? ScreenMirroring::Horizontal
+                                 : ScreenMirroring::Vertical;
+        break;
+      case 0xC000:
+        if (odd) {
+          counter = 0;
+          reload = true;
+        } else {
+          latch = data;
+        }
+        break;
+      case 0xE000:
+        // Writes to even addresses also acknowledge the IRQ
+        irq_enabled = odd;
+        if (!odd) irq = false;
+        break;
+    }
+  }
+
+  void ppu_tick(const Ppu &ppu, size_t cycles) override {
+    int dot = clock_dot(ppu);
+    if (dot < 0) return;
+    // PPU cycles from now until the start of the scanline
+    long start = -static_cast<long>(ppu.cycle);
+    for (uint16_t line = ppu.scanline; start + dot <= static_cast<long>(cycles);
+         line = (line + 1) % 262, start += 341) {
+      if (start + dot > 0 && rendered(line)) clock();
+    }
+  }
+
+  size_t ppu_cycles_until_irq(const Ppu &ppu) const override {
+    int dot = clock_dot(ppu);
+    if (!irq_enabled || dot < 0) return SIZE_MAX;
+    // Clocks until the counter reaches 0
+    size_t clocks = (counter == 0 || reload) ? latch + 1 : counter;
+    long start = -static_cast<long>(ppu.cycle);
+    for (uint16_t line = ppu.scanline;; line = (line + 1) % 262, start += 341) {
+      if (start + dot > 0 && rendered(line) && --clocks == 0)
+        return start + dot;
+    }
+  }
+
+ private:
+  bool four_screen;
+
+  // Register written by the next odd write to $8000-$9FFF, and banking
+  // modes
+  uint8_t bank_select = 0;
+  std::array<uint8_t, 8> registers = {0, 2, 4, 5, 6, 7, 0, 1};
+
+  uint8_t latch = 0;
+  uint8_t counter = 0;
+  bool reload = false;
+  bool irq_enabled = false;
+
+  // Dot at which A12 rises on rendered scanlines, or -1 if it does not
+  static int clock_dot(const Ppu &ppu) {
+    if (!(ppu.mask & 0b11000)) return -1;
+    bool sprites_high = ppu.ctrl & 0b101000;
+    bool background_high = ppu.ctrl & 0b10000;
+    if (sprites_high && !background_high) return 260;
+    if (background_high && !sprites_high) return 324;
+    return -1;
+  }
+
+  // Whether the PPU fetches patterns on the scanline: the visible ones and
+  // the pre-render one
+  static bool rendered(uint16_t line) { return line <= 239 || line == 261; }
+
+  void clock() {
+    if (counter == 0 || reload) {
+      counter = latch;
+      reload = false;
+    } else {
+      --counter;
+    }
+    if (counter == 0 && irq_enabled) irq = true;
+  }
+
+  void update() {
+    // PRG banks: R6 and the second to last bank swap places in PRG mode 1
+    bool prg_mode = bank_select & 0x40;
+    map_prg(prg_mode ? 0xC000 : 0x8000, 0x2000, registers[6]);
+    map_prg(0xA000, 0x2000, registers[7]);
+    map_prg(prg_mode ? 0x8000 : 0xC000, 0x2000, -2);
+    map_prg(0xE000, 0x2000, -1);
+
+    // CHR banks: the 2KB and 1KB banks swap halves in CHR mode 1
+    uint16_t inversion = (bank_select & 0x80) ? 0x1000 : 0;
+    map_chr(0x0000 ^ inversion, 0x800, registers[0] >> 1);
+    map_chr(0x0800 ^ inversion, 0x800, registers[1] >> 1);
+    for (int i = 0; i < 4; ++i)
+      map_chr((0x1000 + i * 0x400) ^ inversion, 0x400, registers[2 + i]);
+  }
+};
+
+// https://www.nesdev.org/wiki/AxROM
+class Axrom final : public Mapper {
+ public:
+  explicit Axrom(const Cartridge &cartridge) : Mapper(cartridge) {
+    write(0x8000, 0);
+  }
+
+  std::unique_ptr<Mapper> clone() const override {
+    return std::make_unique<Axrom>(*this);
+  }
+
+  void write(uint16_t /*addr*/, uint8_t data) override {
+    map_prg(0x8000, 0x8000, data & 0b111);
+    mirroring = (data & 0x10) ? ScreenMirroring::SingleScreenUpper
+                              : ScreenMirroring::SingleScreenLower;
+  }
+};
+
+bool mapper_supported(uint8_t number) {
+  switch (number) {
+    case 0:
+    case 1:
+    case 2:
+    case 3:
+    case 4:
+    case 7:
+      return true;
+    default:
+      return false;
+  }
+}
+
+std::unique_ptr<Mapper> make_mapper(const Cartridge &cartridge) {
+  switch (cartridge.mapper) {
+    case 0:
+      return std::make_unique<Nrom>(cartridge);
+    case 1:
+      return std::make_unique<Mmc1>(cartridge);
+    case 2:
+      return std::make_unique<Uxrom>(cartridge);
+    case 3:
+      return std::make_unique<Cnrom>(cartridge);
+    case 4:
+      return std::make_unique<Mmc3>(cartridge);
+    case 7:
+      return std::make_unique<Axrom>(cartridge);
+    default:
+      throw std::runtime_error(
+          fmt::format("Unsupported cartridge mapper {}", cartridge.mapper));
+  }
+}
+
+}  // namespace nesem
@@ -0,0 +1,86 @@
+// Bank switching hardware of cartridges:
+// https://www.nesdev.org/wiki/Mapper
+//
+// A mapper only holds its registers and the banks they select. After each
+// write to the mapper, NesMmu points its page table at the selected PRG
+// banks, and the PPU its pattern table windows at the selected CHR banks, so
+// that reads of ROM never go through the mapper and a bank switch only
+// swaps a few pointers.
+//
+// Mappers counting scanlines are not stepped along with the PPU either: they
+// predict how many PPU cycles remain until their next IRQ, so that the PPU
+// can be left behind until then, and catch up on the scanlines the PPU
+// rendered in between each time it is synced.
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "cartridge.h"
+#include "ppu.h"
+
+namespace nesem {
+
+class Mapper {
+ public:
+  virtual ~Mapper() {}
+
+  virtual std::unique_ptr<Mapper> clone() const = 0;
+
+  // Write to the registers of the mapper, at $8000-$FFFF
+  virtual void write(uint16_t addr, uint8_t data) = 0;
+
+  // Whether PRG ROM stays mapped at $8000-$FFFF as is (mirrored if smaller
+  // than 32KB), which compiled code relies on
+  virtual bool fixed_prg() const { return false; }
+
+  // Offsets in PRG ROM of the 8KB banks mapped at $8000, $A000, $C000 and
+  // $E000
+  std::array<uint32_t, 4> prg_banks;
+
+  // Offsets in CHR of the 1KB banks mapped at $0000-$1FFF of the PPU
+  std::array<uint32_t, 8> chr_banks;
+
+  ScreenMirroring mirroring;
+
+  // Whether the mapper asserts the IRQ line
+  bool irq = false;
+
+  // Catch up with the PPU, which is about to tick the cycles from its
+  // current state
+  virtual void ppu_tick(const Ppu & /*ppu*/, size_t /*cycles*/) {}
+
+  // Number of PPU cycles from the current state of the PPU until the mapper
+  // asserts its IRQ, provided that neither the mapper nor the PPU are
+  // configured differently in between. SIZE_MAX if it does not.
+  virtual size_t ppu_cycles_until_irq(const Ppu & /*ppu*/) const {
+    return SIZE_MAX;
+  }
+
+ protected:
+  // Maps PRG ROM and CHR as is
+  explicit Mapper(const Cartridge &cartridge);
+
+  // Map bank number bank of the size (a multiple of 8KB for PRG, of 1KB for
+  // CHR) at the address. Negative numbers count from the last bank, and
+  // numbers past the last bank wrap around.
+  void map_prg(uint16_t addr, size_t size, int bank);
+  void map_chr(uint16_t addr, size_t size, int bank);
+
+ private:
+  size_t prg_size;
+  size_t chr_size;
+};
+
+// Whether cartridges using the mapper of the number are supported: NROM (0),
+// MMC1 (1), UxROM (2), CNROM (3), MMC3 (4) and AxROM (7)
+bool mapper_supported(uint8_t number);
+
+// Mapper of the cartridge, in its power-up state. Throws for unsupported
+// mappers.
+std::unique_ptr<Mapper> make_mapper(const Cartridge &cartridge);
+
+}  // namespace nesem
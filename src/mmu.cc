@@ -2,51 +2,216 @@
 
 #include <fmt/core.h>
 
+#include <algorithm>
+#include <stdexcept>
+
 namespace nesem {
 
-uint8_t RamOnlyMmu::read(uint16_t addr) const { return ram[addr]; }
+NesMmu::NesMmu(const Cartridge &c)
+    : NesMmu(std::make_shared<const Cartridge>(c)) {}
+
+NesMmu::NesMmu(std::shared_ptr<const Cartridge> c)
+    : ppu(SharedRom(c, &c->chr), c->mirroring),
+      prg(c, &c->prg),
+      mapper(make_mapper(*c)) {
+  map_memory();
+}
+
+NesMmu::NesMmu(const NesMmu &other)
+    : Mmu(other),
+      heatmap(other.heatmap ? std::make_unique<AccessHeatmap>(*other.heatmap)
+                            : nullptr),
+      wram(other.wram),
+      ppu(other.ppu),
+      apu_registers(other.apu_registers),
+      gamepad(other.gamepad),
+      prg(other.prg),
+      prg_ram(other.prg_ram),
+      save_ram(other.save_ram),
+      mapper(other.mapper->clone()),
+      bus_errors(other.bus_errors),
+      cpu_cycles(other.cpu_cycles),
+      cpu_run_limit(other.cpu_run_limit),
+      ppu_synced_cycle(other.ppu_synced_cycle),
+      event_cycle(other.event_cycle),
+      cheats(other.cheats) {
+  map_memory();
+}
+
+NesMmu &NesMmu::operator=(const NesMmu &other) {
+  Mmu::operator=(other);
+  heatmap = other.heatmap ? std::make_unique<AccessHeatmap>(*other.heatmap)
+                          : nullptr;
+  wram = other.wram;
+  ppu = other.ppu;
+  apu_registers = other.apu_registers;
+  gamepad = other.gamepad;
+  prg = other.prg;
+  prg_ram = other.prg_ram;
+  save_ram = other.save_ram;
+  mapper = other.mapper->clone();
+  bus_errors = other.bus_errors;
+  cpu_cycles = other.cpu_cycles;
+  cpu_run_limit = other.cpu_run_limit;
+  ppu_synced_cycle = other.ppu_synced_cycle;
+  event_cycle = other.event_cycle;
+  cheats = other.cheats;
+  cheat_pages.clear();
+  map_memory();
+  return *this;
+}
+
+bool NesMmu::set_heatmap_enabled(bool enabled) {
+  if (!kHeatmap || !enabled) {
+    heatmap.reset();
+    return !enabled;
+  }
+  if (!heatmap) heatmap = std::make_unique<AccessHeatmap>();
+  return true;
+}
+
+void NesMmu::map_pages(uint8_t first, size_t count, const uint8_t *read_data,
+                       uint8_t *write_data) {
+  for (size_t i = 0; i < count; ++i) {
+    read_pages[first + i] = read_data ? read_data + (i << 8) : nullptr;
+    write_pages[first + i] = write_data ? write_data + (i << 8) : nullptr;
+  }
+}
+
+void NesMmu::map_memory() {
+  map_pages(0x00, 0x100, nullptr, nullptr);
+
+  // The addressable ram space goes up to 0x1FFF, which requires 13 bits to
+  // address. However, the bus only decodes 11 bits, which leads to mirroring
+  // in the WRAM address space.
+  for (int page = 0x00; page < 0x20; page += 0x08)
+    map_pages(page, 0x08, wram.data(), wram.data());
+
+  map_prg_ram();
+  map_prg();
+  ppu.chr_banks = mapper->chr_banks;
+  ppu.set_mirroring(mapper->mirroring);
+}
 
-void RamOnlyMmu::write(uint16_t addr, uint8_t data) { ram[addr] = data; }
+void NesMmu::map_prg_ram() {
+  if (!save_ram) {
+    map_pages(0x60, SaveRam::kPages, prg_ram.data(), prg_ram.data());
+    return;
+  }
+  for (size_t page = 0; page < SaveRam::kPages; ++page) {
+    uint8_t *data = save_ram->data() + (page << 8);
+    map_pages(0x60 + page, 1, data, save_ram->is_dirty(page) ? data : nullptr);
+  }
+}
+
+void NesMmu::set_save_ram(std::shared_ptr<SaveRam> save_ram) {
+  this->save_ram = std::move(save_ram);
+  map_prg_ram();
+}
 
-// The addressable ram space goes up to 0x1FFF, which requires 13 bits to
-// address. However, the bus only decodes 11 bits, which leads to mirroring in
-// the WRAM address space.
-static inline uint16_t mirror_wram_addr(uint16_t addr) {
-  addr &= 0b0000011111111111;
-  return addr;
+void NesMmu::flush_save_ram() {
+  if (!save_ram) return;
+  save_ram->flush();
+  map_prg_ram();
 }
 
-NesMmu::NesMmu(const Cartridge &c) : prg(c.prg), ppu(c) {}
+void NesMmu::map_prg() {
+  mapped_prg_banks = mapper->prg_banks;
+
+  // ROMs not made of whole pages are left to read_io. Banks of ROMs smaller
+  // than 32KB are mirrored.
+  if (prg->empty() || prg->size() % 0x100) return;
+  for (int page = 0x80; page <= 0xFF; ++page) {
+    size_t offset = mapped_prg_banks[(page - 0x80) >> 5] + ((page & 0x1F) << 8);
+    read_pages[page] = prg->data() + offset % prg->size();
+  }
+
+  // Patches are made again after each bank switch, so that compare values
+  // see the bytes of the banks switched in
+  for (const Cheat &cheat : cheats) {
+    uint8_t page = cheat.addr >> 8;
+    std::array<uint8_t, 0x100> &shadow = cheat_pages[page];
+    if (read_pages[page] != shadow.data()) {
+      std::copy_n(read_pages[page], shadow.size(), shadow.begin());
+      read_pages[page] = shadow.data();
+    }
+    uint8_t &byte = shadow[cheat.addr & 0xFF];
+    if (!cheat.compare || byte == *cheat.compare) byte = cheat.value;
+  }
+}
+
+void NesMmu::add_cheat(const Cheat &cheat) {
+  if (cheat.addr < 0x8000)
+    throw std::runtime_error(
+        fmt::format("Cheat at {:04X} outside of PRG ROM", cheat.addr));
+  cheats.push_back(cheat);
+  map_prg();
+  remap(cheat.addr, cheat.addr);
+}
+
+void NesMmu::remove_cheat(const Cheat &cheat) {
+  auto it = std::find(cheats.begin(), cheats.end(), cheat);
+  if (it == cheats.end()) return;
+  cheats.erase(it);
+  uint8_t page = cheat.addr >> 8;
+  if (std::none_of(cheats.begin(), cheats.end(),
+                   [&](const Cheat &c) { return c.addr >> 8 == page; }))
+    cheat_pages.erase(page);
+  map_prg();
+  remap(cheat.addr, cheat.addr);
+}
+
+void NesMmu::clear_cheats() {
+  cheats.clear();
+  cheat_pages.clear();
+  map_prg();
+  remap(0x8000, 0xFFFF);
+}
+
+void NesMmu::map_banks() {
+  if (mapper->prg_banks != mapped_prg_banks) {
+    map_prg();
+    remap(0x8000, 0xFFFF);
+  }
+  ppu.chr_banks = mapper->chr_banks;
+  ppu.set_mirroring(mapper->mirroring);
+}
+
+void NesMmu::sync_events() {
+  sync_ppu();
+  size_t ppu_cycles = std::min(ppu.cycles_until_vblank(),
+                               mapper->ppu_cycles_until_irq(ppu));
+  // The PPU ticks three times per cpu cycle
+  event_cycle = ppu_synced_cycle + (ppu_cycles + 2) / 3;
+  if (cpu_run_limit) *cpu_run_limit = std::min(*cpu_run_limit, event_cycle);
+}
 
 uint8_t NesMmu::read(uint16_t addr) const {
+  if (const uint8_t *page = read_pages[addr >> 8]) return page[addr & 0xFF];
+
   uint8_t data;
-  if (addr <= 0x1FFF) {
-    // WRAM
-    addr = mirror_wram_addr(addr);
-    data = wram[addr];
-  } else if ((addr >= 0x4000 && addr <= 0x4013) || (addr == 0x4015) ||
-             (addr == 0x4017)) {
+  if ((addr >= 0x4000 && addr <= 0x4013) || (addr == 0x4015) ||
+      (addr == 0x4017)) {
     // APU registers
     data = apu_registers[addr - 0x4000];
-  } else if (addr >= 0x8000 && addr <= 0xFFFF) {
-    // PRG ROM
+  } else if (addr >= 0x8000 && !prg->empty()) {
+    // PRG ROM not made of whole pages
     addr -= 0x8000;
-    if (addr >= prg.size()) addr %= prg.size();
-    data = prg[addr];
+    if (addr >= prg->size()) addr %= prg->size();
+    data = (*prg)[addr];
   } else {
     data = 0;
   }
   return data;
 }
 
-uint8_t NesMmu::read(uint16_t addr) {
+uint8_t NesMmu::read_io(uint16_t addr) {
   uint8_t data;
-  if (addr <= 0x1FFF) {
-    // WRAM
-    addr = mirror_wram_addr(addr);
-    data = wram[addr];
-  } else if (addr <= 0x3FFF) {
+  if (addr >= 0x2000 && addr <= 0x3FFF) {
     addr &= 0x2007;
+    if constexpr (kHeatmap)
+      if (heatmap && addr == 0x2007) ++ppu_heatmap_page().reads;
+    sync_ppu();
     data = ppu.read(addr);
   } else if ((addr >= 0x4000 && addr <= 0x4013) || (addr == 0x4015) ||
              (addr == 0x4017)) {
@@ -54,27 +219,30 @@ uint8_t NesMmu::read(uint16_t addr) {
     data = apu_registers[addr - 0x4000];
   } else if (addr == 0x4016) {
       data = gamepad.read();
-  } else if (addr >= 0x8000 && addr <= 0xFFFF) {
-    // PRG ROM
+  } else if (addr >= 0x8000 && !prg->empty()) {
+    // PRG ROM not made of whole pages
     addr -= 0x8000;
-    if (addr >= prg.size()) addr %= prg.size();
-    data = prg[addr];
+    if (addr >= prg->size()) addr %= prg->size();
+    data = (*prg)[addr];
   } else {
-    fmt::print(stderr, "Invalid read at addr {:X}\n", addr);
+    ++bus_errors.reads[addr >> 8];
     data = 0;
   }
   return data;
 }
 
-void NesMmu::write(uint16_t addr, uint8_t data) {
-  if (addr <= 0x1FFF) {
-    // WRAM
-    addr = mirror_wram_addr(addr);
-    wram[addr] = data;
-  } else if (addr <= 0x3FFF) {
+void NesMmu::write_io(uint16_t addr, uint8_t data) {
+  if (addr >= 0x2000 && addr <= 0x3FFF) {
     addr &= 0x2007;
+    if constexpr (kHeatmap)
+      if (heatmap && addr == 0x2007) ++ppu_heatmap_page().writes;
+    sync_ppu();
     ppu.write(addr, data);
+    // The pattern tables in use and rendering decide when scanlines are
+    // counted
+    if (addr <= 0x2001) sync_events();
   } else if (addr == 0x4014) {
+    sync_ppu();
     uint16_t hi = data << 8;
     ppu.oam_dma(&wram[hi]);
   } else if ((addr >= 0x4000 && addr <= 0x4013) || (addr == 0x4015) ||
@@ -86,12 +254,22 @@ void NesMmu::write(uint16_t addr, uint8_t data) {
           gamepad.strobe_on();
       else
           gamepad.strobe_off();
-  } else if (addr >= 0x8000 && addr <= 0xFFFF) {
-    // PRG ROM
-    throw std::runtime_error(
-        fmt::format("Attempted to write to ROM at {:04X}", addr));
+  } else if (addr >= 0x6000 && addr <= 0x7FFF && save_ram) {
+    // First write to a clean page of save RAM
+    size_t page = (addr - 0x6000) >> 8;
+    save_ram->mark_dirty(page);
+    map_prg_ram();
+    save_ram->data()[addr - 0x6000] = data;
+  } else if (addr >= 0x8000) {
+    // Mapper registers. The PPU renders up to the write with the previous
+    // banks.
+    sync_ppu();
+    mapper->write(addr, data);
+    map_banks();
+    update_mapper_irq();
+    sync_events();
   } else {
-    fmt::print(stderr, "Invalid write at addr {:04X}\n", addr);
+    ++bus_errors.writes[addr >> 8];
   }
 }
 
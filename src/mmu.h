@@ -1,12 +1,20 @@
 #pragma once
 
 #include <array>
+#include <cstddef>
 #include <cstdint>
+#include <map>
+#include <memory>
 #include <vector>
 
+#include "bus_errors.h"
 #include "cartridge.h"
+#include "cheats.h"
 #include "gamepad.h"
+#include "heatmap.h"
+#include "mapper.h"
 #include "ppu.h"
+#include "save_ram.h"
 
 namespace nesem {
 
@@ -24,15 +32,39 @@ class Mmu {
 
   // Write a single byte at the specified address
   virtual void write(uint16_t addr, uint8_t data) = 0;
+
+  // Whether pages $00 and $01 (zero page and stack) are plain memory, which
+  // a cpu bound statically to the mmu may access through the pointer
+  // returned by low_ram() rather than through read and write. Classes
+  // setting this define low_ram().
+  static constexpr bool kDirectLowRam = false;
+
+  // Report that the memory backing the range [lo, hi] of the address space
+  // changed without being written to, e.g. because of a bank switch.
+  void remap(uint16_t lo, uint16_t hi) {
+    last_remap_lo = lo;
+    last_remap_hi = hi;
+    ++remap_count;
+  }
+
+  // Number of remappings reported so far. Holders of data derived from
+  // memory (such as decoded code) compare this against the count they last
+  // saw: if it moved by exactly one, only the last remapped range changed.
+  uint32_t remap_count = 0;
+  uint16_t last_remap_lo = 0;
+  uint16_t last_remap_hi = 0;
 };
 
 // Dummy MMU that permits reads and writes to its entire address space
 // with no validation and no side-effects
-class RamOnlyMmu : public Mmu {
+class RamOnlyMmu final : public Mmu {
  public:
-  uint8_t read(uint16_t addr) const override;
+  uint8_t read(uint16_t addr) const override { return ram[addr]; }
 
-  void write(uint16_t addr, uint8_t data) override;
+  void write(uint16_t addr, uint8_t data) override { ram[addr] = data; }
+
+  static constexpr bool kDirectLowRam = true;
+  uint8_t *low_ram() { return ram.data(); }
 
  private:
   std::array<uint8_t, 0xFFFF + 1> ram = {0};
@@ -62,21 +94,161 @@ class RamOnlyMmu : public Mmu {
 // 0x0800 -----------------
 //        |    CPU RAM    |
 // 0x0000 -----------------
+//
+// Not final, so that DebugNesMmu can watch its accesses. Cpus bound to it
+// still call its own accessors directly.
 class NesMmu : public Mmu {
  public:
-  NesMmu() {}
+  NesMmu() : NesMmu(Cartridge{}) {}
   NesMmu(const Cartridge &c);
 
+  // Share the ROM images of the cartridge with the other instances made from
+  // it, rather than copying them
+  explicit NesMmu(std::shared_ptr<const Cartridge> c);
+
+  // The memory map of a copy points at the memory of the copy
+  NesMmu(const NesMmu &other);
+  NesMmu &operator=(const NesMmu &other);
+
   uint8_t read(uint16_t addr) const override;
-  uint8_t read(uint16_t addr) override;
 
-  void write(uint16_t addr, uint8_t data) override;
+  // Pages backed by memory are accessed inline, so that a cpu bound to this
+  // class reads them without a function call
+  uint8_t read(uint16_t addr) override {
+    if constexpr (kHeatmap)
+      if (heatmap) ++heatmap->cpu_pages[addr >> 8].reads;
+    if (const uint8_t *page = read_pages[addr >> 8]) return page[addr & 0xFF];
+    return read_io(addr);
+  }
+
+  void write(uint16_t addr, uint8_t data) override {
+    if constexpr (kHeatmap)
+      if (heatmap) ++heatmap->cpu_pages[addr >> 8].writes;
+    if (uint8_t *page = write_pages[addr >> 8])
+      page[addr & 0xFF] = data;
+    else
+      write_io(addr, data);
+  }
+
+  // Point the count pages starting at page first to consecutive 256-byte
+  // pages of host memory, for reads and for writes. A null pointer sends the
+  // accesses to the registers instead. Mappers call this to switch banks, and
+  // report the change with remap().
+  void map_pages(uint8_t first, size_t count, const uint8_t *read_data,
+                 uint8_t *write_data);
+
+  // Rebuild the whole memory map, and the pattern table and nametable
+  // mappings of the PPU
+  void map_memory();
+
+  // Back PRG RAM with a save file from now on, for battery-backed
+  // cartridges. Pass nullptr to go back to volatile PRG RAM.
+  void set_save_ram(std::shared_ptr<SaveRam> save_ram);
+
+  // Start writing the pages of save RAM written since the last flush back to
+  // the save file, without waiting for it
+  void flush_save_ram();
+
+  // Patch PRG ROM with the cheat until it is removed. Throws for addresses
+  // outside of PRG ROM.
+  void add_cheat(const Cheat &cheat);
+  void remove_cheat(const Cheat &cheat);
+  void clear_cheats();
+
+  // Whether PRG ROM read through the mmu differs from the ROM image, which
+  // code compiled from the image must not run
+  bool has_cheats() const { return !cheats.empty(); }
+
+  // Pages $00 and $01 are the start of CPU RAM. Their accesses go through
+  // the mmu when they are counted into a heatmap.
+  static constexpr bool kDirectLowRam = !kHeatmap;
+  uint8_t *low_ram() { return wram.data(); }
+
+  // Start or stop counting the accesses of the cpu into a heatmap, by page.
+  // Returns false if counting was compiled out (see heatmap.h).
+  bool set_heatmap_enabled(bool enabled);
+  std::unique_ptr<AccessHeatmap> heatmap;
 
   std::array<uint8_t, 0x800> wram = {0};  // CPU RAM ("working ram")
   Ppu ppu;
   std::array<uint8_t, 18> apu_registers;  // TODO: dummy APU registers
   Gamepad gamepad;
-  std::vector<uint8_t> prg;               // program code
+  SharedRom prg;                          // program code
+  std::array<uint8_t, 0x2000> prg_ram = {0};  // PRG RAM, unless saved
+  std::shared_ptr<SaveRam> save_ram;      // battery-backed PRG RAM
+  std::unique_ptr<Mapper> mapper;         // bank switching of prg and chr
+  BusErrors bus_errors;                   // accesses to unmapped addresses
+
+  // Cycle counter of the cpu driving the bus, which it advances to the cycle
+  // of each access before making it. When set, the PPU is caught up to that
+  // cycle right before its registers are accessed, and otherwise only when
+  // sync_ppu is called.
+  const size_t *cpu_cycles = nullptr;
+
+  // Limit of the current run of that cpu, lowered to the next event when it
+  // is scheduled earlier, so that batched runs stop in time for it
+  size_t *cpu_run_limit = nullptr;
+
+  // Cpu cycle up to which the PPU has been ticked
+  size_t ppu_synced_cycle = 0;
+
+  // Tick the PPU up to the current cycle of the cpu
+  void sync_ppu() {
+    if (!cpu_cycles || *cpu_cycles <= ppu_synced_cycle) return;
+    size_t cycles = (*cpu_cycles - ppu_synced_cycle) * 3;
+    mapper->ppu_tick(ppu, cycles);
+    update_mapper_irq();
+    ppu.tick(cycles);
+    ppu_synced_cycle = *cpu_cycles;
+  }
+
+  // First cpu cycle at which the PPU enters vblank or the mapper asserts its
+  // IRQ. Nothing else raises an interrupt, so the PPU may be left behind
+  // until then. Rescheduled by the writes to the registers that move it.
+  size_t event_cycle = 0;
+
+  // Catch the PPU up, and schedule the next event
+  void sync_events();
+
+ private:
+  // Host memory backing each page of the address space, or null for pages
+  // holding registers or unmapped addresses
+  std::array<const uint8_t *, 0x100> read_pages = {};
+  std::array<uint8_t *, 0x100> write_pages = {};
+
+  // PRG banks the page table points to
+  std::array<uint32_t, 4> mapped_prg_banks = {};
+
+  std::vector<Cheat> cheats;
+
+  // Patched copies of the pages of PRG ROM holding cheats, which the page
+  // table points to instead of the ROM. Rebuilt rather than copied.
+  std::map<uint8_t, std::array<uint8_t, 0x100>> cheat_pages;
+
+  // Point the pages of $8000-$FFFF at the PRG banks selected by the mapper,
+  // and the pages holding cheats at their patched copies
+  void map_prg();
+
+  // Point the pages of $6000-$7FFF at PRG RAM. Clean pages of save RAM are
+  // only mapped for reads, so that the first write to each of them marks it
+  // dirty.
+  void map_prg_ram();
+
+  // Apply the banks and mirroring selected by the mapper after a write to it
+  void map_banks();
+
+  // Page of the PPU address space that PPUDATA accesses next
+  PageCounter &ppu_heatmap_page() {
+    return heatmap->ppu_pages[ppu.data_addr() >> 8];
+  }
+
+  void update_mapper_irq() {
+    if (ppu.interrupts) ppu.interrupts->set_irq(kIrqMapper, mapper->irq);
+  }
+
+  // Access the rest of the address space: registers and unmapped addresses
+  uint8_t read_io(uint16_t addr);
+  void write_io(uint16_t addr, uint8_t data);
 };
 
 }  // namespace nesem
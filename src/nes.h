@@ -1,35 +1,255 @@
 #pragma once
 
+#include <stdint.h>
+
+#include <algorithm>
+#include <memory>
+#include <type_traits>
+
+#include "aot.h"
 #include "cartridge.h"
 #include "cpu.h"
+#include "debugger.h"
+#include "idle_loop.h"
+#include "jit.h"
 #include "mmu.h"
 
 namespace nesem {
 
-struct Nes {
-  Cpu cpu;
-  NesMmu mmu;
+// Reason for which a run of the NES stopped
+enum class RunStatus {
+  // The cpu cycle counter reached the requested cycle
+  CycleReached,
+
+  // The PPU entered the requested scanline
+  ScanlineReached,
 
-  Nes() : cpu(&mmu) {}
-  explicit Nes(const Cartridge &cartridge) : mmu(cartridge), cpu(&mmu) {}
+  // The PPU finished the frame and wrapped around to scanline 0
+  FrameCompleted,
+
+  // The cpu executed a JAM opcode and halted before the run could complete.
+  // Runs return immediately until the NES is reset.
+  Jammed,
+
+  // A breakpoint or watchpoint of a DebugNes stopped the run (see
+  // Debugger::last_hit)
+  DebugStop,
+};
+
+// NES whose cpu accesses the mmu through a bus of type Bus: either NesMmu,
+// binding accesses statically, Mmu, going through virtual calls, or
+// DebugNesMmu, checking breakpoints and watchpoints.
+template <typename Bus>
+struct BasicNes {
+  // Whether the NES checks the breakpoints and watchpoints of mmu.debugger.
+  // Its runs only go through the interpreter, one instruction at a time.
+  static constexpr bool kDebug = std::is_same_v<Bus, DebugNesMmu>;
+
+  BasicCpu<Bus> cpu;
+  std::conditional_t<kDebug, DebugNesMmu, NesMmu> mmu;
+  std::unique_ptr<Jit> jit;
+  std::unique_ptr<AotEngine> aot;
+
+  // Skip the iterations of idle loops (see idle_loop.h) up to the start of
+  // the next vblank, in a single step
+  bool idle_loop_skip = false;
+
+  // Number of cpu cycles skipped in idle loops
+  uint64_t idle_cycles_skipped = 0;
+
+  // The PPU is caught up with the cpu lazily: by the mmu when its registers
+  // are accessed, before the instruction at which it may enter vblank or the
+  // mapper may assert its IRQ, and at the end of each step and run.
+  BasicNes() : cpu(&mmu) {
+    cpu.fusion_cycle_limit = 0;
+    mmu.cpu_cycles = &cpu.cycles;
+    mmu.cpu_run_limit = &cpu.run_limit;
+    mmu.ppu.interrupts = &cpu.interrupts;
+  }
+  explicit BasicNes(const Cartridge &cartridge) : cpu(&mmu), mmu(cartridge) {
+    cpu.fusion_cycle_limit = 0;
+    mmu.cpu_cycles = &cpu.cycles;
+    mmu.cpu_run_limit = &cpu.run_limit;
+    mmu.ppu.interrupts = &cpu.interrupts;
+  }
+  // NESes made from the same shared cartridge share its ROM images
+  explicit BasicNes(std::shared_ptr<const Cartridge> cartridge)
+      : cpu(&mmu), mmu(std::move(cartridge)) {
+    cpu.fusion_cycle_limit = 0;
+    mmu.cpu_cycles = &cpu.cycles;
+    mmu.cpu_run_limit = &cpu.run_limit;
+    mmu.ppu.interrupts = &cpu.interrupts;
+  }
+  BasicNes(const BasicNes &) = delete;
 
   void reset() {
-    size_t before_cycles = cpu.cycles;
     cpu.reset();
-    size_t elapsed_cycles = cpu.cycles - before_cycles;
-    mmu.ppu.tick(elapsed_cycles * 3);
+    mmu.sync_ppu();
+  }
+
+  // Run hot blocks of PRG ROM code as native code, when supported by the
+  // host. Blocks are compiled once entered hot_threshold times.
+  void set_jit_enabled(bool enabled,
+                       uint32_t hot_threshold = Jit::kDefaultHotThreshold) {
+    if (enabled)
+      jit = std::make_unique<Jit>(&mmu, hot_threshold);
+    else
+      jit.reset();
   }
 
+  // Run blocks of code translated ahead of time from the cartridge by
+  // nesem_recompile. Returns false if the program was translated from
+  // another cartridge. Pass nullptr to stop running the program.
+  bool set_aot_program(const AotProgram *program) {
+    aot.reset();
+    if (!program) return true;
+    auto engine = std::make_unique<AotEngine>(*program, &mmu);
+    if (!engine->matches()) return false;
+    aot = std::move(engine);
+    return true;
+  }
+
+  // Execute the next instruction, or several at once when compiled code,
+  // fused sequences or idle loop skipping allow it
   void step() {
-    if (mmu.ppu.nmi_pending) {
-      mmu.ppu.nmi_pending = false;
-      cpu.nmi_pending = true;
+    step_until(SIZE_MAX);
+    mmu.sync_ppu();
+  }
+
+  // Run until the cpu cycle counter reaches the cycle. The last instruction
+  // may end a few cycles past it.
+  RunStatus run_until_cycle(size_t cycle) {
+    while (cpu.cycles < cycle && !cpu.jammed) {
+      if constexpr (!kDebug) {
+        if (!accelerated()) {
+          run_interpreted(cycle);
+          continue;
+        }
+      }
+      step_until(cycle);
+      if constexpr (kDebug) {
+        if (mmu.debugger.stopped) break;
+      }
+    }
+    mmu.sync_ppu();
+    if constexpr (kDebug) {
+      if (mmu.debugger.stopped) {
+        mmu.debugger.stopped = false;
+        return RunStatus::DebugStop;
+      }
     }
-    size_t before_cycles = cpu.cycles;
-    cpu.step();
-    size_t elapsed_cycles = cpu.cycles - before_cycles;
-    mmu.ppu.tick(elapsed_cycles * 3);
+    return cpu.jammed ? RunStatus::Jammed : RunStatus::CycleReached;
+  }
+
+  // Run until the PPU enters the scanline (261 is the pre-render line).
+  // Stops after the instruction during which it does.
+  RunStatus run_until_scanline(uint16_t scanline) {
+    mmu.sync_ppu();
+    // The PPU ticks three times per cpu cycle
+    RunStatus status = run_until_cycle(
+        cpu.cycles + (mmu.ppu.cycles_until_scanline(scanline) + 2) / 3);
+    return status == RunStatus::CycleReached ? RunStatus::ScanlineReached
+                                             : status;
+  }
+
+  // Run until the end of the current frame, i.e. until the PPU enters
+  // scanline 0
+  RunStatus run_frame() {
+    RunStatus status = run_until_scanline(0);
+    return status == RunStatus::ScanlineReached ? RunStatus::FrameCompleted
+                                                : status;
+  }
+
+ private:
+  // Execute the next instruction like step. Compiled code, fused sequences
+  // and skipped idle loops only execute the instructions that start before
+  // cycle_limit, so that runs stop after the same instruction as the
+  // interpreter.
+  void step_until(size_t cycle_limit) {
+    // Nothing but the start of vblank and the mapper raise interrupts, so
+    // the PPU only needs to catch up here once the next of them is reached
+    if (cpu.cycles >= mmu.event_cycle) mmu.sync_events();
+    if constexpr (kDebug) {
+      Debugger &debugger = mmu.debugger;
+      debugger.instruction_pc = cpu.pc;
+      cpu.step();
+      if (debugger.has_breakpoint(cpu.pc))
+        debugger.report({DebugHitKind::Breakpoint, cpu.pc, 0, cpu.pc,
+                         cpu.cycles});
+      return;
+    }
+    if (!accelerated() || !run_accelerated(cycle_limit)) cpu.step();
+  }
+
+  bool accelerated() const {
+    return idle_loop_skip || jit || aot || cpu.fusion_enabled();
+  }
+
+  // Run the interpreter up to the cycle, or up to the next event if it comes
+  // first, in one go. That lets the cpu dispatch instructions in a tight
+  // loop (threaded with NESEM_THREADED_DISPATCH) rather than one step at a
+  // time. The mmu cuts the run short if it schedules an event earlier.
+  void run_interpreted(size_t cycle_limit) {
+    if (cpu.cycles >= mmu.event_cycle) mmu.sync_events();
+    cpu.run(std::min(cycle_limit, mmu.event_cycle));
+  }
+
+  // Run several instructions at once by skipping an idle loop, or from
+  // translated or compiled code, if possible. Otherwise, set up fused
+  // sequences for the next step of the cpu and return false.
+  bool run_accelerated(size_t cycle_limit) {
+    // None of them run into the start of vblank or the IRQ of the mapper, so
+    // that interrupts are raised after the same instruction as with the
+    // interpreter
+    size_t event_cycles = mmu.event_cycle - 1 - cpu.cycles;
+    size_t max_cycles = std::min(event_cycles, cycle_limit - cpu.cycles);
+    if (idle_loop_skip && skip_idle_loop(max_cycles)) return true;
+    if (cpu.fusion_enabled())
+      cpu.fusion_cycle_limit =
+          cpu.cycles + std::min(event_cycles, cycle_limit - cpu.cycles - 1);
+    return (aot && aot->run(&cpu, max_cycles, cpu.decoded_blocks())) ||
+           (jit && jit->run(&cpu, max_cycles, cpu.decoded_blocks()));
+  }
+
+  // Run the idle loop at the program counter, if any, for as many whole
+  // iterations as complete within max_cycles. Returns false if there is no
+  // loop or no iteration to skip.
+  bool skip_idle_loop(size_t max_cycles) {
+    if (cpu.interrupt_pending()) return false;
+    IdleLoop loop = find_idle_loop(mmu, cpu.pc);
+    if (!loop) return false;
+    // The loop exits on its next read of the status
+    mmu.sync_ppu();
+    if (loop.polls_ppu_status() && (mmu.ppu.status() & 0x80)) return false;
+
+    // An NMI is raised when vblank starts, and no other event changes the
+    // outcome of the loop before then, or before the IRQ of the mapper
+    size_t iterations = max_cycles / loop.cycles;
+    if (iterations == 0) return false;
+
+    // Every read of the status returns the same value until vblank starts,
+    // so all the iterations leave the same state as the first one
+    if (loop.polls_ppu_status()) {
+      uint8_t status = mmu.read(0x2002);
+      if (loop.kind == IdleLoopKind::LdaPpuStatusBpl) {
+        cpu.a = status;
+        cpu.flags.set_nz(status);
+      } else {
+        cpu.flags.set_nz(status, status & cpu.a);
+        cpu.flags.overflow = status & 0b01000000;
+      }
+    }
+    size_t cycles = iterations * loop.cycles;
+    cpu.cycles += cycles;
+    idle_cycles_skipped += cycles;
+    return true;
   }
 };
 
+using Nes = BasicNes<NesMmu>;
+
+// NES stopping its runs at the breakpoints and watchpoints of
+// mmu.debugger
+using DebugNes = BasicNes<DebugNesMmu>;
+
 };  // namespace nesem
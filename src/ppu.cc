@@ -5,31 +5,45 @@
 namespace nesem {
 
 Ppu::Ppu(const Cartridge &cartridge)
-    : chr(cartridge.chr), mirroring(cartridge.mirroring) {}
+    : Ppu(std::make_shared<const std::vector<uint8_t>>(cartridge.chr),
+          cartridge.mirroring) {}
+
+Ppu::Ppu(SharedRom chr, ScreenMirroring mirroring) : chr(std::move(chr)) {
+  // Cartridges without CHR ROM have 8KB of CHR RAM instead, blank until
+  // written to
+  static const SharedRom blank_chr_ram =
+      std::make_shared<std::vector<uint8_t>>(0x2000);
+  if (this->chr->empty()) {
+    this->chr = blank_chr_ram;
+    chr_writable = true;
+  }
+  set_mirroring(mirroring);
+}
 
 uint8_t Ppu::status() const {
   return (in_vblank << 7) | (sprite_0_hit << 6) | (sprite_overflow << 5) |
          (io_databus & 0b11111);
 }
 
-static uint16_t translate_vram_addr(uint16_t addr, ScreenMirroring mirroring) {
-  addr %= 0x2000;
+void Ppu::set_mirroring(ScreenMirroring mirroring) {
+  this->mirroring = mirroring;
   switch (mirroring) {
     case ScreenMirroring::Horizontal:
-      if (addr >= 0x800) {
-        addr %= 0x400;
-        addr += 0x400;
-      } else {
-        addr %= 0x400;
-      }
+      nametables = {0x000, 0x000, 0x400, 0x400};
       break;
     case ScreenMirroring::Vertical:
-      addr %= 0x800;
+      nametables = {0x000, 0x400, 0x000, 0x400};
       break;
-    default:
+    case ScreenMirroring::FourScreen:
+      nametables = {0x000, 0x400, 0x800, 0xC00};
+      break;
+    case ScreenMirroring::SingleScreenLower:
+      nametables = {0x000, 0x000, 0x000, 0x000};
+      break;
+    case ScreenMirroring::SingleScreenUpper:
+      nametables = {0x400, 0x400, 0x400, 0x400};
       break;
   }
-  return addr;
 }
 
 uint8_t Ppu::read(uint16_t addr) {
@@ -46,18 +60,16 @@ uint8_t Ppu::read(uint16_t addr) {
       addr = addr_latch.read();
       if (addr <= 0x1FFF) {  // chr
         io_databus = read_buffer;
-        read_buffer = chr[addr];
+        read_buffer = chr_at(addr);
       } else if (addr <= 0x3EFF) {  // vram
         io_databus = read_buffer;
-        uint16_t vram_addr = translate_vram_addr(addr, mirroring);
-        read_buffer = vram[vram_addr];
+        read_buffer = vram[vram_offset(addr)];
       } else {  // palettes
         addr &= 0x3F1F;
         io_databus = palettes[addr - 0x3F00];
         // read buffer still gets updated, to the mirrored nametable data
         // that would be beneath the palette
-        uint16_t vram_addr = translate_vram_addr(addr & 0x2FFF, mirroring);
-        read_buffer = vram[vram_addr];
+        read_buffer = vram[vram_offset(addr & 0x2FFF)];
       }
       addr_latch.increment((ctrl & 0b100) ? 32 : 1);
       break;
@@ -89,10 +101,10 @@ void Ppu::write(uint16_t addr, uint8_t data) {
     case 0x2007:  // data
       addr = addr_latch.read();
       if (addr <= 0x1FFF) {  // chr
-        // ignore writes to chr
+        // writes to chr are ignored, unless it is RAM
+        if (chr_writable) write_chr(addr, data);
       } else if (addr <= 0x3EFF) {  // vram
-        uint16_t vram_addr = translate_vram_addr(addr, mirroring);
-        vram[vram_addr] = data;
+        vram[vram_offset(addr)] = data;
       } else {  // palettes
         addr &= 0x3F1F;
         palettes[addr - 0x3F00] = data;
@@ -118,7 +130,7 @@ void Ppu::tick(size_t cycles) {
     if (scanline == 240) draw_sprites();
     ++scanline;
     if (scanline == 241) {
-      if (ctrl & (1 << 7)) nmi_pending = true;
+      if ((ctrl & (1 << 7)) && interrupts) interrupts->raise_nmi();
       in_vblank = true;
     } else if (scanline >= 262) {
       in_vblank = false;
@@ -127,6 +139,17 @@ void Ppu::tick(size_t cycles) {
   }
 }
 
+size_t Ppu::cycles_until_vblank() const {
+  // vblank starts with scanline 241
+  return cycles_until_scanline(241);
+}
+
+size_t Ppu::cycles_until_scanline(uint16_t target) const {
+  // Number of scanlines to finish after the current one
+  size_t scanlines = (target + 261 - scanline) % 262;
+  return scanlines * 341 + (341 - cycle);
+}
+
 void Ppu::frame_set(size_t x, size_t y, uint8_t color) {
   size_t idx = x + y * kDisplayWidth;
   if (idx < frame.size()) frame[idx] = color;
@@ -138,11 +161,11 @@ void Ppu::draw_scanline() {
 
   for (int tile_col = 0; tile_col < kTilesPerScanline; ++tile_col) {
     uint16_t nametable_index = tile_row * kTilesPerScanline + tile_col;
-    uint8_t pattern_index = vram[nametable_index];
+    uint8_t pattern_index = vram[nametables[0] + nametable_index];
 
     uint16_t begin = bank_start + pattern_index * 16;
-    uint8_t upper = chr[begin + (scanline % kTileHeight)];
-    uint8_t lower = chr[begin + (scanline % kTileHeight) + kTileHeight];
+    uint8_t upper = chr_at(begin + (scanline % kTileHeight));
+    uint8_t lower = chr_at(begin + (scanline % kTileHeight) + kTileHeight);
 
     for (int8_t x = 7; x >= 0; --x) {
       uint8_t value = (1 & lower) << 1 | (1 & upper);
@@ -161,7 +184,7 @@ void Ppu::draw_scanline() {
 
 uint8_t Ppu::bg_palette_start_idx(uint16_t tile_row, uint16_t tile_col) const {
   uint16_t attr_table_offset = tile_row / 4 * 8 + tile_col / 4;
-  uint8_t attr = vram[0x3C0 + attr_table_offset];
+  uint8_t attr = vram[nametables[0] + 0x3C0 + attr_table_offset];
   if ((tile_col % 4 / 2) >= 1) attr >>= 2;
   if ((tile_row % 4 / 2) >= 1) attr >>= 4;
   attr &= 0b11;
@@ -183,8 +206,8 @@ void Ppu::draw_sprites() {
     uint16_t begin = bank_start + pattern_index * 16;
 
     for (int8_t y = 0; y <= 7; ++y) {
-      uint8_t upper = chr[begin + y];
-      uint8_t lower = chr[begin + y + kTileHeight];
+      uint8_t upper = chr_at(begin + y);
+      uint8_t lower = chr_at(begin + y + kTileHeight);
       for (int8_t x = 7; x >= 0; --x) {
         uint8_t value = (1 & lower) << 1 | (1 & upper);
         assert(value <= 3);
@@ -202,6 +225,13 @@ void Ppu::draw_sprites() {
   }
 }
 
+void Ppu::write_chr(uint16_t addr, uint8_t data) {
+  // Copy CHR RAM before writing to it, unless this PPU is the only one to
+  // use it. The copy is not const, so writing through it is fine.
+  if (chr.use_count() > 1) chr = std::make_shared<std::vector<uint8_t>>(*chr);
+  const_cast<uint8_t &>((*chr)[chr_banks[addr >> 10] + (addr & 0x3FF)]) = data;
+}
+
 uint8_t Ppu::sprite_palette_start_idx(uint8_t data_byte) const {
   uint8_t offset = data_byte & 0b11;
   return 0x10 + offset * 4;
@@ -1,8 +1,10 @@
 #pragma once
 
+#include <memory>
 #include <vector>
 
 #include "cartridge.h"
+#include "interrupts.h"
 
 namespace nesem {
 
@@ -36,9 +38,25 @@ struct PpuAddressLatch {
 };
 
 struct Ppu {
-  std::vector<uint8_t> chr;  // graphics data (external to the PPU)
+  // Graphics data (external to the PPU). CHR ROM is shared by the NES
+  // instances running the same cartridge, and so is CHR RAM until written
+  // to.
+  SharedRom chr = std::make_shared<std::vector<uint8_t>>();
+  bool chr_writable = false;  // CHR RAM rather than ROM
+
+  // Offsets in chr of the 1KB banks mapped at $0000-$1FFF, as selected by
+  // the mapper of the cartridge
+  std::array<uint32_t, 8> chr_banks = {0x0000, 0x0400, 0x0800, 0x0C00,
+                                       0x1000, 0x1400, 0x1800, 0x1C00};
+
   ScreenMirroring mirroring = ScreenMirroring::Vertical;
-  std::array<uint8_t, 2048> vram = {0};    // video ram (external to the PPU)
+
+  // Offsets in vram of the nametables at $2000, $2400, $2800 and $2C00, as
+  // laid out by the mirroring
+  std::array<uint16_t, 4> nametables = {0x000, 0x400, 0x000, 0x400};
+
+  // video ram (external to the PPU): 2KB, or 4KB for four-screen cartridges
+  std::array<uint8_t, 4096> vram = {0};
   std::array<uint8_t, 32> palettes = {0};  // internal storage for colors
   std::array<uint8_t, 256> oam = {0};      // internal storage for sprites
 
@@ -108,10 +126,25 @@ struct Ppu {
   // Address of OAM memory to access
   uint8_t oam_addr = 0;
 
-  bool nmi_pending = false;
+  // Lines on which the start of vblank raises an NMI, if enabled
+  InterruptLines *interrupts = nullptr;
 
   Ppu() {}
   explicit Ppu(const Cartridge &cartridge);
+  Ppu(SharedRom chr, ScreenMirroring mirroring);
+
+  void set_mirroring(ScreenMirroring mirroring);
+
+  // Access the pattern tables, at $0000-$1FFF
+  uint8_t chr_at(uint16_t addr) const {
+    return (*chr)[chr_banks[addr >> 10] + (addr & 0x3FF)];
+  }
+
+  // Translate an address of the nametables, at $2000-$3EFF, into an offset
+  // in vram
+  uint16_t vram_offset(uint16_t addr) const {
+    return nametables[(addr >> 10) & 0b11] + (addr & 0x3FF);
+  }
 
   // 7  bit  0
   // ---- ----
@@ -161,11 +194,23 @@ struct Ppu {
   // the bits, as will writing to any other register.
   void write(uint16_t addr, uint8_t data);
 
+  // Address the next access to data ($2007) goes to
+  uint16_t data_addr() const { return addr_latch.read() & 0x3FFF; }
+
   // Transfer a page (255 bytes) of data.
   void oam_dma(uint8_t *data);
 
   void tick(size_t cycles);
 
+  // Number of ppu cycles until the start of the next vertical blanking
+  // interval, i.e. the smallest n for which tick(n) would enter vblank (and
+  // possibly request an NMI).
+  size_t cycles_until_vblank() const;
+
+  // Number of ppu cycles until the start of the next occurrence of the
+  // scanline, i.e. the smallest n for which tick(n) would enter it
+  size_t cycles_until_scanline(uint16_t scanline) const;
+
  private:
   bool in_vblank = false;
   bool sprite_0_hit = false;
@@ -192,6 +237,8 @@ struct Ppu {
 
   void draw_sprites();
   uint8_t sprite_palette_start_idx(uint8_t data_byte) const;
+
+  void write_chr(uint16_t addr, uint8_t data);
 };
 
 };  // namespace nesem
@@ -0,0 +1,83 @@
+#include "profile.h"
+
+#include <fmt/core.h>
+
+#include <algorithm>
+
+#include "instruction_set.h"
+
+namespace nesem {
+
+// Indices of the executed counters, by decreasing number of cycles
+template <typename Counters>
+static std::vector<size_t> executed_by_cycles(const Counters &counters) {
+  std::vector<size_t> indices;
+  for (size_t i = 0; i < counters.size(); ++i)
+    if (counters[i].executions) indices.push_back(i);
+  std::stable_sort(indices.begin(), indices.end(), [&](size_t a, size_t b) {
+    return counters[a].cycles > counters[b].cycles;
+  });
+  return indices;
+}
+
+void ExecutionProfile::clear() {
+  opcodes.fill({});
+  std::fill(pcs.begin(), pcs.end(), ExecutionCounter{});
+}
+
+std::string ExecutionProfile::dump_text(size_t max_pcs) const {
+  uint64_t total_cycles = 0;
+  for (const ExecutionCounter &counter : opcodes) total_cycles += counter.cycles;
+  auto percent = [&](uint64_t cycles) {
+    return total_cycles ? 100.0 * cycles / total_cycles : 0.0;
+  };
+
+  std::string out = fmt::format("{:<10} {:>14} {:>14} {:>7}\n", "opcode",
+                                "executions", "cycles", "%");
+  for (size_t opc : executed_by_cycles(opcodes)) {
+    const ExecutionCounter &counter = opcodes[opc];
+    out += fmt::format("{:02X} {:<7} {:>14} {:>14} {:>6.2f}%\n", opc,
+                       nesem::opcodes[opc].mnemonic, counter.executions,
+                       counter.cycles, percent(counter.cycles));
+  }
+
+  out += fmt::format("\n{:<10} {:>14} {:>14} {:>7}\n", "pc", "executions",
+                     "cycles", "%");
+  std::vector<size_t> pc_indices = executed_by_cycles(pcs);
+  if (pc_indices.size() > max_pcs) pc_indices.resize(max_pcs);
+  for (size_t pc : pc_indices) {
+    const ExecutionCounter &counter = pcs[pc];
+    out += fmt::format("{:04X}       {:>14} {:>14} {:>6.2f}%\n", pc,
+                       counter.executions, counter.cycles,
+                       percent(counter.cycles));
+  }
+  return out;
+}
+
+std::string ExecutionProfile::dump_json() const {
+  std::string out = "{\"opcodes\":[";
+  bool first = true;
+  for (size_t opc : executed_by_cycles(opcodes)) {
+    const ExecutionCounter &counter = opcodes[opc];
+    out += fmt::format(
+        "{}{{\"opcode\":\"{:02X}\",\"mnemonic\":\"{}\",\"executions\":{},"
+        "\"cycles\":{}}}",
+        first ? "" : ",", opc, nesem::opcodes[opc].mnemonic,
+        counter.executions, counter.cycles);
+    first = false;
+  }
+
+  out += "],\"pcs\":[";
+  first = true;
+  for (size_t pc : executed_by_cycles(pcs)) {
+    const ExecutionCounter &counter = pcs[pc];
+    out += fmt::format(
+        "{}{{\"pc\":\"{:04X}\",\"executions\":{},\"cycles\":{}}}",
+        first ? "" : ",", pc, counter.executions, counter.cycles);
+    first = false;
+  }
+  out += "]}";
+  return out;
+}
+
+}  // namespace nesem
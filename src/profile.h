@@ -0,0 +1,54 @@
+// Execution counters, for finding the instructions worth fusing and the
+// routines a ROM spends its time in.
+//
+// The cpu only records instructions into a profile when built with
+// NESEM_PROFILE, and costs nothing otherwise. Instructions run by the JIT or
+// AOT compiled code are not recorded.
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace nesem {
+
+// Whether the cpu records instructions into its profile (configured with
+// NESEM_PROFILE)
+#ifdef NESEM_PROFILE
+inline constexpr bool kProfiling = true;
+#else
+inline constexpr bool kProfiling = false;
+#endif
+
+struct ExecutionCounter {
+  uint64_t executions = 0;
+  uint64_t cycles = 0;
+};
+
+struct ExecutionProfile {
+  // Indexed by opcode, and by address of the first byte of the instruction
+  std::array<ExecutionCounter, 0x100> opcodes = {};
+  std::vector<ExecutionCounter> pcs = std::vector<ExecutionCounter>(0x10000);
+
+  void record(uint8_t opc, uint16_t pc, size_t cycles) {
+    ++opcodes[opc].executions;
+    opcodes[opc].cycles += cycles;
+    ++pcs[pc].executions;
+    pcs[pc].cycles += cycles;
+  }
+
+  void clear();
+
+  // List the executed opcodes, then the max_pcs addresses that took the most
+  // cycles, as a table sorted by cycles
+  std::string dump_text(size_t max_pcs = 32) const;
+
+  // Same counters as a JSON object holding an "opcodes" and a "pcs" array,
+  // listing every executed opcode and address sorted by cycles
+  std::string dump_json() const;
+};
+
+}  // namespace nesem
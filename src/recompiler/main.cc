@@ -0,0 +1,54 @@
+// Translate a mapper 0 cartridge into a C++ translation unit to be linked
+// with libnesem. See aot.h.
+//
+// Usage: nesem_recompile <rom.nes> <output.cc> <name> [--entry <addr>]...
+//
+// The generated file defines `const nesem::AotProgram <name>`. Additional
+// entry points (in hex) may be given for code that is only reached through
+// jump tables or return addresses pushed on the stack.
+
+#include <fmt/core.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+#include "cartridge.h"
+#include "recompiler/recompiler.h"
+
+int main(int argc, char **argv) {
+  if (argc < 4) {
+    fmt::print(stderr,
+               "Usage: {} <rom.nes> <output.cc> <name> [--entry <addr>]...\n",
+               argv[0]);
+    return 1;
+  }
+
+  std::vector<uint16_t> entries;
+  for (int i = 4; i < argc; ++i) {
+    if (strcmp(argv[i], "--entry") == 0 && i + 1 < argc) {
+      entries.push_back(strtol(argv[++i], nullptr, 16));
+    } else {
+      fmt::print(stderr, "Unknown argument {}\n", argv[i]);
+      return 1;
+    }
+  }
+
+  std::fstream fs{argv[1]};
+  try {
+    nesem::Cartridge cartridge = nesem::load_ines_rom_dump(&fs);
+    auto blocks = nesem::recompiler::discover(cartridge, entries);
+    std::ofstream output{argv[2]};
+    nesem::recompiler::emit(cartridge, blocks, argv[3], &output);
+    if (!output) {
+      fmt::print(stderr, "Failed to write {}\n", argv[2]);
+      return 1;
+    }
+    fmt::print("Translated {} blocks from {}\n", blocks.size(), argv[1]);
+  } catch (const std::exception &e) {
+    fmt::print(stderr, "Failed to translate {}: {}\n", argv[1], e.what());
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,530 @@
+#include "recompiler.h"
+
+#include <fmt/core.h>
+
+#include <set>
+#include <stdexcept>
+#include <string_view>
+
+#include "cpu.h"
+#include "instruction_set.h"
+
+namespace nesem {
+namespace recompiler {
+
+namespace {
+
+// View of PRG ROM as mapped into the cpu address space
+class Rom {
+ public:
+  explicit Rom(const std::vector<uint8_t> &prg) : prg(prg) {}
+
+  uint8_t operator[](uint16_t addr) const {
+    return prg[(addr - 0x8000) % prg.size()];
+  }
+
+  uint16_t read16(uint16_t addr) const {
+    return (*this)[addr] | ((*this)[addr + 1] << 8);
+  }
+
+ private:
+  const std::vector<uint8_t> &prg;
+};
+
+bool is_direct(uint16_t addr) { return addr <= 0x1FFF || addr >= 0x8000; }
+
+struct Instruction {
+  uint16_t pc;
+  const Opcode *opcode;
+  uint16_t operand;
+
+  std::string_view op() const { return opcode->mnemonic; }
+  AddressingMode mode() const { return opcode->mode; }
+  uint32_t next() const { return pc + opcode->len; }
+};
+
+Instruction decode(const Rom &rom, uint16_t pc) {
+  const Opcode &opcode = opcodes[rom[pc]];
+  uint16_t operand = 0;
+  if (opcode.len == 3)
+    operand = rom.read16(pc + 1);
+  else if (opcode.len == 2)
+    operand = rom[pc + 1];
+  return {pc, &opcode, operand};
+}
+
+// How an instruction uses its memory operand
+enum class Access { kNone, kRead, kWrite, kReadWrite };
+
+Access access_of(const Instruction &in) {
+  std::string_view op = in.op();
+  AddressingMode mode = in.mode();
+  if (mode == AddressingMode::Implied || mode == AddressingMode::Relative ||
+      mode == AddressingMode::Indirect || op == "NOP" || op == "JMP" ||
+      op == "JSR")
+    return Access::kNone;
+  if (op == "STA" || op == "STX" || op == "STY" || op == "SAX")
+    return Access::kWrite;
+  if (op == "INC" || op == "DEC" || op == "ASL" || op == "LSR" ||
+      op == "ROL" || op == "ROR" || op == "DCP" || op == "ISB" ||
+      op == "RLA" || op == "RRA" || op == "SLO" || op == "SRE")
+    return Access::kReadWrite;
+  return Access::kRead;
+}
+
+bool is_branch(std::string_view op) {
+  return op == "BCC" || op == "BCS" || op == "BEQ" || op == "BMI" ||
+         op == "BNE" || op == "BPL" || op == "BVC" || op == "BVS";
+}
+
+// Whether the instruction ends a block: it either sets the program counter,
+// or may allow a pending interrupt to be handled
+bool ends_block(std::string_view op) {
+  return is_branch(op) || op == "JMP" || op == "JSR" || op == "RTS" ||
+         op == "RTI" || op == "BRK" || op == "CLI" || op == "PLP";
+}
+
+// Address of the pointer read by an indirect jump, and of its high byte,
+// which wraps around the page
+std::pair<uint16_t, uint16_t> indirect_pointer(const Instruction &in) {
+  uint16_t lo = in.operand;
+  uint16_t hi = (lo & 0xFF) == 0xFF ? lo & 0xFF00 : lo + 1;
+  return {lo, hi};
+}
+
+// Whether the instruction can be translated. Instructions that are not are
+// left to the interpreter.
+bool is_translatable(const Instruction &in) {
+  static constexpr std::string_view kUntranslatable[] = {
+      "ALR", "ANC", "ANE", "ARR", "JAM", "LAS", "LXA",
+      "SBX", "SHA", "SHX", "SHY", "TAS"};
+  for (std::string_view op : kUntranslatable)
+    if (in.op() == op) return false;
+  if (in.next() > 0x10000) return false;
+
+  if (in.mode() == AddressingMode::Indirect) {
+    auto [lo, hi] = indirect_pointer(in);
+    return is_direct(lo) && is_direct(hi);
+  }
+  Access access = access_of(in);
+  if (access != Access::kNone && in.mode() == AddressingMode::Absolute) {
+    if (access == Access::kRead) return is_direct(in.operand);
+    return in.operand <= 0x1FFF;
+  }
+  return true;
+}
+
+// Emits the function translating a single basic block
+class BlockWriter {
+ public:
+  BlockWriter(const Rom &rom, std::ostream *os) : rom(rom), os(os) {}
+
+  // Upper bound of the cycles taken by the last block written
+  uint32_t max_cycles = 0;
+
+  void write(const BasicBlock &block);
+
+ private:
+  const Rom &rom;
+  std::ostream *os;
+  std::string indent;
+
+  template <typename... Args>
+  void line(fmt::format_string<Args...> format, Args &&...args) {
+    *os << indent << fmt::format(format, std::forward<Args>(args)...) << "\n";
+  }
+
+  void leave(uint32_t pc) { line("return r.leave(cpu, 0x{:04X});", pc); }
+
+  void instruction(const Instruction &in);
+
+  // Emit the statements resolving the memory operand of the instruction,
+  // leaving the block if it is not in CPU RAM or PRG ROM. Returns an
+  // expression designating the operand.
+  std::string operand(const Instruction &in, Access access);
+
+  // Emit the computation of the effective address into the variable addr.
+  // Returns an expression telling if a page boundary was crossed, if that
+  // can happen in the addressing mode.
+  std::string effective_address(const Instruction &in);
+
+  void branch(const Instruction &in);
+  void rmw(const Instruction &in, const std::string &m);
+};
+
+void BlockWriter::write(const BasicBlock &block) {
+  max_cycles = 0;
+  *os << fmt::format("void block_{:04X}(CpuState &cpu, uint8_t *wram) {{\n",
+                     block.start);
+  indent = "  ";
+  line("AotRegs r{{cpu}};");
+  const Instruction *last = nullptr;
+  Instruction in;
+  for (uint16_t pc : block.instructions) {
+    in = decode(rom, pc);
+    last = &in;
+    max_cycles += in.opcode->cycles;
+    if (in.opcode->does_add_cycle_if_page_boundary_crossed()) ++max_cycles;
+    if (is_branch(in.op())) max_cycles += 2;
+    instruction(in);
+  }
+  if (!last || !ends_block(last->op()) || last->op() == "CLI" ||
+      last->op() == "PLP")
+    leave(last ? last->next() : block.start);
+  indent = "";
+  *os << "}\n\n";
+}
+
+std::string BlockWriter::effective_address(const Instruction &in) {
+  switch (in.mode()) {
+    case AddressingMode::Zeropage:
+    case AddressingMode::Absolute:
+      line("uint16_t addr = 0x{:04X};", in.operand);
+      return "";
+    case AddressingMode::ZeropageX:
+    case AddressingMode::ZeropageY:
+      line("uint16_t addr = (uint8_t)(0x{:02X} + r.{});", in.operand,
+           in.mode() == AddressingMode::ZeropageX ? 'x' : 'y');
+      return "";
+    case AddressingMode::AbsoluteX:
+    case AddressingMode::AbsoluteY:
+      line("uint16_t addr = 0x{:04X} + r.{};", in.operand,
+           in.mode() == AddressingMode::AbsoluteX ? 'x' : 'y');
+      return fmt::format("(addr >> 8) != 0x{:02X}", in.operand >> 8);
+    case AddressingMode::IndirectX:
+      line("uint8_t ref = 0x{:02X} + r.x;", in.operand);
+      line("uint16_t addr = wram[ref] | wram[(uint8_t)(ref + 1)] << 8;");
+      return "";
+    case AddressingMode::IndirectY:
+      line("uint16_t base = wram[0x{:02X}] | wram[0x{:02X}] << 8;", in.operand,
+           (in.operand + 1) & 0xFF);
+      line("uint16_t addr = base + r.y;");
+      return "(addr >> 8) != (base >> 8)";
+    default:
+      return "";
+  }
+}
+
+std::string BlockWriter::operand(const Instruction &in, Access access) {
+  if (in.mode() == AddressingMode::Immediate)
+    return fmt::format("0x{:02X}", in.operand);
+
+  // Addresses known statically are checked by is_translatable
+  if (in.mode() == AddressingMode::Zeropage ||
+      in.mode() == AddressingMode::Absolute) {
+    if (in.operand <= 0x1FFF)
+      return fmt::format("wram[0x{:03X}]", in.operand & 0x7FF);
+    return fmt::format("0x{:02X}", rom[in.operand]);
+  }
+
+  std::string crossed = effective_address(in);
+  if (in.mode() == AddressingMode::ZeropageX ||
+      in.mode() == AddressingMode::ZeropageY)
+    return "wram[addr]";
+
+  if (access == Access::kRead) {
+    line("if (!is_direct(addr)) return r.leave(cpu, 0x{:04X});", in.pc);
+    if (!crossed.empty() &&
+        in.opcode->does_add_cycle_if_page_boundary_crossed())
+      line("if ({}) ++r.cycles;", crossed);
+    return "load(wram, addr)";
+  }
+  line("if (addr > 0x1FFF) return r.leave(cpu, 0x{:04X});", in.pc);
+  return "wram[addr & 0x7FF]";
+}
+
+void BlockWriter::branch(const Instruction &in) {
+  std::string_view op = in.op();
+  std::string cond;
+  if (op == "BCC") cond = "!r.flags.carry";
+  if (op == "BCS") cond = "r.flags.carry";
+  if (op == "BEQ") cond = "r.flags.zero()";
+  if (op == "BNE") cond = "!r.flags.zero()";
+  if (op == "BMI") cond = "r.flags.negative()";
+  if (op == "BPL") cond = "!r.flags.negative()";
+  if (op == "BVS") cond = "r.flags.overflow";
+  if (op == "BVC") cond = "!r.flags.overflow";
+
+  uint16_t next = in.next();
+  uint16_t target = next + (int8_t)in.operand;
+  uint32_t taken_cycles =
+      in.opcode->cycles + ((target & 0xFF00) != (next & 0xFF00) ? 2 : 1);
+  line("if ({}) {{", cond);
+  line("  r.cycles += {};", taken_cycles);
+  line("  return r.leave(cpu, 0x{:04X});", target);
+  line("}}");
+  line("r.cycles += {};", in.opcode->cycles);
+  leave(next);
+}
+
+// Read, modify and write back the operand
+void BlockWriter::rmw(const Instruction &in, const std::string &m) {
+  std::string_view op = in.op();
+  line("uint8_t data = {};", m);
+  if (op == "INC" || op == "ISB") {
+    line("data = data + 1;");
+    if (op == "INC") line("r.set_nz(data);");
+  } else if (op == "DEC" || op == "DCP") {
+    line("data = data - 1;");
+    if (op == "DEC") line("r.set_nz(data);");
+  } else if (op == "ASL" || op == "SLO") {
+    line("data = r.asl(data);");
+  } else if (op == "LSR" || op == "SRE") {
+    line("data = r.lsr(data);");
+  } else if (op == "ROL" || op == "RLA") {
+    line("data = r.rol(data);");
+  } else if (op == "ROR" || op == "RRA") {
+    line("data = r.ror(data);");
+  }
+  line("{} = data;", m);
+
+  if (op == "DCP") line("r.compare(data, r.a);");
+  if (op == "ISB") line("r.sbc(data);");
+  if (op == "RLA") line("r.a &= data;");
+  if (op == "SLO") line("r.a |= data;");
+  if (op == "SRE") line("r.a ^= data;");
+  if (op == "RLA" || op == "SLO" || op == "SRE") line("r.set_nz(r.a);");
+  if (op == "RRA") line("r.adc(data);");
+}
+
+void BlockWriter::instruction(const Instruction &in) {
+  std::string_view op = in.op();
+  uint8_t cycles = in.opcode->cycles;
+  std::string bytes;
+  for (int i = 0; i < in.opcode->len; ++i)
+    bytes += fmt::format("{:02X} ", rom[in.pc + i]);
+  line("// {:04X}  {:9} {}", in.pc, bytes, op);
+  line("{{");
+  indent += "  ";
+
+  Access access = access_of(in);
+  std::string m;
+  if (access != Access::kNone) m = operand(in, access);
+
+  if (op == "LDA" || op == "LDX" || op == "LDY") {
+    char reg = op[2] + ('a' - 'A');
+    line("r.{} = {};", reg, m);
+    line("r.set_nz(r.{});", reg);
+  } else if (op == "LAX") {
+    line("r.a = r.x = {};", m);
+    line("r.set_nz(r.a);");
+  } else if (op == "STA" || op == "STX" || op == "STY") {
+    line("{} = r.{};", m, (char)(op[2] + ('a' - 'A')));
+  } else if (op == "SAX") {
+    line("{} = r.a & r.x;", m);
+  } else if (op == "TAX" || op == "TAY" || op == "TSX" || op == "TXA" ||
+             op == "TYA" || op == "TXS") {
+    auto reg = [](char c) {
+      return c == 'S' ? "sp" : c == 'A' ? "a" : c == 'X' ? "x" : "y";
+    };
+    line("r.{} = r.{};", reg(op[2]), reg(op[1]));
+    if (op != "TXS") line("r.set_nz(r.{});", reg(op[2]));
+  } else if (op == "PHA") {
+    line("r.push(wram, r.a);");
+  } else if (op == "PHP") {
+    line("r.push(wram, r.flags.bits() | 0b00110000);");
+  } else if (op == "PLA") {
+    line("r.a = r.pop(wram);");
+    line("r.set_nz(r.a);");
+  } else if (op == "PLP") {
+    line("r.plp(r.pop(wram));");
+  } else if (op == "INX" || op == "INY" || op == "DEX" || op == "DEY") {
+    char reg = op[2] + ('a' - 'A');
+    line("r.{} {}= 1;", reg, op[0] == 'I' ? '+' : '-');
+    line("r.set_nz(r.{});", reg);
+  } else if (access == Access::kReadWrite) {
+    rmw(in, m);
+  } else if (op == "ASL" || op == "LSR" || op == "ROL" || op == "ROR") {
+    line("r.a = r.{}(r.a);", op == "ASL"   ? "asl"
+                             : op == "LSR" ? "lsr"
+                             : op == "ROL" ? "rol"
+                                           : "ror");
+  } else if (op == "ADC") {
+    line("r.adc({});", m);
+  } else if (op == "SBC") {
+    line("r.sbc({});", m);
+  } else if (op == "AND" || op == "EOR" || op == "ORA") {
+    line("r.a {}= {};", op == "AND" ? '&' : op == "EOR" ? '^' : '|', m);
+    line("r.set_nz(r.a);");
+  } else if (op == "CMP" || op == "CPX" || op == "CPY") {
+    line("r.compare({}, r.{});", m, op == "CMP" ? 'a' : op == "CPX" ? 'x' : 'y');
+  } else if (op == "BIT") {
+    line("r.bit({});", m);
+  } else if (op == "CLC" || op == "SEC") {
+    line("r.flags.carry = {};", op == "SEC");
+  } else if (op == "CLD" || op == "SED") {
+    line("r.flags.decimal = {};", op == "SED");
+  } else if (op == "CLI" || op == "SEI") {
+    line("r.flags.interrupt_disable = {};", op == "SEI");
+  } else if (op == "CLV") {
+    line("r.flags.overflow = false;");
+  } else if (op == "NOP") {
+    if (in.opcode->does_add_cycle_if_page_boundary_crossed()) {
+      std::string crossed = effective_address(in);
+      line("if ({}) ++r.cycles;", crossed);
+    }
+  } else if (is_branch(op)) {
+    branch(in);
+  } else if (op == "JMP" && in.mode() == AddressingMode::Absolute) {
+    line("r.cycles += {};", cycles);
+    leave(in.operand);
+  } else if (op == "JMP") {
+    auto [lo, hi] = indirect_pointer(in);
+    auto byte = [&](uint16_t addr) {
+      return addr <= 0x1FFF ? fmt::format("wram[0x{:03X}]", addr & 0x7FF)
+                            : fmt::format("0x{:02X}", rom[addr]);
+    };
+    line("r.cycles += {};", cycles);
+    line("return r.leave(cpu, {} | {} << 8);", byte(lo), byte(hi));
+  } else if (op == "JSR") {
+    uint16_t ret = in.pc + 2;
+    line("r.push(wram, 0x{:02X});", ret >> 8);
+    line("r.push(wram, 0x{:02X});", ret & 0xFF);
+    line("r.cycles += {};", cycles);
+    leave(in.operand);
+  } else if (op == "RTS" || op == "RTI") {
+    if (op == "RTI") line("r.plp(r.pop(wram));");
+    line("uint16_t lo = r.pop(wram);");
+    line("uint16_t hi = r.pop(wram);");
+    line("r.cycles += {};", cycles);
+    line("return r.leave(cpu, (uint16_t)((hi << 8 | lo){}));",
+         op == "RTS" ? " + 1" : "");
+  } else if (op == "BRK") {
+    uint16_t ret = in.pc + 2;
+    line("r.push(wram, 0x{:02X});", ret >> 8);
+    line("r.push(wram, 0x{:02X});", ret & 0xFF);
+    line("r.push(wram, r.flags.bits() | 0b00010000);");
+    line("r.flags.interrupt_disable = true;");
+    line("r.cycles += {};", cycles);
+    leave(rom.read16(Cpu::kIrqVector));
+  }
+
+  if (!ends_block(op) || op == "CLI" || op == "PLP")
+    line("r.cycles += {};", cycles);
+  indent.resize(indent.size() - 2);
+  line("}}");
+}
+
+}  // namespace
+
+std::map<uint16_t, BasicBlock> discover(const Cartridge &cartridge,
+                                        const std::vector<uint16_t> &entries) {
+  if (cartridge.mapper != 0)
+    throw std::runtime_error(
+        fmt::format("Unsupported cartridge mapper {}", cartridge.mapper));
+  if (cartridge.prg.empty()) throw std::runtime_error("Cartridge has no PRG");
+  Rom rom{cartridge.prg};
+
+  std::set<uint16_t> leaders;
+  std::set<uint16_t> instructions;
+  std::vector<uint16_t> worklist;
+  auto reach = [&](uint32_t addr) {
+    if (addr < 0x8000 || addr > 0xFFFF) return;
+    leaders.insert(addr);
+    worklist.push_back(addr);
+  };
+  reach(rom.read16(Cpu::kResetVector));
+  reach(rom.read16(Cpu::kNmiVector));
+  reach(rom.read16(Cpu::kIrqVector));
+  for (uint16_t entry : entries) reach(entry);
+
+  while (!worklist.empty()) {
+    uint32_t pc = worklist.back();
+    worklist.pop_back();
+    while (pc >= 0x8000 && pc <= 0xFFFF && !instructions.count(pc)) {
+      Instruction in = decode(rom, pc);
+      if (in.next() > 0x10000 || in.op() == "JAM") break;
+      instructions.insert(pc);
+
+      std::string_view op = in.op();
+      if (!is_translatable(in)) {
+        // Resume after the instruction, once the interpreter executed it
+        if (op == "JMP") break;
+        reach(in.next());
+      } else if (is_branch(op)) {
+        reach(in.next());
+        reach((uint16_t)(in.next() + (int8_t)in.operand));
+      } else if (op == "JMP") {
+        if (in.mode() == AddressingMode::Absolute) {
+          reach(in.operand);
+        } else {
+          auto [lo, hi] = indirect_pointer(in);
+          if (lo >= 0x8000 && hi >= 0x8000) reach(rom[lo] | rom[hi] << 8);
+        }
+      } else if (op == "JSR") {
+        reach(in.operand);
+        reach(in.next());
+      } else if (op == "BRK") {
+        reach(in.next() + 1);
+      } else if (ends_block(op)) {
+        if (op == "CLI" || op == "PLP") reach(in.next());
+      }
+      if (ends_block(op) || !is_translatable(in)) break;
+      pc = in.next();
+    }
+  }
+
+  std::map<uint16_t, BasicBlock> blocks;
+  for (uint16_t leader : leaders) {
+    if (!instructions.count(leader)) continue;
+    BasicBlock block{leader};
+    uint32_t pc = leader;
+    for (;;) {
+      Instruction in = decode(rom, pc);
+      if (!is_translatable(in)) break;
+      block.instructions.push_back(pc);
+      pc = in.next();
+      if (ends_block(in.op()) || leaders.count(pc) || !instructions.count(pc))
+        break;
+    }
+    if (!block.instructions.empty()) blocks[leader] = std::move(block);
+  }
+  return blocks;
+}
+
+void emit(const Cartridge &cartridge,
+          const std::map<uint16_t, BasicBlock> &blocks, const std::string &name,
+          std::ostream *os) {
+  Rom rom{cartridge.prg};
+
+  *os << "// Generated by nesem_recompile. Do not edit.\n\n"
+         "#include <iterator>\n\n"
+         "#include \"aot.h\"\n\n"
+         "namespace {\n\n"
+         "using nesem::AotRegs;\n"
+         "using nesem::CpuState;\n\n";
+
+  *os << "constexpr uint8_t kPrg[] = {";
+  for (size_t i = 0; i < cartridge.prg.size(); ++i)
+    *os << (i % 16 == 0 ? "\n    " : " ")
+        << fmt::format("0x{:02X},", cartridge.prg[i]);
+  *os << "\n};\n\n";
+
+  *os << "inline bool is_direct(uint16_t addr) {\n"
+         "  return addr <= 0x1FFF || addr >= 0x8000;\n"
+         "}\n\n"
+         "inline uint8_t load(const uint8_t *wram, uint16_t addr) {\n"
+         "  if (addr <= 0x1FFF) return wram[addr & 0x7FF];\n"
+         "  return kPrg[(addr - 0x8000) % sizeof(kPrg)];\n"
+         "}\n\n";
+
+  BlockWriter writer{rom, os};
+  std::map<uint16_t, uint32_t> max_cycles;
+  for (const auto &[start, block] : blocks) {
+    writer.write(block);
+    max_cycles[start] = writer.max_cycles;
+  }
+
+  *os << "const nesem::AotBlock kBlocks[] = {\n";
+  for (const auto &[start, block] : blocks)
+    *os << fmt::format("    {{0x{:04X}, {}, block_{:04X}}},\n", start,
+                       max_cycles[start], start);
+  *os << "};\n\n"
+         "}  // namespace\n\n";
+
+  *os << fmt::format("extern const nesem::AotProgram {} = {{\n", name)
+      << "    kPrg, sizeof(kPrg), kBlocks, std::size(kBlocks)};\n";
+}
+
+}  // namespace recompiler
+}  // namespace nesem
@@ -0,0 +1,39 @@
+// Ahead-of-time recompiler translating the code of a mapper 0 (NROM)
+// cartridge into C++. See aot.h for how the generated code is run.
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "cartridge.h"
+
+namespace nesem {
+namespace recompiler {
+
+// A straight-line run of instructions, entered only at its first instruction
+struct BasicBlock {
+  uint16_t start;
+  std::vector<uint16_t> instructions;  // addresses of the instructions
+};
+
+// Trace the code reachable from the interrupt vectors and the additional
+// entry points, and split it into basic blocks keyed by start address.
+//
+// Tracing follows branches, jumps and subroutine calls. It stops at
+// instructions whose destination is only known at run time (e.g. RTS or
+// an indirect jump through RAM).
+std::map<uint16_t, BasicBlock> discover(
+    const Cartridge &cartridge, const std::vector<uint16_t> &entries = {});
+
+// Translate the blocks into a C++ translation unit defining an AotProgram
+// with the specified name
+void emit(const Cartridge &cartridge,
+          const std::map<uint16_t, BasicBlock> &blocks, const std::string &name,
+          std::ostream *os);
+
+}  // namespace recompiler
+}  // namespace nesem
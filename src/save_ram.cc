@@ -0,0 +1,97 @@
+#include "save_ram.h"
+
+#if defined(__linux__) || defined(__APPLE__)
+#define NESEM_MMAP_SUPPORTED 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+namespace nesem {
+
+#ifdef NESEM_MMAP_SUPPORTED
+
+SaveRam::SaveRam(const std::string &path) : path(path) {
+  auto fail = [&](const char *what) {
+    std::string error = strerror(errno);
+    if (fd >= 0) close(fd);
+    return std::runtime_error(
+        fmt::format("Failed to {} save file {}: {}", what, path, error));
+  };
+
+  fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+  if (fd < 0) throw fail("open");
+  // Only grow smaller files, keeping whatever follows the save RAM in
+  // larger ones
+  struct stat st;
+  if (fstat(fd, &st) != 0) throw fail("open");
+  if (st.st_size < off_t(kSize) && ftruncate(fd, kSize) != 0)
+    throw fail("grow");
+  void *mapping =
+      mmap(nullptr, kSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (mapping == MAP_FAILED) throw fail("map");
+  ram = static_cast<uint8_t *>(mapping);
+}
+
+SaveRam::~SaveRam() {
+  flush();
+  munmap(ram, kSize);
+  close(fd);
+}
+
+void SaveRam::flush() {
+  // msync works on whole host pages
+  size_t host_page = sysconf(_SC_PAGESIZE);
+  for (size_t start = 0; start < kSize; start += host_page) {
+    size_t end = std::min(start + host_page, kSize);
+    bool written = false;
+    for (size_t page = start >> 8; page < end >> 8; ++page) {
+      written |= dirty[page];
+      dirty[page] = false;
+    }
+    if (written) msync(ram + start, end - start, MS_ASYNC);
+  }
+}
+
+#else  // !NESEM_MMAP_SUPPORTED
+
+SaveRam::SaveRam(const std::string &path) : path(path) {
+  ram = new uint8_t[kSize]();
+  std::ifstream in{path, std::ios::binary};
+  if (in) in.read(reinterpret_cast<char *>(ram), kSize);
+  std::fstream out{path, std::ios::binary | std::ios::in | std::ios::out};
+  if (!out) out.open(path, std::ios::binary | std::ios::out);
+  out.write(reinterpret_cast<const char *>(ram), kSize);
+  if (!out) {
+    delete[] ram;
+    throw std::runtime_error(fmt::format("Failed to open save file {}", path));
+  }
+}
+
+SaveRam::~SaveRam() {
+  flush();
+  delete[] ram;
+}
+
+void SaveRam::flush() {
+  std::fstream out{path, std::ios::binary | std::ios::in | std::ios::out};
+  for (size_t page = 0; page < kPages; ++page) {
+    if (!dirty[page]) continue;
+    out.seekp(page << 8);
+    out.write(reinterpret_cast<const char *>(ram + (page << 8)), 0x100);
+    dirty[page] = false;
+  }
+}
+
+#endif  // NESEM_MMAP_SUPPORTED
+
+}  // namespace nesem
@@ -0,0 +1,56 @@
+// Battery-backed PRG RAM, kept in a save file.
+//
+// The save file is mapped into memory, and the mmu points the pages of
+// $6000-$7FFF straight at the mapping. Writing a page back to the file is
+// left to the OS: flush() only asks it to start writing back the pages
+// written since the last flush, and returns without waiting. Pages that were
+// not written are never rewritten.
+//
+// To know which pages were written without checking each write, the mmu
+// maps the pages for reads only after each flush. The first write to a page
+// then goes through the mmu's register handler, which marks the page dirty
+// and maps it for writes as well.
+//
+// Mapping files requires POSIX virtual memory. Elsewhere, the file is read
+// into memory, and flush() writes the dirty pages back before returning.
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace nesem {
+
+class SaveRam {
+ public:
+  static constexpr size_t kSize = 0x2000;
+
+  // Number of pages of the address space the save RAM spans
+  static constexpr size_t kPages = kSize >> 8;
+
+  // Open the save file, creating it blank if missing, or growing it to the
+  // size of the save RAM if smaller. Larger files keep their extra data.
+  // Throws on failure.
+  explicit SaveRam(const std::string &path);
+  SaveRam(const SaveRam &) = delete;
+  ~SaveRam();
+
+  uint8_t *data() { return ram; }
+
+  void mark_dirty(size_t page) { dirty[page] = true; }
+  bool is_dirty(size_t page) const { return dirty[page]; }
+
+  // Start writing back the pages written since the last flush, and mark all
+  // the pages clean
+  void flush();
+
+ private:
+  std::string path;
+  int fd = -1;
+  uint8_t *ram = nullptr;
+  std::array<bool, kPages> dirty = {};
+};
+
+}  // namespace nesem
@@ -8,6 +8,7 @@
 namespace nesem {
 
 // ex: 20 76 F9
+template <typename Cpu>
 static std::string trace_opcode_operands(const Cpu &cpu) {
   assert(opcodes.size() == 0x100);
   const Opcode &info = opcodes[cpu.read(cpu.pc)];
@@ -34,6 +35,7 @@ static std::string trace_opcode_operands(const Cpu &cpu) {
 
 // ex:  LDA ($89),Y = 0300 @ 0300 = 89
 // max len: 32
+template <typename Cpu>
 static std::string trace_assembly(const Cpu &cpu) {
   std::string str{};
 
@@ -160,8 +162,9 @@ static std::string trace_assembly(const Cpu &cpu) {
   return str;
 }
 
-std::string trace_explain_state(const Nes &nes) {
-  const Cpu &cpu = nes.cpu;
+template <typename Bus>
+std::string trace_explain_state(const BasicNes<Bus> &nes) {
+  const BasicCpu<Bus> &cpu = nes.cpu;
   std::string opcode_operands = trace_opcode_operands(cpu);
   std::string assembly = trace_assembly(cpu);
   return fmt::format(
@@ -171,4 +174,7 @@ std::string trace_explain_state(const Nes &nes) {
       cpu.sp, nes.mmu.ppu.scanline, nes.mmu.ppu.cycle, cpu.cycles);
 }
 
+template std::string trace_explain_state(const BasicNes<Mmu> &nes);
+template std::string trace_explain_state(const BasicNes<NesMmu> &nes);
+
 }  // namespace nesem
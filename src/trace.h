@@ -13,6 +13,7 @@ namespace nesem {
 // - <asm> is the assembly representation of the current instruction and its
 // operands.
 // - <addr info> varies based on the addressing mode of the instruction
-std::string trace_explain_state(const Nes &nes);
+template <typename Bus>
+std::string trace_explain_state(const BasicNes<Bus> &nes);
 
 }  // namespace nesem
@@ -0,0 +1,134 @@
+#include "access_trace.h"
+
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <thread>
+
+#include "assembler/assembler.h"
+#include "cartridge.h"
+#include "nes.h"
+
+namespace nesem {
+
+static AccessRecord make_record(uint64_t cycle) {
+  return {cycle, uint16_t(cycle), uint16_t(cycle >> 16), uint8_t(cycle),
+          cycle & 1 ? AccessKind::Write : AccessKind::Read};
+}
+
+TEST(AccessTraceTest, capacity_rounded_up) {
+  EXPECT_EQ(AccessTrace(1000).capacity(), 1024);
+  EXPECT_EQ(AccessTrace(16).capacity(), 16);
+  EXPECT_EQ(AccessTrace(1).capacity(), 8);
+}
+
+TEST(AccessTraceTest, push_and_pop_wrap_around) {
+  AccessTrace trace(8);
+  AccessRecord out[4];
+  uint64_t next = 0;
+  for (uint64_t cycle = 0; cycle < 20; ++cycle) {
+    EXPECT_TRUE(trace.push(make_record(cycle)));
+    if (cycle % 3 == 2) {
+      size_t count = trace.pop(out, 4);
+      for (size_t i = 0; i < count; ++i)
+        EXPECT_EQ(out[i], make_record(next++));
+    }
+  }
+  EXPECT_EQ(trace.pop(out, 4), 2);
+  EXPECT_EQ(out[1], make_record(19));
+  EXPECT_EQ(trace.pop(out, 4), 0);
+}
+
+TEST(AccessTraceTest, drops_when_full) {
+  AccessTrace trace(8);
+  for (uint64_t cycle = 0; cycle < 10; ++cycle) trace.push(make_record(cycle));
+  EXPECT_FALSE(trace.push(make_record(10)));
+  EXPECT_EQ(trace.dropped_count(), 3);
+
+  AccessRecord out[16];
+  EXPECT_EQ(trace.pop(out, 16), 8);
+  EXPECT_EQ(out[7], make_record(7));
+  EXPECT_TRUE(trace.push(make_record(11)));
+}
+
+TEST(AccessTraceTest, wakes_consumer_every_eighth) {
+  AccessTrace trace(64);
+  uint32_t wakeups = trace.wakeup_count();
+  for (uint64_t cycle = 0; cycle < 7; ++cycle) trace.push(make_record(cycle));
+  EXPECT_EQ(trace.wakeup_count(), wakeups);
+  trace.push(make_record(7));
+  EXPECT_EQ(trace.wakeup_count(), wakeups + 1);
+  // Returns at once, since the count moved
+  trace.wait(wakeups);
+}
+
+TEST(AccessTraceTest, concurrent_consumer) {
+  constexpr uint64_t kRecords = 100'000;
+  AccessTrace trace(1024);
+  std::thread producer([&] {
+    for (uint64_t cycle = 0; cycle < kRecords; ++cycle)
+      while (!trace.push(make_record(cycle))) std::this_thread::yield();
+  });
+
+  AccessRecord out[64];
+  uint64_t next = 0;
+  while (next < kRecords) {
+    size_t count = trace.pop(out, 64);
+    if (!count) std::this_thread::yield();
+    for (size_t i = 0; i < count; ++i, ++next)
+      if (out[i] != make_record(next)) FAIL() << "record " << next;
+  }
+  producer.join();
+}
+
+TEST(AccessTraceTest, records_cpu_accesses) {
+  Cartridge cartridge;
+  cartridge.write_prg(0x8000, assembler::assemble(
+                                  "LDA #$05 \n"
+                                  "STA $10"));
+  cartridge.chr.resize(0x2000);
+  DebugNes nes{cartridge};
+  nes.reset();
+  AccessTrace trace;
+  nes.mmu.access_trace = &trace;
+  size_t start = nes.cpu.cycles;
+  nes.step();
+  nes.step();
+
+  AccessRecord out[8];
+  ASSERT_EQ(trace.pop(out, 8), 5);
+  EXPECT_EQ(out[0],
+            (AccessRecord{start, 0x8000, 0x8000, 0xA9, AccessKind::Read}));
+  EXPECT_EQ(out[1],
+            (AccessRecord{start, 0x8001, 0x8000, 0x05, AccessKind::Read}));
+  EXPECT_EQ(out[2],
+            (AccessRecord{start + 2, 0x8002, 0x8002, 0x85, AccessKind::Read}));
+  // Operands are accessed at their own cycle
+  EXPECT_EQ(out[4].cycle, start + 4);
+  EXPECT_EQ(out[4].addr, 0x0010);
+  EXPECT_EQ(out[4].pc, 0x8002);
+  EXPECT_EQ(out[4].data, 0x05);
+  EXPECT_EQ(out[4].kind, AccessKind::Write);
+}
+
+TEST(AccessTraceTest, writer) {
+  std::filesystem::path path =
+      std::filesystem::path(::testing::TempDir()) / "access_trace.bin";
+  AccessTrace trace(64);
+  {
+    AccessTraceWriter writer(&trace, path.string());
+    for (uint64_t cycle = 0; cycle < 1000; ++cycle)
+      while (!trace.push(make_record(cycle << 40 | cycle)))
+        std::this_thread::yield();
+  }
+  EXPECT_EQ(std::filesystem::file_size(path), 1000 * kAccessRecordSize);
+
+  std::ifstream in{path, std::ios::binary};
+  std::vector<AccessRecord> records = read_access_trace(in);
+  ASSERT_EQ(records.size(), 1000);
+  for (uint64_t cycle = 0; cycle < 1000; ++cycle)
+    EXPECT_EQ(records[cycle], make_record(cycle << 40 | cycle));
+  std::filesystem::remove(path);
+}
+
+}  // namespace nesem
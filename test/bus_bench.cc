@@ -0,0 +1,97 @@
+// Bus access benchmark.
+//
+// Runs the same memory-bound loop on cpus bound to their mmu statically
+// (BasicCpu<RamOnlyMmu>, BasicCpu<NesMmu>) and through virtual calls
+// (BasicCpu<Mmu>), and reports the average host time per bus access.
+//
+// Usage: bus_bench [instructions]
+
+#include <fmt/core.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "assembler/assembler.h"
+#include "cartridge.h"
+#include "cpu.h"
+#include "mmu.h"
+
+namespace {
+
+// Copies a page of RAM and increments a counter, from PRG ROM
+const std::string kProgram =
+    "LDX #$00 \n"
+    "LDA $0200,X \n"  // loop
+    "STA $0300,X \n"
+    "INC $10 \n"
+    "INX \n"
+    "BNE $F5 \n"
+    "JMP $8000";
+
+// Forwards accesses to another mmu, counting them
+class CountingMmu : public nesem::Mmu {
+ public:
+  explicit CountingMmu(nesem::Mmu *mmu) : mmu(mmu) {}
+
+  uint8_t read(uint16_t addr) const override {
+    ++count;
+    return mmu->read(addr);
+  }
+
+  void write(uint16_t addr, uint8_t data) override {
+    ++count;
+    mmu->write(addr, data);
+  }
+
+  mutable size_t count = 0;
+
+ private:
+  nesem::Mmu *mmu;
+};
+
+template <typename Bus>
+double run(Bus *mmu, int instructions) {
+  nesem::BasicCpu<Bus> cpu{mmu};
+  cpu.reset();
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < instructions; ++i) cpu.step();
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+void load(nesem::Mmu *mmu, const std::vector<uint8_t> &prg) {
+  for (size_t i = 0; i < prg.size(); ++i) mmu->write(0x8000 + i, prg[i]);
+  mmu->write(0xFFFC, 0x00);
+  mmu->write(0xFFFD, 0x80);
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  int instructions = argc > 1 ? atoi(argv[1]) : 100000000;
+  std::vector<uint8_t> prg = nesem::assembler::assemble(kProgram);
+
+  nesem::RamOnlyMmu ram;
+  load(&ram, prg);
+  CountingMmu counting{&ram};
+  run<nesem::Mmu>(&counting, instructions);
+  size_t accesses = counting.count;
+
+  nesem::Cartridge cartridge;
+  cartridge.write_prg(0x8000, prg);
+  nesem::NesMmu nes_mmu{cartridge};
+
+  auto report = [&](const char *name, double seconds) {
+    fmt::print("{:<24} {:.3f}s  {:.2f} ns/access\n", name, seconds,
+               seconds * 1e9 / accesses);
+  };
+  fmt::print("{} instructions, {} bus accesses\n", instructions, accesses);
+  report("BasicCpu<Mmu> (ram)", run<nesem::Mmu>(&ram, instructions));
+  report("BasicCpu<RamOnlyMmu>", run(&ram, instructions));
+  report("BasicCpu<Mmu> (nes)", run<nesem::Mmu>(&nes_mmu, instructions));
+  report("BasicCpu<NesMmu>", run(&nes_mmu, instructions));
+  return 0;
+}
@@ -0,0 +1,94 @@
+#include "bus_errors.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include "mmu.h"
+
+namespace nesem {
+
+TEST(BusErrorsTest, counted_per_page) {
+  NesMmu mmu;
+  mmu.read(0x5000);
+  mmu.read(0x5001);
+  mmu.read(0x5100);
+  mmu.write(0x4020, 0x01);
+  EXPECT_EQ(mmu.bus_errors.reads[0x50], 2);
+  EXPECT_EQ(mmu.bus_errors.reads[0x51], 1);
+  EXPECT_EQ(mmu.bus_errors.writes[0x40], 1);
+  EXPECT_EQ(mmu.bus_errors.count_reads(), 3);
+  EXPECT_EQ(mmu.bus_errors.count_reads(0x5100, 0x5FFF), 1);
+  EXPECT_EQ(mmu.bus_errors.count_writes(0x4000, 0x40FF), 1);
+
+  // Registers and memory are not counted
+  mmu.read(0x0010);
+  mmu.read(0x2002);
+  mmu.write(0x6000, 0x01);
+  EXPECT_EQ(mmu.bus_errors.count_reads(), 3);
+  EXPECT_EQ(mmu.bus_errors.count_writes(), 1);
+
+  mmu.bus_errors.clear();
+  EXPECT_EQ(mmu.bus_errors.count_reads(), 0);
+  EXPECT_EQ(mmu.bus_errors.count_writes(), 0);
+}
+
+TEST(BusErrorsTest, counts_past_32_bits) {
+  NesMmu mmu;
+  mmu.bus_errors.reads[0x50] = UINT32_MAX;
+  mmu.read(0x5000);
+  EXPECT_EQ(mmu.bus_errors.reads[0x50], uint64_t(UINT32_MAX) + 1);
+  EXPECT_EQ(mmu.bus_errors.count_reads(), uint64_t(UINT32_MAX) + 1);
+}
+
+class BusErrorLogTest : public ::testing::Test {
+ protected:
+  std::FILE *out = std::tmpfile();
+  BusErrorLog log{std::chrono::seconds(1), out};
+  BusErrorLog::Clock::time_point start;
+
+  ~BusErrorLogTest() { std::fclose(out); }
+
+  // Everything the log printed so far
+  std::string log_text() {
+    std::string text;
+    std::rewind(out);
+    for (int c; (c = std::fgetc(out)) != EOF;) text += c;
+    std::fseek(out, 0, SEEK_END);
+    return text;
+  }
+};
+
+TEST_F(BusErrorLogTest, reports_ranges) {
+  BusErrors errors;
+  errors.reads[0x50] = 2;
+  errors.reads[0x51] = 3;
+  errors.reads[0x53] = 1;
+  errors.writes[0x40] = 4;
+  log.report(errors, start);
+  EXPECT_EQ(log_text(),
+            "5 invalid reads at 5000-51FF\n"
+            "1 invalid reads at 5300-53FF\n"
+            "4 invalid writes at 4000-40FF\n");
+}
+
+TEST_F(BusErrorLogTest, rate_limited) {
+  BusErrors errors;
+  errors.reads[0x50] = 1;
+  log.report(errors, start);
+  errors.reads[0x50] = 3;
+  log.report(errors, start + std::chrono::milliseconds(500));
+  EXPECT_EQ(log_text(), "1 invalid reads at 5000-50FF\n");
+
+  // Accesses since the last report are counted by the next one
+  log.report(errors, start + std::chrono::seconds(1));
+  EXPECT_EQ(log_text(), "1 invalid reads at 5000-50FF\n"
+                        "2 invalid reads at 5000-50FF\n");
+
+  // Nothing to report
+  log.report(errors, start + std::chrono::seconds(3));
+  EXPECT_EQ(log_text(), "1 invalid reads at 5000-50FF\n"
+                        "2 invalid reads at 5000-50FF\n");
+}
+
+}  // namespace nesem
@@ -0,0 +1,106 @@
+#include "cheats.h"
+
+#include <gtest/gtest.h>
+
+#include "assembler/assembler.h"
+#include "jit.h"
+#include "mmu.h"
+#include "nes.h"
+#include "test_cartridge.h"
+
+namespace nesem {
+
+TEST(CheatsTest, game_genie_6_letters) {
+  EXPECT_EQ(parse_cheat("GOSSIP"), (Cheat{0xD1DD, 0x14, std::nullopt}));
+  EXPECT_EQ(parse_cheat("gossip"), (Cheat{0xD1DD, 0x14, std::nullopt}));
+}
+
+TEST(CheatsTest, game_genie_8_letters) {
+  EXPECT_EQ(parse_cheat("ZEXPYGLA"), (Cheat{0x94A7, 0x02, 0x03}));
+}
+
+TEST(CheatsTest, raw) {
+  EXPECT_EQ(parse_cheat("C010=EA"), (Cheat{0xC010, 0xEA, std::nullopt}));
+  EXPECT_EQ(parse_cheat("8000=1?ff"), (Cheat{0x8000, 0x01, 0xFF}));
+}
+
+TEST(CheatsTest, invalid) {
+  EXPECT_ANY_THROW(parse_cheat(""));
+  EXPECT_ANY_THROW(parse_cheat("GOSSI"));
+  EXPECT_ANY_THROW(parse_cheat("GOSSIPB"));
+  EXPECT_ANY_THROW(parse_cheat("GOSSIB"));
+  EXPECT_ANY_THROW(parse_cheat("8000="));
+  EXPECT_ANY_THROW(parse_cheat("18000=01"));
+  EXPECT_ANY_THROW(parse_cheat("8000=100"));
+  EXPECT_ANY_THROW(parse_cheat("8000=01?"));
+  EXPECT_ANY_THROW(parse_cheat("80G0=01"));
+}
+
+TEST(CheatsTest, patches_rom) {
+  NesMmu mmu{make_cartridge(0, 2)};
+  mmu.add_cheat({0xC123, 0x42});
+  EXPECT_TRUE(mmu.has_cheats());
+  EXPECT_EQ(mmu.read(0xC123), 0x42);
+  EXPECT_EQ(std::as_const(mmu).read(0xC123), 0x42);
+  EXPECT_EQ(mmu.read(0xC122), 0x01);
+  EXPECT_EQ(mmu.read(0xC124), 0x01);
+  EXPECT_EQ((*mmu.prg)[0x4123], 0x01);
+
+  NesMmu copy = mmu;
+  EXPECT_EQ(copy.read(0xC123), 0x42);
+
+  mmu.remove_cheat({0xC123, 0x42});
+  EXPECT_FALSE(mmu.has_cheats());
+  EXPECT_EQ(mmu.read(0xC123), 0x01);
+  EXPECT_EQ(copy.read(0xC123), 0x42);
+}
+
+TEST(CheatsTest, outside_rom) {
+  NesMmu mmu{make_cartridge(0, 2)};
+  EXPECT_ANY_THROW(mmu.add_cheat({0x6000, 0x42}));
+  EXPECT_FALSE(mmu.has_cheats());
+}
+
+TEST(CheatsTest, compare_follows_bank_switches) {
+  NesMmu mmu{make_cartridge(2, 4)};
+  mmu.add_cheat({0x8010, 0x42, 0x02});
+  EXPECT_EQ(mmu.read(0x8010), 0x00);
+
+  mmu.write(0x8000, 2);
+  EXPECT_EQ(mmu.read(0x8010), 0x42);
+  EXPECT_EQ(mmu.read(0x8011), 0x02);
+
+  mmu.write(0x8000, 1);
+  EXPECT_EQ(mmu.read(0x8010), 0x01);
+
+  mmu.clear_cheats();
+  mmu.write(0x8000, 2);
+  EXPECT_EQ(mmu.read(0x8010), 0x02);
+}
+
+// Replace the operand of LDA, after the program already ran once
+TEST(CheatsTest, patches_running_code) {
+  Cartridge cartridge;
+  cartridge.write_prg(0x8000, assembler::assemble(
+                                  "LDA #$05 \n"
+                                  "STA $10"));
+  cartridge.chr.resize(0x2000);
+
+  for (bool jit : {false, true}) {
+    Nes nes{cartridge};
+    if (jit) nes.set_jit_enabled(true, 1);
+    nes.reset();
+    while (nes.cpu.pc < 0x8004) nes.step();
+    EXPECT_EQ(nes.mmu.wram[0x10], 0x05);
+
+    nes.mmu.add_cheat(parse_cheat("8001=07"));
+    if (jit) {
+      EXPECT_FALSE(nes.jit->supported());
+    }
+    nes.reset();
+    while (nes.cpu.pc < 0x8004) nes.step();
+    EXPECT_EQ(nes.mmu.wram[0x10], 0x07);
+  }
+}
+
+}  // namespace nesem
@@ -6,6 +6,7 @@
 
 #include <functional>
 #include <memory>
+#include <string_view>
 
 #include "assembler/assembler.h"
 
@@ -36,6 +37,104 @@ class CpuTest : public ::testing::Test {
   }
 };
 
+// Records the cycle of the cpu at each access to a page of memory
+class AccessTimingMmu final : public Mmu {
+ public:
+  struct Access {
+    uint16_t addr;
+    size_t cycle;
+    bool write;
+
+    bool operator==(const Access&) const = default;
+  };
+
+  explicit AccessTimingMmu(uint16_t page) : page(page) {}
+
+  uint8_t read(uint16_t addr) const override {
+    if ((addr & 0xFF00) == page) accesses.push_back({addr, *cycles, false});
+    return ram.read(addr);
+  }
+
+  void write(uint16_t addr, uint8_t data) override {
+    if ((addr & 0xFF00) == page) accesses.push_back({addr, *cycles, true});
+    ram.write(addr, data);
+  }
+
+  const size_t* cycles = nullptr;
+  mutable std::vector<Access> accesses;
+
+ private:
+  uint16_t page;
+  RamOnlyMmu ram;
+};
+
+class CpuAccessTimingTest : public ::testing::Test {
+ protected:
+  AccessTimingMmu mmu{0x0300};
+  Cpu cpu = {&mmu};
+
+  CpuAccessTimingTest() { mmu.cycles = &cpu.cycles; }
+
+  // Execute the code's single instruction, returning the cycle it started at
+  size_t exec(const std::string& code) {
+    std::vector<uint8_t> prg = assembler::assemble(code);
+    for (int i = 0; i < prg.size(); ++i) cpu.write(0x8000 + i, prg[i]);
+    cpu.write16(Cpu::kResetVector, 0x8000);
+    cpu.reset();
+    size_t start = cpu.cycles;
+    cpu.step();
+    return start;
+  }
+};
+
+TEST_F(CpuAccessTimingTest, read_on_last_cycle) {
+  size_t start = exec("LDA $0310");
+
+  EXPECT_EQ(mmu.accesses, (std::vector<AccessTimingMmu::Access>{
+                              {0x0310, start + 3, false}}));
+  EXPECT_EQ(cpu.cycles, start + 4);
+}
+
+TEST_F(CpuAccessTimingTest, read_after_page_crossing) {
+  cpu.x = 0x20;
+  size_t start = exec("LDA $02F0,X");
+
+  EXPECT_EQ(mmu.accesses, (std::vector<AccessTimingMmu::Access>{
+                              {0x0310, start + 4, false}}));
+  EXPECT_EQ(cpu.cycles, start + 5);
+}
+
+TEST_F(CpuAccessTimingTest, write_on_last_cycle) {
+  cpu.x = 0x10;
+  size_t start = exec("STA $0300,X");
+
+  EXPECT_EQ(mmu.accesses, (std::vector<AccessTimingMmu::Access>{
+                              {0x0310, start + 4, true}}));
+  EXPECT_EQ(cpu.cycles, start + 5);
+}
+
+TEST_F(CpuAccessTimingTest, read_modify_write) {
+  size_t start = exec("INC $0310");
+
+  EXPECT_EQ(mmu.accesses, (std::vector<AccessTimingMmu::Access>{
+                              {0x0310, start + 3, false},
+                              {0x0310, start + 5, true}}));
+  EXPECT_EQ(cpu.cycles, start + 6);
+}
+
+TEST_F(CpuAccessTimingTest, unofficial_read_modify_write) {
+  for (std::string op : {"DCP", "ISB", "RLA", "RRA", "SLO", "SRE"}) {
+    mmu.accesses.clear();
+    size_t start = exec(op + " $0310");
+
+    EXPECT_EQ(mmu.accesses, (std::vector<AccessTimingMmu::Access>{
+                                {0x0310, start + 3, false},
+                                {0x0310, start + 5, true}}))
+        << op;
+    EXPECT_EQ(cpu.cycles, start + 6) << op;
+  }
+}
+
 // Load, store and interregister transfer instructions
 
 TEST_F(CpuTest, lda_immediate_load_data) {
@@ -49,14 +148,14 @@ TEST_F(CpuTest, lda_negative_flag) {
   load("LDA #$FF");
   run();
 
-  EXPECT_TRUE(cpu.flags.negative);
+  EXPECT_TRUE(cpu.flags.negative());
 }
 
 TEST_F(CpuTest, lda_zero_flag) {
   load("LDA #$00");
   run();
 
-  EXPECT_TRUE(cpu.flags.zero);
+  EXPECT_TRUE(cpu.flags.zero());
 }
 
 TEST_F(CpuTest, lda_immediate_timing) {
@@ -347,6 +446,17 @@ TEST_F(CpuTest, plp) {
   EXPECT_EQ(cpu.flags.bits(), 0b00100000);
 }
 
+TEST_F(CpuTest, plp_negative_and_zero) {
+  load("PLP \n PHP");
+  cpu.write(0x01FD, 0b10000010);
+  --cpu.sp;
+  run();
+
+  EXPECT_TRUE(cpu.flags.negative());
+  EXPECT_TRUE(cpu.flags.zero());
+  EXPECT_EQ(cpu.read(0x01FD), 0b10110010);
+}
+
 // Decrements & increments
 
 TEST_F(CpuTest, dec) {
@@ -354,7 +464,7 @@ TEST_F(CpuTest, dec) {
   run();
 
   EXPECT_EQ(cpu.read(0x00), 0xFF);
-  EXPECT_TRUE(cpu.flags.negative);
+  EXPECT_TRUE(cpu.flags.negative());
 }
 
 TEST_F(CpuTest, dex) {
@@ -362,7 +472,7 @@ TEST_F(CpuTest, dex) {
   run();
 
   EXPECT_EQ(cpu.x, 0xFF);
-  EXPECT_TRUE(cpu.flags.negative);
+  EXPECT_TRUE(cpu.flags.negative());
 }
 
 TEST_F(CpuTest, dey) {
@@ -370,7 +480,7 @@ TEST_F(CpuTest, dey) {
   run();
 
   EXPECT_EQ(cpu.y, 0xFF);
-  EXPECT_TRUE(cpu.flags.negative);
+  EXPECT_TRUE(cpu.flags.negative());
 }
 
 TEST_F(CpuTest, inc) {
@@ -541,7 +651,7 @@ TEST_F(CpuTest, cmp_eq) {
   cpu.write(0x00, 0x00);
   run();
 
-  EXPECT_TRUE(cpu.flags.zero);
+  EXPECT_TRUE(cpu.flags.zero());
   EXPECT_TRUE(cpu.flags.carry);
 }
 
@@ -552,7 +662,7 @@ TEST_F(CpuTest, cmp_lt) {
 
   run();
 
-  EXPECT_FALSE(cpu.flags.zero);
+  EXPECT_FALSE(cpu.flags.zero());
   EXPECT_TRUE(cpu.flags.carry);
 }
 
@@ -562,10 +672,21 @@ TEST_F(CpuTest, cmp_gt) {
   cpu.write(0x00, 0x01);
   run();
 
-  EXPECT_FALSE(cpu.flags.zero);
+  EXPECT_FALSE(cpu.flags.zero());
   EXPECT_FALSE(cpu.flags.carry);
 }
 
+TEST_F(CpuTest, bit_negative_and_zero) {
+  load("BIT $00");
+  cpu.a = 0x01;
+  cpu.write(0x00, 0x80);
+  run();
+
+  EXPECT_TRUE(cpu.flags.negative());
+  EXPECT_TRUE(cpu.flags.zero());
+  EXPECT_FALSE(cpu.flags.overflow);
+}
+
 // Conditional branch instructions
 
 TEST_F(CpuTest, bcc_carry_set) {
@@ -711,10 +832,10 @@ TEST_F(CpuTest, irq) {
       "         RTI");
   cpu.write16(Cpu::kIrqVector, 0x8002);
   cpu.flags.interrupt_disable = false;
-  cpu.irq_pending = true;
+  cpu.interrupts.assert_irq(kIrqExternal);
 
   cpu.step();
-  EXPECT_FALSE(cpu.irq_pending);
+  EXPECT_TRUE(cpu.flags.interrupt_disable);
   EXPECT_EQ(cpu.pc, 0x8002);
 }
 
@@ -726,15 +847,13 @@ TEST_F(CpuTest, irq_ignore) {
       "handler: INX \n"
       "         RTI");
   cpu.write16(Cpu::kIrqVector, 0x8003);
-  cpu.irq_pending = true;
+  cpu.interrupts.assert_irq(kIrqExternal);
 
   cpu.step();
-  EXPECT_TRUE(cpu.irq_pending);
   EXPECT_EQ(cpu.pc, 0x8001);
 
   cpu.step();
   cpu.step();
-  EXPECT_FALSE(cpu.irq_pending);
   EXPECT_EQ(cpu.pc, 0x8003);
 }
 
@@ -747,11 +866,11 @@ TEST_F(CpuTest, irq_nested) {
       "         RTI");
   cpu.write16(Cpu::kIrqVector, 0x8002);
   cpu.flags.interrupt_disable = false;
-  cpu.irq_pending = true;
+  cpu.interrupts.assert_irq(kIrqExternal);
 
+  // The line stays asserted, so the IRQ is taken again after CLI
   cpu.step();
   EXPECT_EQ(cpu.pc, 0x8002);
-  cpu.irq_pending = true;
 
   cpu.step();
   EXPECT_EQ(cpu.pc, 0x8003);
@@ -763,6 +882,29 @@ TEST_F(CpuTest, irq_nested) {
   EXPECT_EQ(cpu.x, 2);
 }
 
+TEST_F(CpuTest, irq_shared_line) {
+  load(
+      "         CLI \n"
+      "         NOP \n"
+      "         NOP \n"
+      "handler: INX \n"
+      "         RTI");
+  cpu.write16(Cpu::kIrqVector, 0x8003);
+  cpu.interrupts.assert_irq(kIrqMapper);
+  cpu.interrupts.assert_irq(kIrqDmc);
+  cpu.interrupts.release_irq(kIrqMapper);
+  cpu.step();
+
+  // Still asserted by the DMC
+  cpu.step();
+  EXPECT_EQ(cpu.pc, 0x8003);
+  cpu.step();
+  cpu.interrupts.release_irq(kIrqDmc);
+  cpu.step();
+  EXPECT_EQ(cpu.pc, 0x8001);
+  EXPECT_FALSE(cpu.interrupts.any());
+}
+
 TEST_F(CpuTest, nmi) {
   load(
       "         NOP \n"
@@ -771,11 +913,158 @@ TEST_F(CpuTest, nmi) {
       "         RTI");
   cpu.write16(Cpu::kNmiVector, 0x8002);
   cpu.flags.interrupt_disable = true;
-  cpu.nmi_pending = true;
+  cpu.interrupts.raise_nmi();
 
   cpu.step();
-  EXPECT_FALSE(cpu.nmi_pending);
+  EXPECT_FALSE(cpu.interrupts.nmi());
   EXPECT_EQ(cpu.pc, 0x8002);
 }
 
+TEST_F(CpuTest, run_until_cycle_limit) {
+  load(
+      "      LDX #$00 \n"
+      "loop: INX \n"
+      "      JMP loop");
+  size_t limit = cpu.cycles + 100;
+
+  cpu.run(limit);
+  EXPECT_GE(cpu.cycles, limit);
+  EXPECT_LT(cpu.cycles, limit + 3);
+  EXPECT_EQ(cpu.x, 20);
+}
+
+TEST_F(CpuTest, run_irq) {
+  load(
+      "         CLI \n"
+      "loop:    JMP loop \n"
+      "handler: INX \n"
+      "         JMP handler");
+  cpu.write16(Cpu::kIrqVector, 0x8004);
+  cpu.run(cpu.cycles + 20);
+  EXPECT_EQ(cpu.x, 0);
+
+  cpu.interrupts.assert_irq(kIrqExternal);
+  cpu.run(cpu.cycles + 20);
+  EXPECT_TRUE(cpu.flags.interrupt_disable);
+  EXPECT_GT(cpu.x, 0);
+}
+
+// Unofficial opcodes
+
+TEST_F(CpuTest, anc) {
+  load("ANC #$F0");
+  cpu.a = 0x8F;
+  run();
+
+  EXPECT_EQ(cpu.a, 0x80);
+  EXPECT_TRUE(cpu.flags.carry);
+  EXPECT_TRUE(cpu.flags.negative());
+}
+
+TEST_F(CpuTest, alr) {
+  load("ALR #$03");
+  cpu.a = 0xFF;
+  run();
+
+  EXPECT_EQ(cpu.a, 0x01);
+  EXPECT_TRUE(cpu.flags.carry);
+}
+
+TEST_F(CpuTest, arr) {
+  load("ARR #$FF");
+  cpu.a = 0x80;
+  cpu.flags.carry = true;
+  run();
+
+  // Carry from bit 6, overflow from bit 6 XOR bit 5
+  EXPECT_EQ(cpu.a, 0xC0);
+  EXPECT_TRUE(cpu.flags.carry);
+  EXPECT_TRUE(cpu.flags.overflow);
+  EXPECT_TRUE(cpu.flags.negative());
+}
+
+TEST_F(CpuTest, sbx) {
+  load("SBX #$02");
+  cpu.a = 0x0F;
+  cpu.x = 0x3C;
+  run();
+
+  EXPECT_EQ(cpu.x, 0x0A);
+  EXPECT_TRUE(cpu.flags.carry);
+}
+
+TEST_F(CpuTest, las) {
+  load("LAS $0300,Y");
+  cpu.sp = 0xF0;
+  cpu.y = 0x10;
+  cpu.write(0x0310, 0x3C);
+  size_t cycles = count_cycles([this] { run(); });
+
+  EXPECT_EQ(cpu.a, 0x30);
+  EXPECT_EQ(cpu.x, 0x30);
+  EXPECT_EQ(cpu.sp, 0x30);
+  EXPECT_EQ(cycles, 4);
+}
+
+TEST_F(CpuTest, shx) {
+  load("SHX $0300,Y");
+  cpu.x = 0xFF;
+  cpu.y = 0x10;
+  size_t cycles = count_cycles([this] { run(); });
+
+  EXPECT_EQ(cpu.read(0x0310), 0x04);
+  EXPECT_EQ(cycles, 5);
+}
+
+TEST_F(CpuTest, shx_page_crossing) {
+  load("SHX $03F0,Y");
+  cpu.x = 0x03;
+  cpu.y = 0x20;
+  cpu.write(0x0010, 0xAA);
+  cpu.write(0x0410, 0xAA);
+  run();
+
+  // The stored value, 0x03 & 0x04, replaces the high byte of the address
+  EXPECT_EQ(cpu.read(0x0010), 0x00);
+  EXPECT_EQ(cpu.read(0x0410), 0xAA);
+}
+
+TEST_F(CpuTest, every_opcode_executes) {
+  for (int opc = 0; opc < 0x100; ++opc) {
+    cpu.write(0x8000, opc);
+    cpu.write16(0x8001, 0x0300);
+    cpu.write16(Cpu::kResetVector, 0x8000);
+    cpu.reset();
+    size_t start = cpu.cycles;
+    cpu.step();
+    EXPECT_EQ(cpu.jammed, std::string_view(opcodes[opc].mnemonic) == "JAM")
+        << "opcode " << opc;
+    EXPECT_GE(cpu.cycles - start, opcodes[opc].cycles) << "opcode " << opc;
+  }
+}
+
+TEST_F(CpuTest, jam) {
+  load(
+      "INX \n"
+      "JAM \n"
+      "INX");
+  cpu.run(cpu.cycles + 100);
+  size_t cycles = cpu.cycles;
+
+  EXPECT_TRUE(cpu.jammed);
+  EXPECT_EQ(cpu.pc, 0x8001);
+  EXPECT_EQ(cpu.x, 1);
+
+  // Neither steps nor interrupts do anything until the next reset
+  cpu.interrupts.raise_nmi();
+  cpu.step();
+  cpu.run(cpu.cycles + 100);
+  EXPECT_EQ(cpu.pc, 0x8001);
+  EXPECT_EQ(cpu.cycles, cycles);
+
+  cpu.reset();
+  EXPECT_FALSE(cpu.jammed);
+  EXPECT_EQ(cpu.pc, 0x8000);
+}
+
 }  // namespace nesem
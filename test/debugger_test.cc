@@ -0,0 +1,120 @@
+#include "debugger.h"
+
+#include <gtest/gtest.h>
+
+#include "assembler/assembler.h"
+#include "cartridge.h"
+#include "nes.h"
+
+namespace nesem {
+
+class DebuggerTest : public ::testing::Test {
+ protected:
+  std::unique_ptr<DebugNes> nes;
+
+  // Counts in $10 through a mirror of CPU RAM, and polls the PPU status
+  // through a mirror of the PPU registers
+  static constexpr const char* kProgram =
+      "INC $0810 \n"  // $8000
+      "LDA $3FFA \n"  // $8003
+      "JMP $8000";
+
+  void load(const std::string& code) {
+    Cartridge cartridge;
+    cartridge.write_prg(0x8000, assembler::assemble(code));
+    cartridge.chr.resize(0x2000);
+    nes = std::make_unique<DebugNes>(cartridge);
+    nes->reset();
+  }
+
+  Debugger& debugger() { return nes->mmu.debugger; }
+};
+
+TEST_F(DebuggerTest, breakpoint) {
+  load(kProgram);
+  debugger().add_breakpoint(0x8003);
+
+  for (int i = 1; i <= 3; ++i) {
+    EXPECT_EQ(nes->run_frame(), RunStatus::DebugStop);
+    EXPECT_EQ(nes->cpu.pc, 0x8003);
+    EXPECT_EQ(nes->mmu.wram[0x10], i);
+    EXPECT_EQ(debugger().last_hit.kind, DebugHitKind::Breakpoint);
+    EXPECT_EQ(debugger().last_hit.cycle, nes->cpu.cycles);
+  }
+
+  debugger().remove_breakpoint(0x8003);
+  EXPECT_EQ(nes->run_frame(), RunStatus::FrameCompleted);
+}
+
+TEST_F(DebuggerTest, write_watchpoint_on_mirror) {
+  load(kProgram);
+  debugger().add_watchpoint(0x0010, 0x0010, kWatchWrite);
+
+  EXPECT_EQ(nes->run_frame(), RunStatus::DebugStop);
+  const DebugHit& hit = debugger().last_hit;
+  EXPECT_EQ(hit.kind, DebugHitKind::Write);
+  EXPECT_EQ(hit.addr, 0x0810);
+  EXPECT_EQ(hit.data, 1);
+  EXPECT_EQ(hit.pc, 0x8000);
+  // Stopped once the instruction completed
+  EXPECT_EQ(nes->cpu.pc, 0x8003);
+}
+
+TEST_F(DebuggerTest, zero_page_watchpoint) {
+  load(
+      "INC $10 \n"
+      "JMP $8000");
+  debugger().add_watchpoint(0x0010, 0x0010, kWatchRead);
+
+  EXPECT_EQ(nes->run_frame(), RunStatus::DebugStop);
+  EXPECT_EQ(debugger().last_hit.addr, 0x0010);
+  EXPECT_EQ(debugger().last_hit.pc, 0x8000);
+}
+
+TEST_F(DebuggerTest, ppu_register_watchpoint) {
+  load(kProgram);
+  debugger().add_watchpoint(0x2002, 0x2002, kWatchRead);
+
+  EXPECT_EQ(nes->run_frame(), RunStatus::DebugStop);
+  EXPECT_EQ(debugger().last_hit.kind, DebugHitKind::Read);
+  EXPECT_EQ(debugger().last_hit.addr, 0x3FFA);
+  EXPECT_EQ(debugger().last_hit.pc, 0x8003);
+  EXPECT_EQ(nes->cpu.pc, 0x8006);
+}
+
+TEST_F(DebuggerTest, callback_without_stopping) {
+  load(kProgram);
+  int reads = 0;
+  debugger().on_hit = [&](const DebugHit&) {
+    ++reads;
+    return false;
+  };
+  debugger().add_watchpoint(0x2000, 0x2007, kWatchReadWrite);
+
+  EXPECT_EQ(nes->run_frame(), RunStatus::FrameCompleted);
+  EXPECT_GT(reads, 0);
+  // One read of the status per increment of the counter, except when the
+  // frame ended between the two
+  uint8_t unread = nes->mmu.wram[0x10] - reads;
+  EXPECT_LE(unread, 1);
+}
+
+TEST_F(DebuggerTest, same_state_as_nes) {
+  Cartridge cartridge;
+  cartridge.write_prg(0x8000, assembler::assemble(kProgram));
+  cartridge.chr.resize(0x2000);
+  Nes expected(cartridge);
+  expected.reset();
+  load(kProgram);
+  debugger().add_watchpoint(0x0300, 0x03FF, kWatchWrite);
+
+  for (int frame = 0; frame < 3; ++frame) {
+    EXPECT_EQ(nes->run_frame(), RunStatus::FrameCompleted);
+    expected.run_frame();
+    EXPECT_EQ(nes->cpu.cycles, expected.cpu.cycles);
+    EXPECT_EQ(nes->cpu.pc, expected.cpu.pc);
+    EXPECT_EQ(nes->mmu.wram, expected.mmu.wram);
+  }
+}
+
+}  // namespace nesem
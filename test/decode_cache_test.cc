@@ -0,0 +1,175 @@
+#include "decode_cache.h"
+
+#include <gtest/gtest.h>
+
+#include "assembler/assembler.h"
+#include "cartridge.h"
+#include "cpu.h"
+#include "mmu.h"
+#include "nes.h"
+
+namespace nesem {
+
+class DecodeCacheTest : public ::testing::Test {
+ protected:
+  RamOnlyMmu mmu;
+  Cpu cpu = {&mmu};
+  uint16_t prg_end = -1;
+
+  DecodeCacheTest() { cpu.set_decode_cache_enabled(true); }
+
+  void load(const std::string& code, uint16_t start_pc = 0x8000) {
+    std::vector<uint8_t> prg = assembler::assemble(code);
+    for (int i = 0; i < prg.size(); ++i) cpu.write(start_pc + i, prg[i]);
+    cpu.write16(Cpu::kResetVector, start_pc);
+    prg_end = start_pc + prg.size();
+    cpu.reset();
+  }
+
+  void run() {
+    while (cpu.pc < prg_end) cpu.step();
+  }
+};
+
+TEST_F(DecodeCacheTest, straight_line) {
+  load(
+      "LDA #$05 \n"
+      "TAX \n"
+      "INX \n"
+      "STX $10");
+  run();
+
+  EXPECT_EQ(cpu.a, 0x05);
+  EXPECT_EQ(cpu.x, 0x06);
+  EXPECT_EQ(cpu.read(0x10), 0x06);
+  EXPECT_EQ(cpu.cycles, 7 + 2 + 2 + 2 + 3);
+}
+
+TEST_F(DecodeCacheTest, loop) {
+  load(
+      "LDX #$05 \n"
+      "INY \n"
+      "DEX \n"
+      "BNE $FC");
+  run();
+
+  EXPECT_EQ(cpu.x, 0x00);
+  EXPECT_EQ(cpu.y, 0x05);
+  // 4 taken branches, 1 not taken
+  EXPECT_EQ(cpu.cycles, 7 + 2 + 5 * (2 + 2 + 2) + 4);
+}
+
+TEST_F(DecodeCacheTest, self_modifying_code) {
+  // Overwrite the operand of the following LDA #$01 before it executes
+  load(
+      "LDA #$02 \n"
+      "STA $8006 \n"
+      "LDA #$01");
+  run();
+
+  EXPECT_EQ(cpu.a, 0x02);
+}
+
+TEST_F(DecodeCacheTest, self_modifying_code_in_zero_page) {
+  // Same through a zero page store, which bypasses the bus
+  load(
+      "LDA #$02 \n"
+      "STA $05 \n"
+      "LDA #$01",
+      0x0000);
+  run();
+
+  EXPECT_EQ(cpu.a, 0x02);
+}
+
+TEST(DecodeCacheNesTest, self_modifying_code_through_ram_mirror) {
+  // Code at $0300 overwrites the operand of its LDA #$01 through the mirror
+  // at $0B00, then jumps back over it
+  std::vector<uint8_t> code = assembler::assemble(
+      "LDA #$01 \n"  // $0300
+      "LDX #$02 \n"  // $0302
+      "STX $0B01 \n"
+      "CMP #$01 \n"
+      "BEQ $F5");     // back to $0300 after the first pass
+  NesMmu mmu;
+  NesCpu cpu{&mmu};
+  cpu.set_decode_cache_enabled(true);
+  std::copy(code.begin(), code.end(), mmu.wram.begin() + 0x300);
+  cpu.pc = 0x0300;
+  uint16_t end = 0x0300 + code.size();
+  for (int i = 0; i < 100 && cpu.pc != end; ++i) cpu.step();
+
+  EXPECT_EQ(cpu.pc, end);
+  EXPECT_EQ(cpu.a, 0x02);
+}
+
+TEST(DecodeCacheNesTest, decodes_without_bus_accesses) {
+  // Decoding the block reads ahead of the first instruction, which must not
+  // be seen by the bus, e.g. as a hit of a read watchpoint
+  Cartridge cartridge;
+  cartridge.write_prg(0x8000, assembler::assemble(
+                                  "LDA #$01 \n"
+                                  "NOP \n"  // $8002
+                                  "NOP"));
+  cartridge.chr.resize(0x2000);
+  DebugNes nes{cartridge};
+  nes.cpu.set_decode_cache_enabled(true);
+  nes.mmu.debugger.add_watchpoint(0x8002, 0x8002, kWatchRead);
+  nes.reset();
+  nes.step();
+
+  EXPECT_EQ(nes.cpu.pc, 0x8002);
+  EXPECT_FALSE(nes.mmu.debugger.stopped);
+}
+
+TEST_F(DecodeCacheTest, remap_invalidates) {
+  load("LDA #$01");
+  run();
+  EXPECT_EQ(cpu.a, 0x01);
+
+  // Swap the code behind the cpu's back, as a bank switch would
+  mmu.write(0x8001, 0x02);
+  mmu.remap(0x8000, 0xBFFF);
+  cpu.pc = 0x8000;
+  run();
+  EXPECT_EQ(cpu.a, 0x02);
+}
+
+TEST(DecodeCache, invalidate_overlapping_blocks_only) {
+  DecodeCache cache;
+  cache.insert({0x8000, 0x8010, {}});
+  cache.insert({0x8100, 0x8110, {}});
+  uint32_t generation = cache.generation;
+
+  cache.invalidate(0x8010, 0x8010);
+
+  EXPECT_EQ(cache.find(0x8000), nullptr);
+  EXPECT_NE(cache.find(0x8100), nullptr);
+  EXPECT_FALSE(cache.covers(0x8000));
+  EXPECT_TRUE(cache.covers(0x8100));
+  EXPECT_NE(cache.generation, generation);
+}
+
+TEST(DecodeCache, invalidate_unlinks_predecessors) {
+  DecodeCache cache;
+  DecodedBlock *a = cache.insert({0x8000, 0x8010});
+  DecodedBlock *b = cache.insert({0x8100, 0x8110});
+  DecodedBlock *c = cache.insert({0x0300, 0x0305});
+  cache.link(a, b);
+  cache.link(a, c);
+  cache.link(c, b);
+
+  // Through a mirror of the block in RAM
+  cache.invalidate(0x0B04, 0x0B04);
+
+  EXPECT_EQ(cache.find(0x0300), nullptr);
+  EXPECT_FALSE(cache.covers(0x0300));
+  EXPECT_EQ(a->links[0].block, b);
+  EXPECT_EQ(a->links[1].block, nullptr);
+
+  cache.invalidate(0x8100, 0x8100);
+  EXPECT_EQ(a->links[0].block, nullptr);
+  EXPECT_NE(cache.find(0x8000), nullptr);
+}
+
+}  // namespace nesem
@@ -0,0 +1,89 @@
+// Interpreter dispatch benchmark.
+//
+// Runs the automated nestest.nes run on a cpu bound to a NesMmu, without the
+// PPU, and reports the throughput of the interpreter when stepping one
+// instruction at a time and when running to a cycle limit with
+// BasicCpu::run. The latter uses threaded dispatch in builds configured with
+// NESEM_THREADED_DISPATCH.
+//
+// Usage: dispatch_bench [iterations]
+
+#include <fmt/core.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+
+#include "cartridge.h"
+#include "cpu.h"
+#include "mmu.h"
+
+const std::filesystem::path kTestDir{TEST_DIR};
+const std::filesystem::path kNestestPath = kTestDir / "nestest.nes";
+
+// Number of cycles taken by the automated run
+constexpr size_t kNestestCycles = 26560;
+
+template <typename Run>
+double bench(const nesem::Cartridge &cartridge, int iterations, Run run,
+             size_t *instructions) {
+  std::chrono::steady_clock::duration elapsed{};
+  for (int i = 0; i < iterations; ++i) {
+    nesem::NesMmu mmu{cartridge};
+    nesem::NesCpu cpu{&mmu};
+    cpu.reset();
+    cpu.pc = 0xC000;
+
+    auto start = std::chrono::steady_clock::now();
+    *instructions += run(&cpu);
+    elapsed += std::chrono::steady_clock::now() - start;
+  }
+  return std::chrono::duration<double>(elapsed).count();
+}
+
+int main(int argc, char **argv) {
+  int iterations = argc > 1 ? atoi(argv[1]) : 2000;
+
+  std::fstream fs{kNestestPath};
+  nesem::Cartridge cartridge;
+  try {
+    cartridge = nesem::load_ines_rom_dump(&fs);
+  } catch (const std::exception &e) {
+    fmt::print(stderr, "Failed to load ines file {}: {}\n",
+               kNestestPath.string(), e.what());
+    return 1;
+  }
+
+  // Count the instructions of a run once, since run() does not
+  size_t run_instructions = 0;
+  {
+    nesem::NesMmu mmu{cartridge};
+    nesem::NesCpu cpu{&mmu};
+    cpu.reset();
+    cpu.pc = 0xC000;
+    for (; cpu.cycles < kNestestCycles; ++run_instructions) cpu.step();
+  }
+
+  size_t instructions = 0;
+  double step_seconds =
+      bench(cartridge, iterations, [](nesem::NesCpu *cpu) {
+        size_t n = 0;
+        for (; cpu->cycles < kNestestCycles; ++n) cpu->step();
+        return n;
+      }, &instructions);
+  double run_seconds =
+      bench(cartridge, iterations, [&](nesem::NesCpu *cpu) {
+        cpu->run(kNestestCycles);
+        return run_instructions;
+      }, &instructions);
+
+  fmt::print("{} dispatch, {} instructions per method\n",
+             nesem::kThreadedDispatch ? "threaded" : "table",
+             instructions / 2);
+  fmt::print("{:<8} {:.3f}s  {:.2f} M instructions/s\n", "step",
+             step_seconds, instructions / 2 / step_seconds / 1e6);
+  fmt::print("{:<8} {:.3f}s  {:.2f} M instructions/s\n", "run", run_seconds,
+             instructions / 2 / run_seconds / 1e6);
+  return 0;
+}
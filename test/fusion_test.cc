@@ -0,0 +1,154 @@
+#include "fusion.h"
+
+#include <gtest/gtest.h>
+
+#include "assembler/assembler.h"
+#include "cpu.h"
+#include "lockstep.h"
+
+namespace nesem {
+
+// Runs the same program with and without fused instructions, and compares
+// the resulting states
+class FusionTest : public ::testing::Test {
+ protected:
+  RamOnlyMmu expected_mmu;
+  RamOnlyMmu actual_mmu;
+  Cpu expected = {&expected_mmu};
+  Cpu actual = {&actual_mmu};
+  uint16_t prg_end = -1;
+
+  FusionTest() { actual.set_fusion_enabled(true); }
+
+  void load(const std::string& code, uint16_t start_pc = 0x8000) {
+    std::vector<uint8_t> prg = assembler::assemble(code);
+    for (Cpu* cpu : {&expected, &actual}) {
+      for (int i = 0; i < prg.size(); ++i) cpu->write(start_pc + i, prg[i]);
+      cpu->write16(Cpu::kResetVector, start_pc);
+      cpu->reset();
+    }
+    prg_end = start_pc + prg.size();
+  }
+
+  void run() {
+    while (expected.pc < prg_end) expected.step();
+    while (actual.pc < prg_end) actual.step();
+  }
+
+  void expect_same_state() {
+    expect_same_cpu(actual, expected);
+    if (HasFatalFailure()) return;
+    for (uint16_t addr = 0; addr < 0x800; ++addr)
+      EXPECT_EQ(actual.read(addr), expected.read(addr)) << addr;
+  }
+
+  uint64_t hits(FusedIdiom idiom) {
+    return actual.fusion_hits[static_cast<size_t>(idiom)];
+  }
+};
+
+TEST_F(FusionTest, lda_sta) {
+  load(
+      "LDA #$05 \n"
+      "STA $10 \n"
+      "LDA $10 \n"
+      "STA $0200 \n"
+      "LDX #$03 \n"
+      "LDA $0200 \n"
+      "STA $20,X");
+  run();
+
+  expect_same_state();
+  EXPECT_EQ(hits(FusedIdiom::LdaSta), 3);
+}
+
+TEST_F(FusionTest, dex_bne) {
+  load(
+      "LDX #$08 \n"
+      "INC $10 \n"
+      "DEX \n"
+      "BNE $FB");
+  run();
+
+  expect_same_state();
+  EXPECT_EQ(hits(FusedIdiom::DexBne), 8);
+}
+
+TEST_F(FusionTest, iny_cpy_bne) {
+  load(
+      "LDA #$03 \n"
+      "STA $10 \n"
+      "LDY #$00 \n"
+      "INC $0300 \n"
+      "INY \n"
+      "CPY $10 \n"
+      "BNE $F8 \n"
+      "INY \n"
+      "CPY #$08 \n"
+      "BNE $FB");
+  run();
+
+  expect_same_state();
+  EXPECT_EQ(hits(FusedIdiom::InyCpyBne), 8);
+}
+
+TEST_F(FusionTest, cmp_beq) {
+  load(
+      "LDA #$02 \n"
+      "CMP #$01 \n"
+      "BEQ $02 \n"
+      "CMP #$02 \n"
+      "BEQ $00");
+  run();
+
+  expect_same_state();
+  EXPECT_EQ(hits(FusedIdiom::CmpBeq), 2);
+}
+
+TEST_F(FusionTest, registers_are_not_accessed_within_sequence) {
+  load(
+      "LDA #$05 \n"
+      "STA $2000 \n"
+      "LDY #$00 \n"
+      "INY \n"
+      "CPY $4016 \n"
+      "BNE $00");
+  run();
+
+  expect_same_state();
+  EXPECT_EQ(hits(FusedIdiom::LdaSta), 0);
+  EXPECT_EQ(hits(FusedIdiom::InyCpyBne), 0);
+}
+
+TEST_F(FusionTest, stops_at_cycle_limit) {
+  load(
+      "LDA #$05 \n"
+      "STA $10");
+  actual.fusion_cycle_limit = actual.cycles + 1;
+  actual.step();
+
+  EXPECT_EQ(actual.pc, 0x8002);
+  EXPECT_EQ(actual.a, 0x05);
+  actual.step();
+  EXPECT_EQ(actual.pc, 0x8004);
+  EXPECT_EQ(actual.read(0x10), 0x05);
+  EXPECT_EQ(hits(FusedIdiom::LdaSta), 0);
+
+  run();
+  expect_same_state();
+}
+
+TEST_F(FusionTest, runs_sequence_in_one_step) {
+  load(
+      "LDX #$02 \n"
+      "DEX \n"
+      "BNE $FD");
+  actual.step();
+  actual.step();
+
+  EXPECT_EQ(actual.x, 0x01);
+  EXPECT_EQ(actual.pc, 0x8002);
+  EXPECT_EQ(actual.cycles, 7 + 2 + 2 + 3);
+}
+
+}  // namespace nesem
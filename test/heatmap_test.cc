@@ -0,0 +1,92 @@
+#include "heatmap.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+
+#include "assembler/assembler.h"
+#include "cartridge.h"
+#include "nes.h"
+
+namespace nesem {
+
+TEST(HeatmapTest, dump_csv) {
+  AccessHeatmap heatmap;
+  heatmap.cpu_pages[0x00] = {3, 1, 0};
+  heatmap.cpu_pages[0x80] = {5, 0, 7};
+  heatmap.ppu_pages[0x20] = {0, 2, 0};
+
+  EXPECT_EQ(heatmap.dump_csv(),
+            "space,page,reads,writes,executions\n"
+            "cpu,0000,3,1,0\n"
+            "cpu,8000,5,0,7\n"
+            "ppu,2000,0,2,0\n");
+}
+
+TEST(HeatmapTest, dump_json) {
+  AccessHeatmap heatmap;
+  heatmap.cpu_pages[0x80] = {5, 0, 7};
+  heatmap.ppu_pages[0x3F] = {1, 2, 0};
+
+  EXPECT_EQ(heatmap.dump_json(),
+            "{\"cpu\":["
+            "{\"page\":\"8000\",\"reads\":5,\"writes\":0,\"executions\":7}],"
+            "\"ppu\":["
+            "{\"page\":\"3F00\",\"reads\":1,\"writes\":2,\"executions\":0}]}");
+}
+
+TEST(HeatmapTest, dump_png) {
+  AccessHeatmap heatmap;
+  heatmap.cpu_pages[0x00].reads = 100;
+  std::vector<uint8_t> png = heatmap.dump_png();
+
+  const uint8_t signature[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+  ASSERT_GT(png.size(), 33);
+  EXPECT_TRUE(std::equal(std::begin(signature), std::end(signature),
+                         png.begin()));
+  EXPECT_EQ(std::string(png.begin() + 12, png.begin() + 16), "IHDR");
+  uint32_t width = (png[16] << 24) | (png[17] << 16) | (png[18] << 8) | png[19];
+  uint32_t height = (png[20] << 24) | (png[21] << 16) | (png[22] << 8) | png[23];
+  EXPECT_EQ(width, 400);
+  EXPECT_EQ(height, 168);
+  EXPECT_EQ(std::string(png.end() - 8, png.end() - 4), "IEND");
+
+  // The first block of image data starts with the top left pixel, of the
+  // hottest page: white, after the zlib header, the block header and the
+  // filter type of the row
+  size_t idat = std::search(png.begin(), png.end(), "IDAT", "IDAT" + 4) -
+                png.begin();
+  ASSERT_LT(idat, png.size());
+  const uint8_t *pixel = &png[idat + 4 + 2 + 5 + 1];
+  EXPECT_EQ(pixel[0], 255);
+  EXPECT_EQ(pixel[1], 255);
+  EXPECT_EQ(pixel[2], 255);
+}
+
+TEST(HeatmapTest, counts_accesses) {
+  Cartridge cartridge;
+  cartridge.write_prg(0x8000, assembler::assemble(
+                                  "LDA #$3F \n"
+                                  "STA $2006 \n"
+                                  "LDA #$00 \n"
+                                  "STA $2006 \n"
+                                  "STA $2007 \n"
+                                  "STA $10 \n"
+                                  "LDA $0300"));
+  cartridge.chr.resize(0x2000);
+  Nes nes{cartridge};
+  if (!nes.mmu.set_heatmap_enabled(true)) GTEST_SKIP() << "NESEM_HEATMAP off";
+  nes.reset();
+  nes.mmu.heatmap->clear();
+  for (int i = 0; i < 7; ++i) nes.step();
+
+  const AccessHeatmap &heatmap = *nes.mmu.heatmap;
+  EXPECT_EQ(heatmap.cpu_pages[0x80].executions, 7);
+  EXPECT_EQ(heatmap.cpu_pages[0x20].writes, 3);
+  EXPECT_EQ(heatmap.cpu_pages[0x00].writes, 1);
+  EXPECT_EQ(heatmap.cpu_pages[0x03].reads, 1);
+  EXPECT_EQ(heatmap.ppu_pages[0x3F].writes, 1);
+  EXPECT_EQ(heatmap.ppu_pages[0x3F].reads, 0);
+}
+
+}  // namespace nesem
@@ -0,0 +1,113 @@
+#include "idle_loop.h"
+
+#include <gtest/gtest.h>
+
+#include "assembler/assembler.h"
+#include "cartridge.h"
+#include "lockstep.h"
+#include "nes.h"
+#include "test_cartridge.h"
+
+namespace nesem {
+
+// Runs the same program with and without skipping idle loops, and compares
+// the states whenever both have run for the same number of cycles
+class IdleLoopTest : public LockstepTest {
+ protected:
+  // Number of cycles in a frame, rounded up
+  static constexpr size_t kFrameCycles = 29781;
+
+  // Load the program at $8000, with an NMI handler counting NMIs in $11
+  void load(const std::string& code) {
+    LockstepTest::load(make_program_cartridge_with_nmi(code));
+    actual->idle_loop_skip = true;
+  }
+
+  void run_frames(size_t frames) {
+    while (actual->cpu.cycles < frames * kFrameCycles) {
+      actual->step();
+      while (expected->cpu.cycles < actual->cpu.cycles) expected->step();
+      expect_same_state();
+      if (HasFailure()) return;
+    }
+  }
+};
+
+TEST_F(IdleLoopTest, find_idle_loop) {
+  Cartridge cartridge;
+  cartridge.write_prg(0x8000, assembler::assemble(
+                                  "LDA $2002 \n"  // $8000
+                                  "BPL $FB \n"
+                                  "BIT $200A \n"  // $8005
+                                  "BPL $FB \n"
+                                  "LDA $2002 \n"  // $800A
+                                  "BMI $FB \n"
+                                  "LDA $2003 \n"  // $800F
+                                  "BPL $FB \n"
+                                  "JMP $8014 \n"  // $8014
+                                  "JMP $8000"));  // $8017
+  NesMmu mmu{cartridge};
+
+  EXPECT_EQ(find_idle_loop(mmu, 0x8000).kind, IdleLoopKind::LdaPpuStatusBpl);
+  EXPECT_EQ(find_idle_loop(mmu, 0x8000).cycles, 7);
+  EXPECT_EQ(find_idle_loop(mmu, 0x8005).kind, IdleLoopKind::BitPpuStatusBpl);
+  EXPECT_FALSE(find_idle_loop(mmu, 0x800A));
+  EXPECT_FALSE(find_idle_loop(mmu, 0x800F));
+  EXPECT_EQ(find_idle_loop(mmu, 0x8014).kind, IdleLoopKind::JmpSelf);
+  EXPECT_EQ(find_idle_loop(mmu, 0x8014).cycles, 3);
+  EXPECT_FALSE(find_idle_loop(mmu, 0x8017));
+}
+
+TEST_F(IdleLoopTest, lda_ppu_status_bpl) {
+  load(
+      "       LDA $2002 \n"
+      "       BPL $FB \n"
+      "       INC $10 \n"
+      "       JMP $8000");
+  run_frames(4);
+
+  EXPECT_EQ(actual->mmu.wram[0x10], 4);
+  EXPECT_GT(actual->idle_cycles_skipped, 3 * kFrameCycles * 9 / 10);
+}
+
+TEST_F(IdleLoopTest, bit_ppu_status_bpl_with_nmi) {
+  load(
+      "       LDA #$80 \n"
+      "       STA $2000 \n"
+      "       LDA #$40 \n"
+      "       BIT $2002 \n"  // $8007
+      "       BPL $FB \n"
+      "       INC $10 \n"
+      "       JMP $8007");
+  run_frames(4);
+
+  EXPECT_EQ(actual->mmu.wram[0x11], 4);
+  EXPECT_GT(actual->idle_cycles_skipped, 0);
+}
+
+TEST_F(IdleLoopTest, jmp_self_with_nmi) {
+  load(
+      "       LDA #$80 \n"
+      "       STA $2000 \n"
+      "       JMP $8005");  // $8005
+  run_frames(4);
+
+  EXPECT_EQ(actual->mmu.wram[0x11], 4);
+  EXPECT_GT(actual->idle_cycles_skipped, 3 * kFrameCycles * 9 / 10);
+}
+
+TEST_F(IdleLoopTest, page_crossing_loop) {
+  std::string code = "JMP $80FD \n";
+  for (int addr = 0x8003; addr < 0x80FD; ++addr) code += "NOP \n";
+  // LDA $2002; BPL straddling $8100
+  load(code +
+       "LDA $2002 \n"
+       "BPL $FB \n"
+       "JMP $80FD");
+  EXPECT_EQ(find_idle_loop(actual->mmu, 0x80FD).cycles, 8);
+  run_frames(3);
+
+  EXPECT_GT(actual->idle_cycles_skipped, 0);
+}
+
+}  // namespace nesem
@@ -74,11 +74,19 @@ TEST(InesTest, fail_invalid_header) {
 
 TEST(InesTest, fail_unsupported_mapper) {
   std::stringstream ss;
-  Input input = {.mapperType = 0x01};
+  Input input = {.mapperType = 0x05};
   prepare(&ss, input);
   EXPECT_ANY_THROW(load_ines_rom_dump(&ss));
 }
 
+TEST(InesTest, supported_mapper) {
+  std::stringstream ss;
+  Input input = {.mapperType = 0x01};
+  prepare(&ss, input);
+  Cartridge c = load_ines_rom_dump(&ss);
+  ASSERT_EQ(c.mapper, 0x01);
+}
+
 TEST(InesTest, fail_ines_ver_2) {
   std::stringstream ss;
   Input input = {.inesVer = INES_VER_2};
@@ -102,6 +110,14 @@ TEST(InesTest, fourscreen_mirroring) {
   ASSERT_EQ(c.mirroring, ScreenMirroring::FourScreen);
 }
 
+TEST(InesTest, battery) {
+  std::stringstream ss;
+  Input input = {.batteryRam = true};
+  prepare(&ss, input);
+  Cartridge c = load_ines_rom_dump(&ss);
+  ASSERT_TRUE(c.battery);
+}
+
 TEST(InesTest, fail_read_prg) {
   std::stringstream ss;
   Input input = {.numRomBanks = 1, .prg = {0x10}};
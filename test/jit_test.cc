@@ -0,0 +1,160 @@
+#include "jit.h"
+
+#include <gtest/gtest.h>
+
+#include "assembler/assembler.h"
+#include "lockstep.h"
+#include "nes.h"
+#include "test_cartridge.h"
+
+namespace nesem {
+
+// Runs the same program on the interpreter and with compiled code, and
+// compares the resulting states
+class JitTest : public LockstepTest {
+ protected:
+  uint16_t prg_end = -1;
+
+  void load(const std::string& code) {
+    LockstepTest::load(make_program_cartridge(code));
+    actual->set_jit_enabled(true, 1);
+    if (!actual->jit->supported()) GTEST_SKIP() << "jit not supported";
+    prg_end = 0x8000 + assembler::assemble(code).size();
+  }
+
+  void run() {
+    while (expected->cpu.pc < prg_end) expected->step();
+    while (actual->cpu.pc < prg_end) actual->step();
+  }
+};
+
+TEST_F(JitTest, runs_compiled_code) {
+  load(
+      "LDA #$05 \n"
+      "TAX \n"
+      "INX \n"
+      "STX $10");
+  if (IsSkipped()) return;
+
+  EXPECT_TRUE(actual->jit->run(&actual->cpu, 1000));
+  EXPECT_EQ(actual->cpu.pc, prg_end);
+  // Running compiled code directly leaves the PPU behind
+  actual->mmu.sync_ppu();
+  run();
+  expect_same_state();
+}
+
+TEST_F(JitTest, arithmetic) {
+  load(
+      "LDX #$20 \n"
+      "CLC \n"
+      "LDA #$00 \n"
+      "ADC #$37 \n"  // loop
+      "STA $10 \n"
+      "SBC #$11 \n"
+      "EOR $10 \n"
+      "ORA #$01 \n"
+      "AND #$F7 \n"
+      "CMP #$40 \n"
+      "BIT $10 \n"
+      "ROL \n"
+      "ROR $10 \n"
+      "ASL $10 \n"
+      "LSR \n"
+      "INC $10 \n"
+      "DEC $11 \n"
+      "PHP \n"
+      "CPX #$08 \n"
+      "DEX \n"
+      "BNE $E0");
+  if (IsSkipped()) return;
+
+  run();
+  expect_same_state();
+}
+
+TEST_F(JitTest, addressing_modes) {
+  load(
+      "LDA #$00 \n"
+      "STA $20 \n"
+      "LDA #$03 \n"
+      "STA $21 \n"
+      "LDY #$F0 \n"
+      "LDX #$10 \n"
+      "TYA \n"  // loop
+      "STA $40,X \n"
+      "STA $02F8,X \n"
+      "STA ($20),Y \n"
+      "STA ($10,X) \n"
+      "LDA $80F0,Y \n"
+      "ADC $40,X \n"
+      "STA $0100,Y \n"
+      "INY \n"
+      "DEX \n"
+      "BNE $EA");
+  if (IsSkipped()) return;
+
+  run();
+  expect_same_state();
+}
+
+TEST_F(JitTest, subroutines) {
+  load(
+      "LDX #$03 \n"
+      "JSR $800B \n"
+      "DEX \n"
+      "BNE $FA \n"
+      "JMP $800F \n"
+      "PHA \n"
+      "PLA \n"
+      "INY \n"
+      "RTS");
+  if (IsSkipped()) return;
+
+  run();
+  expect_same_state();
+}
+
+TEST_F(JitTest, io_registers_are_left_to_interpreter) {
+  load(
+      "LDX #$F8 \n"
+      "LDA $1F10,X \n"  // reads $2008
+      "STA $10 \n"
+      "LDA #$80 \n"
+      "STA $2000 \n"
+      "LDA $2002");
+  if (IsSkipped()) return;
+
+  run();
+  expect_same_state();
+}
+
+// Rewrite the operand of a routine in RAM before each call, while the
+// interpreter runs it from its decode cache
+TEST_F(JitTest, self_modifying_code_with_decode_cache) {
+  for (bool fusion : {false, true}) {
+    load(
+        "LDA #$A9 \n"
+        "STA $0300 \n"
+        "LDA #$60 \n"
+        "STA $0302 \n"
+        "LDX #$00 \n"
+        "STX $0301 \n"  // loop
+        "INC $0301 \n"
+        "JSR $0300 \n"
+        "STA $0400,X \n"
+        "INX \n"
+        "BNE $F1");
+    if (IsSkipped()) return;
+    if (fusion)
+      actual->cpu.set_fusion_enabled(true);
+    else
+      actual->cpu.set_decode_cache_enabled(true);
+
+    run();
+    expect_same_state();
+    EXPECT_EQ(actual->mmu.wram[0x4FF], 0x00);
+  }
+}
+
+}  // namespace nesem
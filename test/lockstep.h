@@ -0,0 +1,58 @@
+// Lockstep comparison of two runs of the same program, one of them with the
+// feature under test enabled (compiled code, fused instructions, skipped
+// idle loops, batched runs)
+
+#pragma once
+
+#include <gtest/gtest.h>
+
+#include <memory>
+
+#include "cartridge.h"
+#include "cpu.h"
+#include "nes.h"
+
+namespace nesem {
+
+// Expect the cpus to have run for the same number of cycles, and to have the
+// same registers, flags and pending interrupts
+inline void expect_same_cpu(const CpuState& actual, const CpuState& expected) {
+  ASSERT_EQ(actual.cycles, expected.cycles);
+  EXPECT_EQ(actual.pc, expected.pc);
+  EXPECT_EQ(actual.a, expected.a);
+  EXPECT_EQ(actual.x, expected.x);
+  EXPECT_EQ(actual.y, expected.y);
+  EXPECT_EQ(actual.sp, expected.sp);
+  EXPECT_EQ(actual.flags.bits(), expected.flags.bits());
+  EXPECT_EQ(actual.interrupts.word, expected.interrupts.word);
+}
+
+// Same, and expect the PPUs to be at the same dot with the same status, and
+// CPU RAM to hold the same bytes
+inline void expect_same_state(const Nes& actual, const Nes& expected) {
+  expect_same_cpu(actual.cpu, expected.cpu);
+  if (::testing::Test::HasFatalFailure()) return;
+  EXPECT_EQ(actual.mmu.ppu.scanline, expected.mmu.ppu.scanline);
+  EXPECT_EQ(actual.mmu.ppu.cycle, expected.mmu.ppu.cycle);
+  EXPECT_EQ(actual.mmu.ppu.status(), expected.mmu.ppu.status());
+  EXPECT_EQ(actual.mmu.wram, expected.mmu.wram);
+}
+
+// Runs a cartridge on two NES: expected as the reference, and actual with
+// the feature under test, enabled by the fixture after load
+class LockstepTest : public ::testing::Test {
+ protected:
+  std::unique_ptr<Nes> expected;
+  std::unique_ptr<Nes> actual;
+
+  void load(const Cartridge& cartridge) {
+    expected = std::make_unique<Nes>(cartridge);
+    actual = std::make_unique<Nes>(cartridge);
+    expected->reset();
+    actual->reset();
+  }
+
+  void expect_same_state() { nesem::expect_same_state(*actual, *expected); }
+};
+
+}  // namespace nesem
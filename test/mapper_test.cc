@@ -0,0 +1,263 @@
+#include "mapper.h"
+
+#include <gtest/gtest.h>
+
+#include "assembler/assembler.h"
+#include "mmu.h"
+#include "nes.h"
+#include "test_cartridge.h"
+
+namespace nesem {
+
+// Write a register of an MMC1, one bit at a time
+static void mmc1_write(NesMmu *mmu, uint16_t addr, uint8_t data) {
+  for (int bit = 0; bit < 5; ++bit) mmu->write(addr, (data >> bit) & 1);
+}
+
+TEST(MapperTest, unsupported) {
+  EXPECT_FALSE(mapper_supported(5));
+  EXPECT_ANY_THROW(make_mapper(make_cartridge(5, 2, 2)));
+}
+
+TEST(MapperTest, nrom_rejects_writes) {
+  NesMmu mmu{make_cartridge(0, 1, 2)};
+  EXPECT_EQ(mmu.read(0xC000), 0);
+  EXPECT_ANY_THROW(mmu.write(0x8000, 0x01));
+}
+
+TEST(MapperTest, uxrom) {
+  NesMmu mmu{make_cartridge(2, 8, 0)};
+  EXPECT_EQ(mmu.read(0x8000), 0);
+  EXPECT_EQ(mmu.read(0xC000), 7);
+
+  uint32_t remaps = mmu.remap_count;
+  mmu.write(0x8000, 5);
+  EXPECT_EQ(mmu.read(0x8000), 5);
+  EXPECT_EQ(mmu.read(0xBFFF), 5);
+  EXPECT_EQ(mmu.read(0xFFFF), 7);
+  EXPECT_EQ(mmu.remap_count, remaps + 1);
+  EXPECT_EQ(mmu.last_remap_lo, 0x8000);
+  EXPECT_EQ(mmu.last_remap_hi, 0xFFFF);
+}
+
+TEST(MapperTest, uxrom_chr_ram) {
+  NesMmu mmu{make_cartridge(2, 2, 0)};
+  mmu.write(0x2006, 0x01);
+  mmu.write(0x2006, 0x23);
+  mmu.write(0x2007, 0x45);
+  EXPECT_EQ(mmu.ppu.chr_at(0x0123), 0x45);
+}
+
+TEST(MapperTest, cnrom) {
+  NesMmu mmu{make_cartridge(3, 2, 8)};
+  EXPECT_EQ(mmu.ppu.chr_at(0x1000), 1);
+
+  uint32_t remaps = mmu.remap_count;
+  mmu.write(0x8000, 2);
+  EXPECT_EQ(mmu.ppu.chr_at(0x0000), 4);
+  EXPECT_EQ(mmu.ppu.chr_at(0x1FFF), 5);
+  // PRG ROM is left as is
+  EXPECT_EQ(mmu.remap_count, remaps);
+}
+
+TEST(MapperTest, axrom) {
+  NesMmu mmu{make_cartridge(7, 8, 0)};
+  EXPECT_EQ(mmu.read(0x8000), 0);
+  EXPECT_EQ(mmu.read(0xC000), 1);
+  EXPECT_EQ(mmu.ppu.mirroring, ScreenMirroring::SingleScreenLower);
+
+  mmu.write(0x8000, 0x12);
+  EXPECT_EQ(mmu.read(0x8000), 4);
+  EXPECT_EQ(mmu.read(0xFFFF), 5);
+  EXPECT_EQ(mmu.ppu.mirroring, ScreenMirroring::SingleScreenUpper);
+  EXPECT_EQ(mmu.ppu.vram_offset(0x2000), 0x400);
+  EXPECT_EQ(mmu.ppu.vram_offset(0x2C05), 0x405);
+}
+
+TEST(MapperTest, mmc1_prg_banks) {
+  NesMmu mmu{make_cartridge(1, 8, 2)};
+  // Powers up with the last bank fixed at $C000
+  EXPECT_EQ(mmu.read(0xC000), 7);
+
+  mmc1_write(&mmu, 0xE000, 3);
+  EXPECT_EQ(mmu.read(0x8000), 3);
+  EXPECT_EQ(mmu.read(0xC000), 7);
+
+  // First bank fixed at $8000
+  mmc1_write(&mmu, 0x8000, 0b01000);
+  EXPECT_EQ(mmu.read(0x8000), 0);
+  EXPECT_EQ(mmu.read(0xC000), 3);
+
+  // 32KB banks, ignoring the low bit of the bank number
+  mmc1_write(&mmu, 0x8000, 0b00000);
+  mmc1_write(&mmu, 0xE000, 5);
+  EXPECT_EQ(mmu.read(0x8000), 4);
+  EXPECT_EQ(mmu.read(0xC000), 5);
+}
+
+TEST(MapperTest, mmc1_reset) {
+  NesMmu mmu{make_cartridge(1, 8, 2)};
+  mmc1_write(&mmu, 0x8000, 0b01000);
+  EXPECT_EQ(mmu.read(0x8000), 0);
+
+  // Writing bit 7 drops the bits written so far, and fixes the last bank at
+  // $C000 again
+  mmu.write(0x8000, 1);
+  mmu.write(0x8000, 0x80);
+  EXPECT_EQ(mmu.read(0xC000), 7);
+  mmc1_write(&mmu, 0xE000, 2);
+  EXPECT_EQ(mmu.read(0x8000), 2);
+}
+
+TEST(MapperTest, mmc1_chr_banks_and_mirroring) {
+  NesMmu mmu{make_cartridge(1, 2, 8)};
+
+  // Two 4KB banks, horizontal mirroring
+  mmc1_write(&mmu, 0x8000, 0b11111);
+  mmc1_write(&mmu, 0xA000, 5);
+  mmc1_write(&mmu, 0xC000, 2);
+  EXPECT_EQ(mmu.ppu.chr_at(0x0000), 5);
+  EXPECT_EQ(mmu.ppu.chr_at(0x1000), 2);
+  EXPECT_EQ(mmu.ppu.mirroring, ScreenMirroring::Horizontal);
+  EXPECT_EQ(mmu.ppu.vram_offset(0x2400), 0x000);
+  EXPECT_EQ(mmu.ppu.vram_offset(0x2800), 0x400);
+
+  // One 8KB bank, single-screen mirroring
+  mmc1_write(&mmu, 0x8000, 0b01101);
+  EXPECT_EQ(mmu.ppu.chr_at(0x0000), 4);
+  EXPECT_EQ(mmu.ppu.chr_at(0x1000), 5);
+  EXPECT_EQ(mmu.ppu.mirroring, ScreenMirroring::SingleScreenUpper);
+}
+
+TEST(MapperTest, mmc3_banks) {
+  NesMmu mmu{make_cartridge(4, 4, 8)};
+  // 16KB PRG banks are 8KB banks 2n and 2n + 1
+  EXPECT_EQ(mmu.read(0xC000), 3);
+  EXPECT_EQ(mmu.read(0xE000), 3);
+
+  mmu.write(0x8000, 6);
+  mmu.write(0x8001, 2);  // R6
+  mmu.write(0x8000, 7);
+  mmu.write(0x8001, 4);  // R7
+  EXPECT_EQ(mmu.read(0x8000), 1);
+  EXPECT_EQ(mmu.read(0xA000), 2);
+
+  // PRG mode 1 swaps $8000 and $C000
+  mmu.write(0x8000, 0x40);
+  EXPECT_EQ(mmu.read(0x8000), 3);
+  EXPECT_EQ(mmu.read(0xC000), 1);
+
+  // CHR banks of 1KB, in units of 4KB here
+  mmu.write(0x8000, 0);
+  mmu.write(0x8001, 8);   // R0: 2KB at $0000
+  mmu.write(0x8000, 2);
+  mmu.write(0x8001, 20);  // R2: 1KB at $1000
+  EXPECT_EQ(mmu.ppu.chr_at(0x0000), 2);
+  EXPECT_EQ(mmu.ppu.chr_at(0x1000), 5);
+
+  // CHR mode 1 swaps the halves
+  mmu.write(0x8000, 0x80);
+  EXPECT_EQ(mmu.ppu.chr_at(0x1000), 2);
+  EXPECT_EQ(mmu.ppu.chr_at(0x0000), 5);
+
+  mmu.write(0xA000, 1);
+  EXPECT_EQ(mmu.ppu.mirroring, ScreenMirroring::Horizontal);
+}
+
+// Configure the PPU and the counter of an MMC3, in vblank
+static void mmc3_setup(NesMmu *mmu, uint8_t ctrl, uint8_t latch) {
+  mmu->ppu.tick(341 * 241 + 10);
+  mmu->write(0x2000, ctrl);
+  mmu->write(0x2001, 0x18);
+  mmu->write(0xC000, latch);
+  mmu->write(0xC001, 0);
+  mmu->write(0xE001, 0);
+}
+
+// Smallest number of PPU cycles after which the mapper asserts its IRQ,
+// clocking its counter
+static size_t cycles_until_irq(const NesMmu &mmu, size_t max_cycles) {
+  for (size_t cycles = 1; cycles <= max_cycles; ++cycles) {
+    std::unique_ptr<Mapper> mapper = mmu.mapper->clone();
+    mapper->ppu_tick(mmu.ppu, cycles);
+    if (mapper->irq) return cycles;
+  }
+  return SIZE_MAX;
+}
+
+TEST(MapperTest, mmc3_predicted_irq) {
+  // Sprites at $1000, or background at $1000
+  for (uint8_t ctrl : {0x08, 0x10, 0x20}) {
+    for (uint8_t latch : {0, 1, 30, 250}) {
+      NesMmu mmu{make_cartridge(4, 4, 8)};
+      mmc3_setup(&mmu, ctrl, latch);
+      size_t predicted = mmu.mapper->ppu_cycles_until_irq(mmu.ppu);
+      EXPECT_EQ(predicted, cycles_until_irq(mmu, 2 * 262 * 341))
+          << int(ctrl) << " " << int(latch);
+    }
+  }
+}
+
+TEST(MapperTest, mmc3_no_irq_without_rendering) {
+  NesMmu mmu{make_cartridge(4, 4, 8)};
+  mmc3_setup(&mmu, 0x08, 10);
+  mmu.write(0x2001, 0);
+  EXPECT_EQ(mmu.mapper->ppu_cycles_until_irq(mmu.ppu), SIZE_MAX);
+  mmu.mapper->ppu_tick(mmu.ppu, 262 * 341);
+  EXPECT_FALSE(mmu.mapper->irq);
+}
+
+// Raises an IRQ every 33 scanlines, from scanline 31
+TEST(MapperTest, mmc3_irq_scanlines) {
+  Cartridge cartridge = make_cartridge(4, 2, 2);
+  std::vector<uint8_t> code = assembler::assemble(
+      "LDA $2002 \n"
+      "BPL $FB \n"
+      "LDA #$08 \n"  // sprites at $1000
+      "STA $2000 \n"
+      "LDA #$18 \n"
+      "STA $2001 \n"
+      "LDA #$20 \n"
+      "STA $C000 \n"
+      "STA $C001 \n"
+      "STA $E001 \n"
+      "CLI \n"
+      "JMP $E01B");  // $E01B
+  std::copy(code.begin(), code.end(), cartridge.prg.begin() + 0x6000);
+  // IRQ handler acknowledging the IRQ, and enabling the next one
+  std::vector<uint8_t> irq = assembler::assemble(
+      "STA $E000 \n"
+      "STA $E001 \n"
+      "RTI");
+  std::copy(irq.begin(), irq.end(), cartridge.prg.begin() + 0x6100);
+  cartridge.prg[0x7FFC] = 0x00;
+  cartridge.prg[0x7FFD] = 0xE0;
+  cartridge.prg[0x7FFE] = 0x00;
+  cartridge.prg[0x7FFF] = 0xE1;
+
+  DebugNes nes(cartridge);
+  nes.reset();
+  nes.mmu.debugger.add_breakpoint(0xE100);
+  std::vector<uint16_t> scanlines;
+  for (int frame = 0; frame < 4 && scanlines.size() < 3;) {
+    RunStatus status = nes.run_frame();
+    if (status == RunStatus::DebugStop)
+      scanlines.push_back(nes.mmu.ppu.scanline);
+    else
+      ++frame;
+  }
+  EXPECT_EQ(scanlines, (std::vector<uint16_t>{31, 64, 97}));
+}
+
+TEST(MapperTest, copy_keeps_banks) {
+  NesMmu mmu{make_cartridge(2, 8, 0)};
+  mmu.write(0x8000, 5);
+  NesMmu copy = mmu;
+  mmu.write(0x8000, 1);
+  EXPECT_EQ(copy.read(0x8000), 5);
+  copy.write(0x8000, 6);
+  EXPECT_EQ(copy.read(0x8000), 6);
+  EXPECT_EQ(mmu.read(0x8000), 1);
+}
+
+}  // namespace nesem
@@ -36,4 +36,80 @@ TEST_F(MmuTest, read_prg_large) {
   ASSERT_EQ(mmu.read(0xC005), 0x06);
 }
 
+TEST_F(MmuTest, read_prg_mirrored_pages) {
+  cartridge.prg.insert(cartridge.prg.begin(), 0x4000, 0);
+  cartridge.prg[0x3FFF] = 0x06;
+  mmu = {cartridge};
+  ASSERT_EQ(mmu.read(0xBFFF), 0x06);
+  ASSERT_EQ(mmu.read(0xFFFF), 0x06);
+  ASSERT_EQ(static_cast<const NesMmu &>(mmu).read(0xFFFF), 0x06);
+}
+
+TEST_F(MmuTest, copy_maps_own_memory) {
+  NesMmu copy = mmu;
+  copy.write(0x05, 0x06);
+  ASSERT_EQ(copy.read(0x0805), 0x06);
+  ASSERT_EQ(mmu.read(0x05), 0x00);
+}
+
+TEST_F(MmuTest, map_pages) {
+  std::array<uint8_t, 0x200> bank = {0};
+  bank[0x105] = 0x06;
+  mmu.map_pages(0x60, 2, bank.data(), bank.data());
+  ASSERT_EQ(mmu.read(0x6105), 0x06);
+  mmu.write(0x6005, 0x07);
+  ASSERT_EQ(bank[0x05], 0x07);
+
+  mmu.map_pages(0x60, 2, nullptr, nullptr);
+  ASSERT_EQ(static_cast<const NesMmu &>(mmu).read(0x6105), 0x00);
+}
+
+TEST_F(MmuTest, shared_rom) {
+  cartridge.prg.resize(0x8000);
+  cartridge.chr.resize(0x2000);
+  auto shared = std::make_shared<const Cartridge>(cartridge);
+  NesMmu a{shared};
+  NesMmu b{shared};
+  EXPECT_EQ(a.prg.get(), &shared->prg);
+  EXPECT_EQ(b.prg.get(), &shared->prg);
+  EXPECT_EQ(a.ppu.chr.get(), &shared->chr);
+  EXPECT_EQ(b.ppu.chr.get(), &shared->chr);
+}
+
+TEST_F(MmuTest, chr_ram_copied_on_write) {
+  cartridge.prg.resize(0x8000);
+  auto shared = std::make_shared<const Cartridge>(cartridge);
+  NesMmu a{shared};
+  NesMmu b{shared};
+  EXPECT_EQ(a.ppu.chr, b.ppu.chr);
+
+  a.write(0x2006, 0x00);
+  a.write(0x2006, 0x10);
+  a.write(0x2007, 0x06);
+  EXPECT_NE(a.ppu.chr, b.ppu.chr);
+  EXPECT_EQ(a.ppu.chr_at(0x0010), 0x06);
+  EXPECT_EQ(b.ppu.chr_at(0x0010), 0x00);
+}
+
+TEST_F(MmuTest, ppu_caught_up_at_register_access) {
+  cartridge.chr.resize(0x2000);
+  mmu = {cartridge};
+  size_t cycles = 0;
+  mmu.cpu_cycles = &cycles;
+
+  // vblank starts when the PPU enters scanline 241, at cpu cycle 27394
+  cycles = 27393;
+  EXPECT_FALSE(mmu.read(0x2002) & 0x80);
+  EXPECT_EQ(mmu.ppu.scanline, 240);
+  cycles = 27394;
+  EXPECT_TRUE(mmu.read(0x2002) & 0x80);
+  EXPECT_EQ(mmu.ppu.scanline, 241);
+
+  // Other accesses leave the PPU behind
+  cycles = 30000;
+  mmu.write(0x05, 0x06);
+  EXPECT_EQ(mmu.read(0x05), 0x06);
+  EXPECT_EQ(mmu.ppu_synced_cycle, 27394);
+}
+
 }  // namespace nesem
@@ -0,0 +1,175 @@
+#include "nes.h"
+
+#include <gtest/gtest.h>
+
+#include "assembler/assembler.h"
+#include "cartridge.h"
+#include "lockstep.h"
+#include "test_cartridge.h"
+
+namespace nesem {
+
+// Runs the same program step by step and with the batched run functions,
+// and compares the states where the runs stop: expected is stepped, and
+// actual runs batched
+class NesTest : public LockstepTest {
+ protected:
+  // Copies a page of RAM and counts the copies in $10, then waits for
+  // vblank with the NMI enabled
+  static constexpr const char* kProgram =
+      "LDA #$80 \n"
+      "STA $2000 \n"
+      "LDX #$00 \n"
+      "LDA $0200,X \n"  // $8007
+      "STA $0300,X \n"
+      "INX \n"
+      "BNE $F7 \n"
+      "INC $10 \n"
+      "LDA $2002 \n"  // $8013
+      "BPL $FB \n"
+      "JMP $8007";
+
+  using LockstepTest::load;
+
+  void load(const std::string& code) {
+    load(make_program_cartridge_with_nmi(code));
+  }
+
+  // Step until the same cycle as the batched run
+  void catch_up() {
+    while (expected->cpu.cycles < actual->cpu.cycles) expected->step();
+  }
+};
+
+TEST_F(NesTest, run_until_cycle) {
+  load(kProgram);
+
+  for (size_t cycle : {100, 101, 5000, 30000, 100000}) {
+    EXPECT_EQ(actual->run_until_cycle(cycle), RunStatus::CycleReached);
+    EXPECT_GE(actual->cpu.cycles, cycle);
+    EXPECT_LT(actual->cpu.cycles, cycle + 7);
+    catch_up();
+    expect_same_state();
+  }
+}
+
+TEST_F(NesTest, run_until_scanline) {
+  load(kProgram);
+
+  for (uint16_t scanline : {10, 100, 241, 261, 0, 0, 5}) {
+    EXPECT_EQ(actual->run_until_scanline(scanline),
+              RunStatus::ScanlineReached);
+    EXPECT_EQ(actual->mmu.ppu.scanline, scanline);
+    // Stopped after the instruction during which the scanline started
+    EXPECT_LT(actual->mmu.ppu.cycle, 7 * 3);
+    catch_up();
+    expect_same_state();
+  }
+}
+
+TEST_F(NesTest, run_frame) {
+  load(kProgram);
+
+  for (int frame = 1; frame <= 3; ++frame) {
+    EXPECT_EQ(actual->run_frame(), RunStatus::FrameCompleted);
+    EXPECT_EQ(actual->mmu.ppu.scanline, 0);
+    EXPECT_EQ(actual->mmu.wram[0x11], frame);
+    catch_up();
+    expect_same_state();
+  }
+}
+
+TEST_F(NesTest, run_frame_with_idle_loop_skip) {
+  load(kProgram);
+  actual->idle_loop_skip = true;
+
+  for (int frame = 1; frame <= 3; ++frame) {
+    actual->run_until_scanline(120);
+    EXPECT_EQ(actual->mmu.ppu.scanline, 120);
+    catch_up();
+    expect_same_state();
+
+    actual->run_frame();
+    EXPECT_EQ(actual->mmu.ppu.scanline, 0);
+    catch_up();
+    expect_same_state();
+  }
+  EXPECT_GT(actual->idle_cycles_skipped, 0);
+}
+
+TEST_F(NesTest, run_frame_with_fusion) {
+  load(kProgram);
+  actual->cpu.set_fusion_enabled(true);
+
+  for (int frame = 1; frame <= 3; ++frame) {
+    actual->run_until_cycle(frame * 20000 + 1);
+    catch_up();
+    expect_same_state();
+
+    actual->run_frame();
+    catch_up();
+    expect_same_state();
+  }
+}
+
+// Batched runs go through the interpreter loop (threaded with
+// NESEM_THREADED_DISPATCH), and stop in time for an IRQ of the mapper that
+// gets scheduled while they run
+TEST_F(NesTest, run_frame_with_mapper_irq) {
+  Cartridge cartridge;
+  cartridge.mapper = 4;  // MMC3
+  cartridge.prg.resize(0x8000);
+  cartridge.chr.resize(0x2000);
+  // Enable rendering and an IRQ at scanline 32, then count in $10
+  std::vector<uint8_t> code = assembler::assemble(
+      "LDA #$08 \n"
+      "STA $2000 \n"
+      "LDA #$18 \n"
+      "STA $2001 \n"
+      "LDA #$20 \n"
+      "STA $C000 \n"
+      "STA $C001 \n"
+      "STA $E001 \n"
+      "CLI \n"
+      "INC $10 \n"  // $E016
+      "JMP $E016");
+  std::copy(code.begin(), code.end(), cartridge.prg.begin() + 0x6000);
+  // IRQ handler counting IRQs in $11
+  std::vector<uint8_t> irq = assembler::assemble(
+      "INC $11 \n"
+      "STA $E000 \n"
+      "STA $E001 \n"
+      "RTI");
+  std::copy(irq.begin(), irq.end(), cartridge.prg.begin() + 0x6100);
+  cartridge.prg[0x7FFC] = 0x00;
+  cartridge.prg[0x7FFD] = 0xE0;
+  cartridge.prg[0x7FFE] = 0x00;
+  cartridge.prg[0x7FFF] = 0xE1;
+  load(cartridge);
+
+  for (int frame = 1; frame <= 3; ++frame) {
+    EXPECT_EQ(actual->run_frame(), RunStatus::FrameCompleted);
+    catch_up();
+    expect_same_state();
+  }
+  EXPECT_GT(actual->mmu.wram[0x11], 3);
+}
+
+TEST_F(NesTest, run_jammed) {
+  load(
+      "INC $10 \n"
+      "JAM");
+
+  EXPECT_EQ(actual->run_frame(), RunStatus::Jammed);
+  EXPECT_EQ(actual->cpu.pc, 0x8002);
+  size_t cycles = actual->cpu.cycles;
+  EXPECT_EQ(actual->run_until_cycle(cycles + 1000), RunStatus::Jammed);
+  EXPECT_EQ(actual->cpu.cycles, cycles);
+
+  actual->reset();
+  EXPECT_EQ(actual->run_until_cycle(actual->cpu.cycles + 5),
+            RunStatus::CycleReached);
+  EXPECT_EQ(actual->mmu.wram[0x10], 2);
+}
+
+}  // namespace nesem
@@ -3,6 +3,7 @@
 #include <filesystem>
 #include <fstream>
 
+#include "aot.h"
 #include "cartridge.h"
 #include "cpu.h"
 #include "mmu.h"
@@ -14,6 +15,9 @@ const std::filesystem::path kNestestPath = kTestDir / "nestest.nes";
 const std::filesystem::path kExpectedPath = kTestDir / "nestest.log";
 const std::filesystem::path kActualPath = kTestDir / "nestest_actual.log";
 
+// nestest.nes translated by nesem_recompile at build time
+extern const nesem::AotProgram kNestestAot;
+
 nesem::Cartridge load_nestest_cartridge() {
   if (!std::filesystem::exists(kNestestPath))
     throw std::runtime_error(
@@ -27,9 +31,24 @@ nesem::Cartridge load_nestest_cartridge() {
   }
 }
 
-void trace_nestest(std::ostream *output) {
+enum class Mode { kInterpreter, kDecodeCache, kFusion, kJit, kAot };
+
+// Whether a step may execute several instructions
+bool is_multistep(Mode mode) {
+  return mode == Mode::kFusion || mode == Mode::kJit || mode == Mode::kAot;
+}
+
+// Cycle count of the last instruction of the expected log
+constexpr size_t kLastCycle = 26554;
+
+void trace_nestest(std::ostream *output, Mode mode) {
   nesem::Cartridge cartridge = load_nestest_cartridge();
   nesem::Nes nes{cartridge};
+  nes.cpu.set_decode_cache_enabled(mode == Mode::kDecodeCache);
+  nes.cpu.set_fusion_enabled(mode == Mode::kFusion);
+  nes.set_jit_enabled(mode == Mode::kJit, 1);
+  if (mode == Mode::kAot && !nes.set_aot_program(&kNestestAot))
+    throw std::runtime_error("Translated program does not match nestest.nes");
   nes.reset();
 
   // Special state for this test
@@ -40,6 +59,15 @@ void trace_nestest(std::ostream *output) {
   nes.cpu.write(0x4007, 0xFF);
   nes.cpu.write(0x4015, 0xFF);
 
+  if (is_multistep(mode)) {
+    // Only the state between steps can be traced
+    while (nes.cpu.cycles <= kLastCycle) {
+      *output << nesem::trace_explain_state(nes) << "\n";
+      nes.step();
+    }
+    return;
+  }
+
   for (int i = 0; i < 8991; ++i) {
     *output << nesem::trace_explain_state(nes) << "\n";
     nes.step();
@@ -71,19 +99,61 @@ void verify_match(std::istream *expected, std::istream *actual) {
   }
 }
 
+std::string cycle_of(const std::string &line) {
+  size_t pos = line.rfind("CYC:");
+  return pos == std::string::npos ? "" : rtrim(line.substr(pos));
+}
+
+// Check that every line of the actual output matches the line of the
+// expected output with the same cycle count, in order
+void verify_subsequence(std::istream *expected, std::istream *actual) {
+  expected->seekg(0, std::ios::beg);
+  actual->seekg(0, std::ios::beg);
+
+  int line = 0;
+  std::string expected_line;
+  std::string actual_line;
+  while (std::getline(*actual, actual_line)) {
+    std::string cycle = cycle_of(actual_line);
+    do {
+      if (!std::getline(*expected, expected_line))
+        throw std::runtime_error(fmt::format(
+            "No expected line for {}:\n  Actual:\n    {}", cycle, actual_line));
+      ++line;
+    } while (cycle_of(expected_line) != cycle);
+
+    if (rtrim(expected_line) != rtrim(actual_line))
+      throw std::runtime_error(fmt::format(
+          "Mismatch at line {}:\n  Expected:\n    {}\n  Actual:\n    {}",
+          line - 1, expected_line, actual_line));
+  }
+}
+
 int main() {
-  try {
-    std::fstream expected{kExpectedPath};
-    std::fstream actual{kActualPath, std::fstream::out | std::fstream::in};
-
-    fmt::print("Running {}\n", kNestestPath.string());
-    trace_nestest(&actual);
-    fmt::print("Comparing results with {}\n", kExpectedPath.string());
-    verify_match(&expected, &actual);
-    fmt::print("{}\n", "Output succesfully matched.");
-  } catch (const std::exception &e) {
-    fmt::print("{}\nActual results written to {}\n", e.what(),
-               kActualPath.string());
-    return 1;
+  for (Mode mode : {Mode::kInterpreter, Mode::kDecodeCache, Mode::kFusion,
+                    Mode::kJit, Mode::kAot}) {
+    try {
+      std::fstream expected{kExpectedPath};
+      std::fstream actual{kActualPath, std::fstream::out | std::fstream::in |
+                                           std::fstream::trunc};
+
+      fmt::print("Running {}{}\n", kNestestPath.string(),
+                 mode == Mode::kDecodeCache ? " with decode cache"
+                 : mode == Mode::kFusion    ? " with fused instructions"
+                 : mode == Mode::kJit       ? " with jit"
+                 : mode == Mode::kAot       ? " with translated code"
+                                            : "");
+      trace_nestest(&actual, mode);
+      fmt::print("Comparing results with {}\n", kExpectedPath.string());
+      if (is_multistep(mode))
+        verify_subsequence(&expected, &actual);
+      else
+        verify_match(&expected, &actual);
+      fmt::print("{}\n", "Output succesfully matched.");
+    } catch (const std::exception &e) {
+      fmt::print("{}\nActual results written to {}\n", e.what(),
+                 kActualPath.string());
+      return 1;
+    }
   }
 }
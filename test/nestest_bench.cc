@@ -0,0 +1,94 @@
+// Headless throughput benchmark.
+//
+// Replays the automated nestest.nes run (the same instruction stream that
+// nestest verifies) many times and reports how many emulated instructions
+// are executed per second of host time.
+//
+// Usage: nestest_bench [iterations] [--decode-cache] [--fusion] [--jit]
+
+#include <fmt/core.h>
+
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+#include "cartridge.h"
+#include "nes.h"
+
+const std::filesystem::path kTestDir{TEST_DIR};
+const std::filesystem::path kNestestPath = kTestDir / "nestest.nes";
+
+// Number of instructions in the automated run, i.e. the length of nestest.log
+constexpr int kNestestInstructions = 8991;
+
+// Number of cycles taken by the automated run. Compiled code executes several
+// instructions per step, so runs are delimited by cycles rather than steps.
+constexpr size_t kNestestCycles = 26560;
+
+int main(int argc, char **argv) {
+  int iterations = 2000;
+  bool decode_cache = false;
+  bool fusion = false;
+  bool jit = false;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--decode-cache") == 0)
+      decode_cache = true;
+    else if (strcmp(argv[i], "--fusion") == 0)
+      fusion = true;
+    else if (strcmp(argv[i], "--jit") == 0)
+      jit = true;
+    else
+      iterations = atoi(argv[i]);
+  }
+
+  std::fstream fs{kNestestPath};
+  nesem::Cartridge cartridge;
+  try {
+    cartridge = nesem::load_ines_rom_dump(&fs);
+  } catch (const std::exception &e) {
+    fmt::print(stderr, "Failed to load ines file {}: {}\n",
+               kNestestPath.string(), e.what());
+    return 1;
+  }
+
+  std::chrono::steady_clock::duration elapsed{};
+  size_t instructions = 0;
+  size_t cycles = 0;
+  std::array<uint64_t, nesem::kNumFusedIdioms> fusion_hits = {0};
+  for (int i = 0; i < iterations; ++i) {
+    nesem::Nes nes{cartridge};
+    nes.cpu.set_decode_cache_enabled(decode_cache);
+    nes.cpu.set_fusion_enabled(fusion);
+    nes.set_jit_enabled(jit);
+    nes.reset();
+    nes.cpu.pc = 0xC000;
+    nes.cpu.write(0x4004, 0xFF);
+    nes.cpu.write(0x4005, 0xFF);
+    nes.cpu.write(0x4006, 0xFF);
+    nes.cpu.write(0x4007, 0xFF);
+    nes.cpu.write(0x4015, 0xFF);
+
+    auto start = std::chrono::steady_clock::now();
+    nes.run_until_cycle(kNestestCycles);
+    elapsed += std::chrono::steady_clock::now() - start;
+
+    instructions += kNestestInstructions;
+    cycles += nes.cpu.cycles;
+    for (size_t j = 0; j < fusion_hits.size(); ++j)
+      fusion_hits[j] += nes.cpu.fusion_hits[j];
+  }
+
+  double seconds = std::chrono::duration<double>(elapsed).count();
+  fmt::print("{} instructions, {} cycles in {:.3f}s\n", instructions, cycles,
+             seconds);
+  if (fusion) {
+    for (size_t j = 0; j < fusion_hits.size(); ++j)
+      fmt::print("{:<16} {} hits\n", nesem::fused_idiom_names[j],
+                 fusion_hits[j]);
+  }
+  fmt::print("{:.2f} M instructions/s\n", instructions / seconds / 1e6);
+  return 0;
+}
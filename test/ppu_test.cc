@@ -8,7 +8,7 @@ class PpuTest : public ::testing::Test {
  protected:
   Ppu ppu;
 
-  PpuTest() { ppu.chr.insert(ppu.chr.begin(), 8 * 1024, 0); }
+  PpuTest() { ppu.chr = std::make_shared<std::vector<uint8_t>>(8 * 1024); }
 };
 
 TEST_F(PpuTest, write_ctrl) {
@@ -0,0 +1,63 @@
+#include "profile.h"
+
+#include <gtest/gtest.h>
+
+#include "assembler/assembler.h"
+#include "cpu.h"
+
+namespace nesem {
+
+TEST(ProfileTest, dump_text) {
+  ExecutionProfile profile;
+  profile.record(0xA9, 0x8000, 2);
+  profile.record(0xE8, 0x8002, 2);
+  profile.record(0xE8, 0x8002, 2);
+
+  std::string text = profile.dump_text();
+  // Sorted by cycles
+  EXPECT_LT(text.find("E8 INX"), text.find("A9 LDA"));
+  EXPECT_NE(text.find("8002                    2              4  66.67%"),
+            std::string::npos)
+      << text;
+  EXPECT_EQ(text.find("4C JMP"), std::string::npos);
+}
+
+TEST(ProfileTest, dump_json) {
+  ExecutionProfile profile;
+  profile.record(0xA9, 0x8000, 2);
+  profile.record(0x4C, 0x8002, 3);
+
+  EXPECT_EQ(profile.dump_json(),
+            "{\"opcodes\":["
+            "{\"opcode\":\"4C\",\"mnemonic\":\"JMP\",\"executions\":1,"
+            "\"cycles\":3},"
+            "{\"opcode\":\"A9\",\"mnemonic\":\"LDA\",\"executions\":1,"
+            "\"cycles\":2}],"
+            "\"pcs\":["
+            "{\"pc\":\"8002\",\"executions\":1,\"cycles\":3},"
+            "{\"pc\":\"8000\",\"executions\":1,\"cycles\":2}]}");
+}
+
+TEST(ProfileTest, cpu_records_instructions) {
+  RamOnlyMmu mmu;
+  Cpu cpu(&mmu);
+  if (!cpu.set_profiling_enabled(true)) GTEST_SKIP() << "NESEM_PROFILE off";
+
+  std::vector<uint8_t> prg = assembler::assemble(
+      "LDX #$00 \n"
+      "INX \n"  // $8002
+      "BNE $FD");
+  for (int i = 0; i < prg.size(); ++i) cpu.write(0x8000 + i, prg[i]);
+  cpu.write16(Cpu::kResetVector, 0x8000);
+  cpu.reset();
+  while (cpu.pc != 0x8005) cpu.step();
+
+  const ExecutionProfile &profile = *cpu.profile;
+  EXPECT_EQ(profile.opcodes[0xE8].executions, 256);
+  EXPECT_EQ(profile.pcs[0x8002].executions, 256);
+  // 255 taken branches in the same page, and 1 not taken
+  EXPECT_EQ(profile.opcodes[0xD0].cycles, 255 * 3 + 2);
+  EXPECT_EQ(profile.pcs[0x8000].cycles, 2);
+}
+
+}  // namespace nesem
@@ -0,0 +1,163 @@
+#include "recompiler/recompiler.h"
+
+#include <gtest/gtest.h>
+
+#include <sstream>
+
+#include "aot.h"
+#include "assembler/assembler.h"
+#include "cartridge.h"
+#include "nes.h"
+
+namespace nesem {
+
+namespace {
+
+Cartridge make_cartridge(const std::string& code) {
+  Cartridge cartridge;
+  cartridge.write_prg(0x8000, assembler::assemble(code));
+  cartridge.chr.resize(0x2000);
+  return cartridge;
+}
+
+std::vector<uint16_t> starts(
+    const std::map<uint16_t, recompiler::BasicBlock>& blocks) {
+  std::vector<uint16_t> result;
+  for (const auto& [start, block] : blocks) result.push_back(start);
+  return result;
+}
+
+}  // namespace
+
+TEST(RecompilerTest, splits_code_into_basic_blocks) {
+  Cartridge cartridge = make_cartridge(
+      "LDX #$03 \n"
+      "JSR $800B \n"
+      "DEX \n"
+      "BNE $FA \n"
+      "JMP $8008 \n"
+      "PHA \n"
+      "PLA \n"
+      "INY \n"
+      "RTS");
+  auto blocks = recompiler::discover(cartridge);
+
+  EXPECT_EQ(starts(blocks),
+            (std::vector<uint16_t>{0x8000, 0x8002, 0x8005, 0x8008, 0x800B}));
+  EXPECT_EQ(blocks[0x8000].instructions, std::vector<uint16_t>{0x8000});
+  EXPECT_EQ(blocks[0x8005].instructions,
+            (std::vector<uint16_t>{0x8005, 0x8006}));
+  EXPECT_EQ(blocks[0x800B].instructions,
+            (std::vector<uint16_t>{0x800B, 0x800C, 0x800D, 0x800E}));
+}
+
+TEST(RecompilerTest, leaves_io_accesses_to_interpreter) {
+  Cartridge cartridge = make_cartridge(
+      "LDA #$80 \n"
+      "STA $2000 \n"
+      "LDA $10 \n"
+      "JMP $8005");
+  auto blocks = recompiler::discover(cartridge);
+
+  EXPECT_EQ(starts(blocks), (std::vector<uint16_t>{0x8000, 0x8005}));
+  EXPECT_EQ(blocks[0x8005].instructions,
+            (std::vector<uint16_t>{0x8005, 0x8007}));
+}
+
+TEST(RecompilerTest, follows_additional_entries) {
+  Cartridge cartridge = make_cartridge(
+      "JMP $8000 \n"
+      "INX \n"
+      "RTS");
+  EXPECT_EQ(starts(recompiler::discover(cartridge)),
+            std::vector<uint16_t>{0x8000});
+  EXPECT_EQ(starts(recompiler::discover(cartridge, {0x8003})),
+            (std::vector<uint16_t>{0x8000, 0x8003}));
+}
+
+TEST(RecompilerTest, rejects_bank_switching_mappers) {
+  Cartridge cartridge = make_cartridge("JMP $8000");
+  cartridge.mapper = 1;
+  EXPECT_ANY_THROW(recompiler::discover(cartridge));
+}
+
+TEST(RecompilerTest, emits_program) {
+  Cartridge cartridge = make_cartridge(
+      "LDA #$01 \n"
+      "STA $10 \n"
+      "JMP $8000");
+  std::stringstream ss;
+  recompiler::emit(cartridge, recompiler::discover(cartridge), "kProgram",
+                   &ss);
+  std::string output = ss.str();
+
+  EXPECT_NE(output.find("void block_8000(CpuState &cpu, uint8_t *wram)"),
+            std::string::npos);
+  EXPECT_NE(output.find("wram[0x010] = r.a;"), std::string::npos);
+  EXPECT_NE(output.find("{0x8000, 8, block_8000}"), std::string::npos);
+  EXPECT_NE(output.find("extern const nesem::AotProgram kProgram"),
+            std::string::npos);
+}
+
+namespace {
+
+// Translation of "INX; JMP $8000", as emitted by the recompiler
+void block_8000(CpuState& cpu, uint8_t* wram) {
+  AotRegs r{cpu};
+  r.x += 1;
+  r.set_nz(r.x);
+  r.cycles += 2;
+  r.cycles += 3;
+  return r.leave(cpu, 0x8000);
+}
+
+}  // namespace
+
+TEST(AotEngineTest, runs_blocks_within_budget) {
+  Cartridge cartridge = make_cartridge("INX \n JMP $8000");
+  const AotBlock blocks[] = {{0x8000, 5, block_8000}};
+  AotProgram program = {cartridge.prg.data(), cartridge.prg.size(), blocks, 1};
+
+  Nes nes{cartridge};
+  nes.reset();
+  ASSERT_TRUE(nes.set_aot_program(&program));
+  size_t cycles = nes.cpu.cycles;
+
+  AotEngine engine{program, &nes.mmu};
+  EXPECT_TRUE(engine.run(&nes.cpu, 12));
+  EXPECT_EQ(nes.cpu.x, 2);
+  EXPECT_EQ(nes.cpu.cycles, cycles + 10);
+  EXPECT_FALSE(engine.run(&nes.cpu, 4));
+}
+
+TEST(AotEngineTest, stops_while_ram_code_is_predecoded) {
+  Cartridge cartridge = make_cartridge("INX \n JMP $8000");
+  const AotBlock blocks[] = {{0x8000, 5, block_8000}};
+  AotProgram program = {cartridge.prg.data(), cartridge.prg.size(), blocks, 1};
+
+  Nes nes{cartridge};
+  nes.reset();
+  nes.cpu.set_decode_cache_enabled(true);
+  AotEngine engine{program, &nes.mmu};
+  EXPECT_TRUE(engine.run(&nes.cpu, 5, nes.cpu.decoded_blocks()));
+
+  // JMP $8000, from CPU RAM
+  nes.mmu.wram[0x300] = 0x4C;
+  nes.mmu.wram[0x301] = 0x00;
+  nes.mmu.wram[0x302] = 0x80;
+  nes.cpu.pc = 0x0300;
+  nes.cpu.step();
+  EXPECT_EQ(nes.cpu.pc, 0x8000);
+  EXPECT_FALSE(engine.run(&nes.cpu, 5, nes.cpu.decoded_blocks()));
+}
+
+TEST(AotEngineTest, rejects_other_cartridges) {
+  Cartridge cartridge = make_cartridge("INX \n JMP $8000");
+  const AotBlock blocks[] = {{0x8000, 5, block_8000}};
+  AotProgram program = {cartridge.prg.data(), cartridge.prg.size(), blocks, 1};
+
+  Nes nes{make_cartridge("DEX \n JMP $8000")};
+  EXPECT_FALSE(nes.set_aot_program(&program));
+}
+
+}  // namespace nesem
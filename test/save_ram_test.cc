@@ -0,0 +1,107 @@
+#include "save_ram.h"
+
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+
+#include "mmu.h"
+
+namespace nesem {
+
+class SaveRamTest : public ::testing::Test {
+ protected:
+  std::filesystem::path path =
+      std::filesystem::path(::testing::TempDir()) /
+      (std::string(::testing::UnitTest::GetInstance()
+                       ->current_test_info()
+                       ->name()) +
+       ".sav");
+  NesMmu mmu;
+
+  SaveRamTest() { std::filesystem::remove(path); }
+  ~SaveRamTest() { std::filesystem::remove(path); }
+
+  std::vector<uint8_t> file_contents() const {
+    std::ifstream in{path, std::ios::binary};
+    return {std::istreambuf_iterator<char>(in),
+            std::istreambuf_iterator<char>()};
+  }
+};
+
+TEST_F(SaveRamTest, prg_ram_without_battery) {
+  mmu.write(0x6005, 0x06);
+  mmu.write(0x7FFF, 0x07);
+  EXPECT_EQ(mmu.read(0x6005), 0x06);
+  EXPECT_EQ(mmu.read(0x7FFF), 0x07);
+}
+
+TEST_F(SaveRamTest, creates_blank_file) {
+  mmu.set_save_ram(std::make_shared<SaveRam>(path.string()));
+  EXPECT_EQ(file_contents(), std::vector<uint8_t>(SaveRam::kSize, 0));
+  EXPECT_EQ(mmu.read(0x6000), 0);
+}
+
+TEST_F(SaveRamTest, loads_existing_file) {
+  {
+    std::ofstream out{path, std::ios::binary};
+    out.put(0x11);
+    out.put(0x22);
+  }
+  mmu.set_save_ram(std::make_shared<SaveRam>(path.string()));
+  EXPECT_EQ(mmu.read(0x6000), 0x11);
+  EXPECT_EQ(mmu.read(0x6001), 0x22);
+  EXPECT_EQ(mmu.read(0x6002), 0x00);
+  EXPECT_EQ(file_contents().size(), SaveRam::kSize);
+}
+
+TEST_F(SaveRamTest, keeps_larger_file) {
+  std::vector<uint8_t> contents(SaveRam::kSize + 0x100, 0x33);
+  {
+    std::ofstream out{path, std::ios::binary};
+    out.write(reinterpret_cast<const char *>(contents.data()),
+              contents.size());
+  }
+  mmu.set_save_ram(std::make_shared<SaveRam>(path.string()));
+  EXPECT_EQ(mmu.read(0x6000), 0x33);
+  mmu.write(0x6000, 0x44);
+  mmu.set_save_ram(nullptr);
+
+  contents[0] = 0x44;
+  EXPECT_EQ(file_contents(), contents);
+}
+
+TEST_F(SaveRamTest, written_pages_marked_dirty) {
+  auto save_ram = std::make_shared<SaveRam>(path.string());
+  mmu.set_save_ram(save_ram);
+
+  mmu.write(0x6105, 0x06);
+  mmu.write(0x6106, 0x07);
+  EXPECT_TRUE(save_ram->is_dirty(1));
+  EXPECT_FALSE(save_ram->is_dirty(0));
+  EXPECT_EQ(mmu.read(0x6105), 0x06);
+  EXPECT_EQ(mmu.read(0x6106), 0x07);
+
+  mmu.flush_save_ram();
+  EXPECT_FALSE(save_ram->is_dirty(1));
+  std::vector<uint8_t> contents = file_contents();
+  EXPECT_EQ(contents[0x105], 0x06);
+  EXPECT_EQ(contents[0x106], 0x07);
+
+  // Writes after a flush mark the page dirty again
+  mmu.write(0x6107, 0x08);
+  EXPECT_TRUE(save_ram->is_dirty(1));
+}
+
+TEST_F(SaveRamTest, kept_across_instances) {
+  mmu.set_save_ram(std::make_shared<SaveRam>(path.string()));
+  mmu.write(0x7000, 0x42);
+  mmu.set_save_ram(nullptr);
+
+  NesMmu other;
+  other.set_save_ram(std::make_shared<SaveRam>(path.string()));
+  EXPECT_EQ(other.read(0x7000), 0x42);
+}
+
+}  // namespace nesem
@@ -0,0 +1,50 @@
+// Cartridges shared by the tests: banked ones for mappers and the features
+// built on bank switching, and ones running a program from $8000
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "assembler/assembler.h"
+#include "cartridge.h"
+
+namespace nesem {
+
+// Cartridge whose banks are filled with their number: 16KB PRG banks and
+// 4KB CHR banks
+inline Cartridge make_cartridge(uint8_t mapper, size_t prg_banks,
+                                size_t chr_banks = 0) {
+  Cartridge cartridge;
+  cartridge.mapper = mapper;
+  for (size_t bank = 0; bank < prg_banks; ++bank)
+    cartridge.prg.insert(cartridge.prg.end(), 0x4000, bank);
+  for (size_t bank = 0; bank < chr_banks; ++bank)
+    cartridge.chr.insert(cartridge.chr.end(), 0x1000, bank);
+  return cartridge;
+}
+
+// Mapper 0 cartridge with the program assembled at $8000, and CHR RAM
+inline Cartridge make_program_cartridge(const std::string& code) {
+  Cartridge cartridge;
+  cartridge.write_prg(0x8000, assembler::assemble(code));
+  cartridge.chr.resize(0x2000);
+  return cartridge;
+}
+
+// Same, with an NMI handler at $9000 counting NMIs in $11
+inline Cartridge make_program_cartridge_with_nmi(const std::string& code) {
+  Cartridge cartridge = make_program_cartridge(code);
+  std::vector<uint8_t> nmi = assembler::assemble(
+      "INC $11 \n"
+      "RTI");
+  std::copy(nmi.begin(), nmi.end(), cartridge.prg.begin() + 0x1000);
+  cartridge.prg[0xFFFA - 0x8000] = 0x00;
+  cartridge.prg[0xFFFB - 0x8000] = 0x90;
+  return cartridge;
+}
+
+}  // namespace nesem